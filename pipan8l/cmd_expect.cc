@@ -0,0 +1,493 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// tcl command to match tty printer output against patterns
+// a thread reads the printer into a ring buffer so characters aren't lost between calls
+// and tcl doesn't have to go through the interpreter for every character
+//  pipan8l: reads the printer pipe opened by openttypipes
+//  z8lpanel: reads the fpga tty 03 printer registers directly
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmd_expect.h"
+#include "tclmain.h"
+#include "z8ldefs.h"
+#include "z8lutil.h"
+
+#define RINGSIZE 65536          // printer chars kept that haven't been matched yet
+#define WAITSLICEMS 100         // check for control-C this often when waiting
+
+#define EXPLOCK if (pthread_mutex_lock (&explock) != 0) ABORT ()
+#define EXPUNLK if (pthread_mutex_unlock (&explock) != 0) ABORT ()
+
+static bool expecho;            // thread copies chars to stdout as received
+static bool exprunning;         // thread started and not yet joined
+static bool expstopping;        // tell thread to exit
+static bool expthdone;          // thread exited (stopped or read error)
+static char expring[RINGSIZE];  // chars received, [exptail..exphead-1] not yet matched
+static char expscratch[RINGSIZE+1];
+static int experrno;            // error thread got reading fd
+static int expfd = -1;          // reading this fd (pipan8l)
+static pthread_cond_t expcond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t explock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t expthid;
+static uint32_t volatile *expttyat;  // reading these tty registers (z8lpanel)
+static uint64_t expdropped;     // chars dropped because ring overflowed
+static uint64_t exphead;        // total chars received
+static uint64_t exptail;        // total chars matched or discarded
+static Z8LPage *expz8p;
+
+static int expectstart (Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+static void expectstop ();
+static int expectmatch (Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+static int expectgetc (Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+static bool expectwait (uint64_t seen, struct timespec const *deadline);
+static uint32_t copyunmatched (uint64_t *tail_r);
+static void *expthread (void *dummy);
+
+int cmd_expect (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc >= 2) {
+        char const *subcmd = Tcl_GetString (objv[1]);
+        if (strcasecmp (subcmd, "help") == 0) {
+            puts ("");
+            puts ("  expect start [-echo] <fileid> | tty - start reading printer output in background");
+            puts ("    <fileid> = channel to read from (pipan8l, eg, printer pipe from openttypipes)");
+            puts ("    tty = fpga tty 03 printer registers (z8lpanel)");
+            puts ("    -echo = copy printer output to stdout as it is received");
+            puts ("  expect stop - stop reading printer output");
+            puts ("");
+            puts ("  expect match [-before <varname>] [-exact] [-nocase] [-timeout <ms>] <pattern> ...");
+            puts ("    wait for printer output to match any of the extended regular expressions");
+            puts ("    returns {<index> <matchedtext> <capture1> ...} or {} if timed out or control-C");
+            puts ("      <index> = which pattern matched, starting at 0, earliest match wins");
+            puts ("    output up to end of match is consumed");
+            puts ("    patterns are tried as output arrives so a match can end early, eg, {V([0-9]+)} matches");
+            puts ("      V3 when only that much has been printed, end such patterns with \\r or similar");
+            puts ("    -before = set variable to output skipped over before the match");
+            puts ("    -exact = patterns are plain strings");
+            puts ("    -nocase = ignore case");
+            puts ("    -timeout = give up after this many milliseconds, default 30000");
+            puts ("");
+            puts ("  expect getc [<ms>] - get next printer char, null string if none within ms, default 0");
+            puts ("  expect flush - discard and return unmatched printer output");
+            puts ("  expect stats - return {<received> <unmatched> <dropped>} char counts");
+            puts ("");
+            puts ("  printer chars have parity stripped and nulls removed");
+            puts ("");
+            return TCL_OK;
+        }
+
+        if (strcasecmp (subcmd, "start") == 0) return expectstart (interp, objc, objv);
+
+        if ((strcasecmp (subcmd, "stop") == 0) && (objc == 2)) {
+            expectstop ();
+            return TCL_OK;
+        }
+
+        if (! exprunning) {
+            Tcl_SetResultF (interp, "expect not started");
+            return TCL_ERROR;
+        }
+
+        if (strcasecmp (subcmd, "match") == 0) return expectmatch (interp, objc, objv);
+        if (strcasecmp (subcmd, "getc") == 0) return expectgetc (interp, objc, objv);
+
+        if ((strcasecmp (subcmd, "flush") == 0) && (objc == 2)) {
+            uint64_t tail;
+            uint32_t len = copyunmatched (&tail);
+            EXPLOCK;
+            if (exptail < tail + len) exptail = tail + len;
+            EXPUNLK;
+            Tcl_SetObjResult (interp, Tcl_NewStringObj (expscratch, len));
+            return TCL_OK;
+        }
+
+        if ((strcasecmp (subcmd, "stats") == 0) && (objc == 2)) {
+            EXPLOCK;
+            Tcl_Obj *stats[3] = { Tcl_NewWideIntObj (exphead), Tcl_NewWideIntObj (exphead - exptail), Tcl_NewWideIntObj (expdropped) };
+            EXPUNLK;
+            Tcl_SetObjResult (interp, Tcl_NewListObj (3, stats));
+            return TCL_OK;
+        }
+    }
+    Tcl_SetResultF (interp, "missing/unknown sub-command");
+    return TCL_ERROR;
+}
+
+// expect start [-echo] <fileid> | tty
+static int expectstart (Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    bool echo = false;
+    char const *source = NULL;
+    for (int i = 1; ++ i < objc;) {
+        char const *arg = Tcl_GetString (objv[i]);
+        if (strcasecmp (arg, "-echo") == 0) {
+            echo = true;
+            continue;
+        }
+        if ((arg[0] == '-') || (source != NULL)) {
+            Tcl_SetResultF (interp, "unknown argument %s", arg);
+            return TCL_ERROR;
+        }
+        source = arg;
+    }
+    if (source == NULL) {
+        Tcl_SetResultF (interp, "missing <fileid> or tty");
+        return TCL_ERROR;
+    }
+    if (exprunning) {
+        Tcl_SetResultF (interp, "expect already started");
+        return TCL_ERROR;
+    }
+
+    expfd    = -1;
+    expttyat = NULL;
+    if (strcasecmp (source, "tty") == 0) {
+        if (expz8p == NULL) expz8p = new Z8LPage ();
+        expttyat = expz8p->findev ("TT", NULL, NULL, false);
+    } else {
+        int mode;
+        ClientData handle;
+        Tcl_Channel chan = Tcl_GetChannel (interp, source, &mode);
+        if (chan == NULL) return TCL_ERROR;
+        if (! (mode & TCL_READABLE) || (Tcl_GetChannelHandle (chan, TCL_READABLE, &handle) != TCL_OK)) {
+            Tcl_SetResultF (interp, "%s not readable by fd", source);
+            return TCL_ERROR;
+        }
+
+        // thread reads the fd directly so anything tcl already buffered would be skipped
+        if (Tcl_InputBuffered (chan) > 0) {
+            Tcl_SetResultF (interp, "%s has input buffered in tcl", source);
+            return TCL_ERROR;
+        }
+        expfd = (int) (intptr_t) handle;
+    }
+
+    expecho     = echo;
+    expstopping = false;
+    expthdone   = false;
+    experrno    = 0;
+    exphead     = 0;
+    exptail     = 0;
+    expdropped  = 0;
+    if (pthread_create (&expthid, NULL, expthread, NULL) != 0) ABORT ();
+    exprunning  = true;
+    return TCL_OK;
+}
+
+// tell thread to stop and wait for it
+static void expectstop ()
+{
+    if (exprunning) {
+        expstopping = true;
+        pthread_join (expthid, NULL);
+        exprunning  = false;
+    }
+}
+
+// expect match [-before <varname>] [-exact] [-nocase] [-timeout <ms>] <pattern> ...
+static int expectmatch (Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    bool exact = false;
+    char const *beforevar = NULL;
+    int cflags = REG_EXTENDED;
+    int npats = 0;
+    int rc = TCL_ERROR;
+    int timeoutms = 30000;
+    regex_t *regexs = (regex_t *) malloc (objc * sizeof *regexs);
+    if (regexs == NULL) ABORT ();
+
+    for (int i = 1; ++ i < objc;) {
+        char const *arg = Tcl_GetString (objv[i]);
+        if (strcasecmp (arg, "-before") == 0) {
+            if (++ i >= objc) {
+                Tcl_SetResultF (interp, "missing variable name after -before");
+                goto reterr;
+            }
+            beforevar = Tcl_GetString (objv[i]);
+            continue;
+        }
+        if (strcasecmp (arg, "-exact") == 0) {
+            exact = true;
+            continue;
+        }
+        if (strcasecmp (arg, "-nocase") == 0) {
+            cflags |= REG_ICASE;
+            continue;
+        }
+        if (strcasecmp (arg, "-timeout") == 0) {
+            if (++ i >= objc) {
+                Tcl_SetResultF (interp, "missing milliseconds after -timeout");
+                goto reterr;
+            }
+            if (Tcl_GetIntFromObj (interp, objv[i], &timeoutms) != TCL_OK) goto reterr;
+            continue;
+        }
+        if ((arg[0] == '-') && (arg[1] == '-') && (arg[2] == 0)) {
+            i ++;
+        } else if (arg[0] == '-') {
+            Tcl_SetResultF (interp, "unknown option %s, use -- before patterns starting with -", arg);
+            goto reterr;
+        }
+
+        // rest of args are patterns
+        for (; i < objc; i ++) {
+            char const *pat = Tcl_GetString (objv[i]);
+            char *esc = NULL;
+            if (exact) {
+                // backslash every char that means something in an extended regex
+                esc = (char *) malloc (strlen (pat) * 2 + 1);
+                if (esc == NULL) ABORT ();
+                char *p = esc;
+                for (char const *q = pat; *q != 0; q ++) {
+                    if (strchr ("\\^$.|?*+()[]{}", *q) != NULL) *(p ++) = '\\';
+                    *(p ++) = *q;
+                }
+                *p = 0;
+            }
+            int err = regcomp (&regexs[npats], exact ? esc : pat, cflags);
+            free (esc);
+            if (err != 0) {
+                char errbuf[128];
+                regerror (err, &regexs[npats], errbuf, sizeof errbuf);
+                Tcl_SetResultF (interp, "bad pattern %s: %s", pat, errbuf);
+                goto reterr;
+            }
+            npats ++;
+        }
+    }
+    if (npats == 0) {
+        Tcl_SetResultF (interp, "missing pattern");
+        goto reterr;
+    }
+
+    {
+        struct timespec deadline;
+        if (clock_gettime (CLOCK_REALTIME, &deadline) < 0) ABORT ();
+        deadline.tv_sec  += timeoutms / 1000;
+        deadline.tv_nsec += (timeoutms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec  ++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        // re-scan whole unmatched output whenever more arrives
+        // earliest match of any pattern wins, lowest index if tie
+        uint64_t seen = 0;
+        int maxsubs = 1;
+        for (int j = 0; j < npats; j ++) if (maxsubs < (int) regexs[j].re_nsub + 1) maxsubs = regexs[j].re_nsub + 1;
+        regmatch_t bestmatches[maxsubs], matches[maxsubs];
+        do {
+            uint64_t tail;
+            uint32_t len = copyunmatched (&tail);
+            seen = tail + len;
+            int best = -1;
+            for (int j = 0; j < npats; j ++) {
+                if ((regexec (&regexs[j], expscratch, regexs[j].re_nsub + 1, matches, 0) == 0) &&
+                        ((best < 0) || (matches[0].rm_so < bestmatches[0].rm_so))) {
+                    best = j;
+                    memcpy (bestmatches, matches, (regexs[j].re_nsub + 1) * sizeof *matches);
+                }
+            }
+            if (best >= 0) {
+
+                // consume through end of match, ring may have overflowed past it meanwhile
+                EXPLOCK;
+                if (exptail < tail + bestmatches[0].rm_eo) exptail = tail + bestmatches[0].rm_eo;
+                EXPUNLK;
+
+                int nsubs = regexs[best].re_nsub + 1;
+                Tcl_Obj *results[nsubs+1];
+                results[0] = Tcl_NewIntObj (best);
+                for (int k = 0; k < nsubs; k ++) {
+                    regmatch_t const *m = &bestmatches[k];
+                    results[k+1] = (m->rm_so < 0) ? Tcl_NewObj () : Tcl_NewStringObj (expscratch + m->rm_so, m->rm_eo - m->rm_so);
+                }
+                if ((beforevar != NULL) && (Tcl_SetVar2Ex (interp, beforevar, NULL,
+                        Tcl_NewStringObj (expscratch, bestmatches[0].rm_so), TCL_LEAVE_ERR_MSG) == NULL)) goto reterr;
+                Tcl_SetObjResult (interp, Tcl_NewListObj (nsubs + 1, results));
+                rc = TCL_OK;
+                goto reterr;
+            }
+        } while (expectwait (seen, &deadline));
+
+        if (expthdone && (experrno != 0)) {
+            Tcl_SetResultF (interp, "error reading printer: %s", strerror (experrno));
+            goto reterr;
+        }
+        rc = TCL_OK;
+    }
+
+reterr:;
+    while (-- npats >= 0) regfree (&regexs[npats]);
+    free (regexs);
+    return rc;
+}
+
+// expect getc [<ms>]
+static int expectgetc (Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    int timeoutms = 0;
+    if (objc > 3) {
+        Tcl_SetResultF (interp, "bad number of arguments");
+        return TCL_ERROR;
+    }
+    if ((objc == 3) && (Tcl_GetIntFromObj (interp, objv[2], &timeoutms) != TCL_OK)) return TCL_ERROR;
+
+    struct timespec deadline;
+    if (clock_gettime (CLOCK_REALTIME, &deadline) < 0) ABORT ();
+    deadline.tv_sec  += timeoutms / 1000;
+    deadline.tv_nsec += (timeoutms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec  ++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (true) {
+        EXPLOCK;
+        bool have = exptail < exphead;
+        char ch = expring[exptail%RINGSIZE];
+        if (have) exptail ++;
+        uint64_t tail = exptail;
+        EXPUNLK;
+        if (have) {
+            Tcl_SetObjResult (interp, Tcl_NewStringObj (&ch, 1));
+            break;
+        }
+        if (! expectwait (tail, &deadline)) break;
+    }
+    return TCL_OK;
+}
+
+// wait for more printer output
+//  input:
+//   seen = exphead value already looked at
+//   deadline = give up at this CLOCK_REALTIME time
+//  output:
+//   returns true: more output arrived
+//          false: timed out, control-C or thread exited
+static bool expectwait (uint64_t seen, struct timespec const *deadline)
+{
+    bool more = false;
+    EXPLOCK;
+    while (! (more = (exphead > seen)) && ! expthdone && ! ctrlcflag) {
+
+        // wake up every so often to check for control-C
+        struct timespec slice;
+        if (clock_gettime (CLOCK_REALTIME, &slice) < 0) ABORT ();
+        if ((slice.tv_sec > deadline->tv_sec) || ((slice.tv_sec == deadline->tv_sec) && (slice.tv_nsec >= deadline->tv_nsec))) break;
+        slice.tv_nsec += WAITSLICEMS * 1000000;
+        if (slice.tv_nsec >= 1000000000) {
+            slice.tv_sec  ++;
+            slice.tv_nsec -= 1000000000;
+        }
+        if ((slice.tv_sec > deadline->tv_sec) || ((slice.tv_sec == deadline->tv_sec) && (slice.tv_nsec > deadline->tv_nsec))) slice = *deadline;
+        int rc = pthread_cond_timedwait (&expcond, &explock, &slice);
+        if ((rc != 0) && (rc != ETIMEDOUT)) ABORT ();
+    }
+    EXPUNLK;
+    return more;
+}
+
+// copy unmatched output to expscratch, null terminated
+//  output:
+//   returns number of chars copied
+//   *tail_r = exptail value for expscratch[0]
+static uint32_t copyunmatched (uint64_t *tail_r)
+{
+    EXPLOCK;
+    uint64_t tail = exptail;
+    uint32_t len  = exphead - tail;
+    uint32_t ofs  = tail % RINGSIZE;
+    uint32_t len1 = (len < RINGSIZE - ofs) ? len : RINGSIZE - ofs;
+    memcpy (expscratch, expring + ofs, len1);
+    memcpy (expscratch + len1, expring, len - len1);
+    EXPUNLK;
+    expscratch[len] = 0;
+    *tail_r = tail;
+    return len;
+}
+
+// read printer output into ring buffer until told to stop
+static void *expthread (void *dummy)
+{
+    uint8_t buf[256];
+
+    while (! expstopping) {
+        int rc = 0;
+        if (expttyat != NULL) {
+
+            // z8lpanel: take char from tty registers same as z8ltty does
+            if (expz8p->waitdev (&expttyat[Z_TTYPR], PR_FULL, 0, 1000)) {
+                uint32_t prreg = expttyat[Z_TTYPR];
+                if (prreg & PR_FULL) {
+                    buf[rc++] = prreg;
+                    expttyat[Z_TTYPR] = PR_FLAG;
+                }
+            }
+        } else {
+
+            // pipan8l: read whatever is in pipe
+            struct pollfd pollfd = { expfd, POLLIN, 0 };
+            rc = poll (&pollfd, 1, WAITSLICEMS);
+            if (rc > 0) rc = read (expfd, buf, sizeof buf);
+            if (rc < 0) {
+                if ((errno == EINTR) || (errno == EAGAIN)) continue;
+                experrno = errno;
+                break;
+            }
+            // pipe with no writer polls as readable and reads eof
+            if ((rc == 0) && (pollfd.revents != 0)) usleep (WAITSLICEMS * 1000);
+        }
+
+        // strip parity and nulls same as readttychartimed always did
+        int n = 0;
+        for (int i = 0; i < rc; i ++) {
+            uint8_t ch = buf[i] & 0177;
+            if (ch != 0) buf[n++] = ch;
+        }
+        if (n == 0) continue;
+        if (expecho && (write (STDOUT_FILENO, buf, n) < 0)) expecho = false;
+
+        EXPLOCK;
+        for (int i = 0; i < n; i ++) expring[(exphead++)%RINGSIZE] = buf[i];
+        if (exphead - exptail > RINGSIZE) {
+            expdropped += exphead - exptail - RINGSIZE;
+            exptail = exphead - RINGSIZE;
+        }
+        if (pthread_cond_broadcast (&expcond) != 0) ABORT ();
+        EXPUNLK;
+    }
+
+    EXPLOCK;
+    expthdone = true;
+    if (pthread_cond_broadcast (&expcond) != 0) ABORT ();
+    EXPUNLK;
+    return NULL;
+}
@@ -21,7 +21,10 @@
 #ifndef _PADLIB_H
 #define _PADLIB_H
 
+#include <string>
+
 #include "pindefs.h"
+#include "simtrace.h"
 
 struct PadLib {
     virtual ~PadLib () { }
@@ -62,14 +65,36 @@ struct SimLib : PadLib {
     virtual void openpads ();
     virtual void readpads (uint16_t *pads);
     virtual void writepads (uint16_t const *pads);
+    int savesnap (char const *filename);
+    int loadsnap (char const *filename);
+
+    uint64_t volatile instrcount;   // number of instructions fetched
+
+    // busy-wait loops fast-forwarded by the pre-decoded run loop
+    enum Idle { IDLE_SKIPFLAG, IDLE_ISZLOOP, IDLE_JMPSELF, IDLE_COUNT };
+    uint64_t volatile idlecycles[IDLE_COUNT];   // memory cycles skipped for each kind of loop
 
 private:
     enum State { NUL, FET, EXE, DEF, WCT, CAD, BRK };
 
+    // pre-decoded instruction for each memory location
+    // handler gets called at end of fetch to execute the rest of the instruction
+    typedef void (SimLib::*OpHandler) (uint16_t ea);
+    struct SimOp {
+        OpHandler handler;
+        uint16_t ea;                // memory reference address within field
+    };
+
     bool dfldsw, idelay, ifldsw, ionreg, lnreg, mprtsw, stepsw, traceon;
     State state;
     uint16_t acreg, irtop, mareg, mbreg, pcreg, swreg;
     uint16_t memarray[MEMSIZE];
+    SimOp decoded[MEMSIZE];     // parallel to memarray, invalidated by writemem()
+    bool usedecode;
+    SimTraceHdr *tracehdr;      // binary trace ring file, NULL if not tracing to file
+    SimTraceRec *tracerecs;
+    uint64_t tracemask;
+    bool useidle;
     uint16_t wrpads[P_NU16S];
 
     bool volatile runreg;       // false: thread is not running or just about to exit
@@ -83,10 +108,18 @@ private:
 
     pthread_t runtid;           // - set and cleared only by main thread
 
-    bool kbflag, prflag, prfull, ttinten, ttintrq;
-    int kbreadfd, prwritefd, usperch;
+    // events scheduled in virtual time, counted in memory cycles
+    enum Event { EV_HOSTPOLL, EV_PRDONE, EV_KBREADY, EV_COUNT };
+    uint64_t cyclecount;        // memory cycles since startup
+    uint64_t nexteventat;       // earliest of eventat[]
+    uint64_t eventat[EV_COUNT]; // cyclecount each event is due at, NEVER if not scheduled
+    uint32_t cycperch;          // cycles per tty character, from pipan8l_ttycps
+    uint32_t pollcycles;        // cycles between checks of the tty pipes
+
+    bool kbflag, kbready, prflag, prfull, ttinten, ttintrq;
+    int kbreadfd, prwritefd;
+    std::string kbpipename, prpipename;
     uint8_t kbchar, prchar;
-    uint64_t kbnextus, prnextus;
 
     bool intinhibiteduntiljump;
     uint16_t dfld, eareg, ifld, ifldafterjump, memfields, saveddfld, savedifld;
@@ -102,15 +135,49 @@ private:
     void stopswitch ();
     static void *runthreadwrap (void *zhis);
     void runthread ();
+    bool atinstrboundary ();
+    void fastrun ();
     void singlestep ();
     void dofetch ();
+    bool fetchinstr ();
     void domemref ();
+    void memand ();
+    void memtad ();
+    void memisz ();
+    void memdca ();
+    void memjms ();
+    void deferred (uint16_t ea);
+    void idleloop ();
+    void opentrace (char const *filename);
+    void tracefetch (uint16_t addr, uint16_t ir, uint8_t flags);
     uint16_t readmem (uint16_t field, uint16_t addr);
     void writemem (uint16_t field, uint16_t addr, uint16_t data);
     void dooperate ();
+    void dogroup1 ();
+    void dogroup2 ();
     void doioinst ();
-    void polltty ();
+    void schedevent (Event ev, uint64_t at);
+    void runevents ();
+    void pollhost ();
     char const *ststr ();
+
+    void op_decode (uint16_t ea);
+    void op_and_d (uint16_t ea);
+    void op_tad_d (uint16_t ea);
+    void op_isz_d (uint16_t ea);
+    void op_dca_d (uint16_t ea);
+    void op_jms_d (uint16_t ea);
+    void op_jmp_d (uint16_t ea);
+    void op_and_i (uint16_t ea);
+    void op_tad_i (uint16_t ea);
+    void op_isz_i (uint16_t ea);
+    void op_dca_i (uint16_t ea);
+    void op_jms_i (uint16_t ea);
+    void op_jmp_i (uint16_t ea);
+    void op_iot (uint16_t ea);
+    void op_group1 (uint16_t ea);
+    void op_group2 (uint16_t ea);
+    void op_eae (uint16_t ea);
 };
 
 #endif
@@ -40,6 +40,7 @@
 #include <unistd.h>
 
 #include "assemble.h"
+#include "cmd_expect.h"
 #include "disassemble.h"
 #include "padlib.h"
 #include "pindefs.h"
@@ -67,20 +68,29 @@ static Tcl_ObjCmdProc cmd_flushit;
 static Tcl_ObjCmdProc cmd_getpin;
 static Tcl_ObjCmdProc cmd_getreg;
 static Tcl_ObjCmdProc cmd_getsw;
+static Tcl_ObjCmdProc cmd_idlestats;
 static Tcl_ObjCmdProc cmd_libname;
+static Tcl_ObjCmdProc cmd_loadsnap;
+static Tcl_ObjCmdProc cmd_mips;
 static Tcl_ObjCmdProc cmd_readchar;
+static Tcl_ObjCmdProc cmd_savesnap;
 static Tcl_ObjCmdProc cmd_setpin;
 static Tcl_ObjCmdProc cmd_setsw;
 
 static TclFunDef const fundefs[] = {
     { cmd_assemop,    "assemop",    "assemble instruction" },
     { cmd_disasop,    "disasop",    "disassemble instruction" },
+    { CMD_EXPECT },
     { cmd_flushit,    "flushit",    "flush writes / invalidate reads" },
     { cmd_getpin,     "getpin",     "get gpio pin" },
     { cmd_getreg,     "getreg",     "get register value" },
     { cmd_getsw,      "getsw",      "get switch value" },
+    { cmd_idlestats,  "idlestats",  "get simulator busy-wait loop counts" },
     { cmd_libname,    "libname",    "get library name i2c,sim" },
+    { cmd_loadsnap,   "loadsnap",   "load simulator snapshot file" },
+    { cmd_mips,       "mips",       "measure simulator speed" },
     { cmd_readchar,   "readchar",   "read character with timeout" },
+    { cmd_savesnap,   "savesnap",   "save simulator snapshot file" },
     { cmd_setpin,     "setpin",     "set gpio pin" },
     { cmd_setsw,      "setsw",      "set switch value" },
     { NULL, NULL, NULL }
@@ -113,6 +123,8 @@ static uint16_t const wrmsks[P_NU16S] = { P0_WMSK, P1_WMSK, P2_WMSK, P3_WMSK, P4
 static bool rdpadsvalid;
 static bool wrpadsdirty;
 static PadLib *padlib;
+static SimLib *simlib;
+static int udpport;
 static pthread_mutex_t padmutex = PTHREAD_MUTEX_INITIALIZER;
 static uint16_t rdpads[P_NU16S];
 static uint16_t wrpads[P_NU16S];
@@ -122,12 +134,15 @@ static void setpin (int pin, bool set);
 static bool getpin (int pin);
 static void flushit ();
 static int showstatus (int argc, char **argv);
+static int getudpport ();
 static void *udpthread (void *dummy);
 
 
 
 int main (int argc, char **argv)
 {
+    udpport = getudpport ();
+
     if ((argc >= 2) && (strcasecmp (argv[1], "-status") == 0)) {
         return showstatus (argc - 1, argv + 1);
     }
@@ -155,6 +170,7 @@ int main (int argc, char **argv)
             puts ("            must be plugged into pdp via pipan8l pcb");
             puts ("     <scriptfile.tcl> : execute script then exit");
             puts ("                 else : read and process commands from stdin");
+            puts ("     envar pipan8l_udpport : status udp port, default 23456, 0 to disable");
             puts ("");
             puts ("  ./pipan8l -status [<hostname-or-ip-address-of-pipan8l>]");
             puts ("     display ascii-art front panel operated by one of the above pipan8l methods");
@@ -184,14 +200,15 @@ int main (int argc, char **argv)
         break;
     }
 
-    padlib = simit ? (PadLib *) new SimLib () : (PadLib *) new I2CLib ();
+    if (simit) padlib = simlib = new SimLib ();
+          else padlib = new I2CLib ();
     padlib->openpads ();
     // initialize switches from existing switch states
     padlib->readpads (rdpads);
     for (int i = 0; i < P_NU16S; i ++) wrpads[i] = rdpads[i];
 
     // create udp server thread
-    {
+    if (udpport != 0) {
         pthread_t udptid;
         int rc = pthread_create (&udptid, NULL, udpthread, NULL);
         if (rc != 0) ABORT ();
@@ -374,7 +391,7 @@ static int cmd_getreg (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_
                 puts ("    link - link bit");
                 puts ("     ion - interrupts enabled");
                 puts ("     par - memory parity error");
-                puts ("    prot - memory protect error");
+                puts ("    prot - memory protect error (or prte)");
                 puts ("     run - executing instructions");
                 puts ("");
                 return TCL_OK;
@@ -414,6 +431,7 @@ static int cmd_getreg (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_
             if (strcasecmp (regname, "link") == 0) pinum = P_LINK;
             if (strcasecmp (regname, "par")  == 0) pinum = P_PARE;
             if (strcasecmp (regname, "prot") == 0) pinum = P_PRTE;
+            if (strcasecmp (regname, "prte") == 0) pinum = P_PRTE;     // name used by z8lpanel and pipan8lini.tcl
             if (strcasecmp (regname, "run")  == 0) pinum = P_RUN;
             if (pinum >= 0) {
                 if (pthread_mutex_lock (&padmutex) != 0) ABORT ();
@@ -473,6 +491,125 @@ static int cmd_libname (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl
     return TCL_OK;
 }
 
+// get memory cycles skipped by simulator for each kind of busy-wait loop
+//  idlestats [reset]
+static int cmd_idlestats (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    bool reset = false;
+    if (objc == 2) {
+        char const *stri = Tcl_GetString (objv[1]);
+        if (strcasecmp (stri, "help") == 0) {
+            puts ("");
+            puts (" idlestats [reset]");
+            puts ("   get memory cycles skipped by simulator for each kind of busy-wait loop");
+            puts ("   returns list of name value pairs:");
+            puts ("     skipflag : KSF/TSF/TSK; JMP .-1 loops waiting for tty");
+            puts ("     iszloop  : ISZ x; JMP .-1 delay loops");
+            puts ("     jmpself  : JMP . loops");
+            puts ("   reset clears the counts after reading them");
+            puts ("   set envar pipan8l_simidle=0 to run the loops instead");
+            puts ("   loops are always run when pipan8l_simtrace is set");
+            puts ("");
+            return TCL_OK;
+        }
+        if (strcasecmp (stri, "reset") != 0) {
+            Tcl_SetResultF (interp, "bad option %s", stri);
+            return TCL_ERROR;
+        }
+        reset = true;
+    } else if (objc != 1) {
+        Tcl_SetResult (interp, (char *) "bad number of arguments", TCL_STATIC);
+        return TCL_ERROR;
+    }
+    if (simlib == NULL) {
+        Tcl_SetResult (interp, (char *) "only for sim library", TCL_STATIC);
+        return TCL_ERROR;
+    }
+
+    Tcl_SetResultF (interp, "skipflag %llu iszloop %llu jmpself %llu",
+        (unsigned long long) simlib->idlecycles[SimLib::IDLE_SKIPFLAG],
+        (unsigned long long) simlib->idlecycles[SimLib::IDLE_ISZLOOP],
+        (unsigned long long) simlib->idlecycles[SimLib::IDLE_JMPSELF]);
+    if (reset) {
+        for (int i = 0; i < SimLib::IDLE_COUNT; i ++) simlib->idlecycles[i] = 0;
+    }
+    return TCL_OK;
+}
+
+// load simulator state from snapshot file
+//  loadsnap <filename>
+static int cmd_loadsnap (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc == 2) {
+        char const *name = Tcl_GetString (objv[1]);
+        if (strcasecmp (name, "help") == 0) {
+            puts ("");
+            puts (" loadsnap <filename>");
+            puts ("   load memory, registers and tty state from file written by savesnap");
+            puts ("   processor must be stopped, use flicksw cont to resume");
+            puts ("");
+            return TCL_OK;
+        }
+        if (simlib == NULL) {
+            Tcl_SetResult (interp, (char *) "only for sim library", TCL_STATIC);
+            return TCL_ERROR;
+        }
+        int rc = simlib->loadsnap (name);
+        if (rc != 0) {
+            Tcl_SetResultF (interp, "error loading %s: %s", name, (rc == EINVAL) ? "not a valid snapshot file" : strerror (rc));
+            return TCL_ERROR;
+        }
+
+        // registers changed without going through the paddles
+        if (pthread_mutex_lock (&padmutex) != 0) ABORT ();
+        rdpadsvalid = false;
+        if (pthread_mutex_unlock (&padmutex) != 0) ABORT ();
+        return TCL_OK;
+    }
+    Tcl_SetResult (interp, (char *) "bad number of arguments", TCL_STATIC);
+    return TCL_ERROR;
+}
+
+// measure simulator speed while processor is running
+//  mips [<milliseconds>]
+static int cmd_mips (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    int ms = 1000;
+    if (objc == 2) {
+        char const *stri = Tcl_GetString (objv[1]);
+        if (strcasecmp (stri, "help") == 0) {
+            puts ("");
+            puts (" mips [<milliseconds>]");
+            puts ("   measure simulated instructions per second while processor is running");
+            puts ("   default 1000 milliseconds");
+            puts ("   returns millions of instructions per second");
+            puts ("   set envar pipan8l_simdecode=0 to compare with cycle-by-cycle stepping");
+            puts ("");
+            return TCL_OK;
+        }
+        int rc = Tcl_GetIntFromObj (interp, objv[1], &ms);
+        if (rc != TCL_OK) return rc;
+    } else if (objc != 1) {
+        Tcl_SetResult (interp, (char *) "bad number of arguments", TCL_STATIC);
+        return TCL_ERROR;
+    }
+    if (simlib == NULL) {
+        Tcl_SetResult (interp, (char *) "only for sim library", TCL_STATIC);
+        return TCL_ERROR;
+    }
+
+    struct timeval tvbeg, tvend;
+    uint64_t countbeg = simlib->instrcount;
+    if (gettimeofday (&tvbeg, NULL) < 0) ABORT ();
+    usleep (ms * 1000);
+    uint64_t countend = simlib->instrcount;
+    if (gettimeofday (&tvend, NULL) < 0) ABORT ();
+
+    uint64_t elapus = (tvend.tv_sec - tvbeg.tv_sec) * 1000000ULL + tvend.tv_usec - tvbeg.tv_usec;
+    Tcl_SetResultF (interp, "%.3f", (countend - countbeg) / (double) elapus);
+    return TCL_OK;
+}
+
 // read character with timeout as an integer
 // returns null string if timeout, else decimal integer
 //  readchar file timeoutms
@@ -505,6 +642,35 @@ static int cmd_readchar (ClientData clientdata, Tcl_Interp *interp, int objc, Tc
     return TCL_ERROR;
 }
 
+// save simulator state to snapshot file
+//  savesnap <filename>
+static int cmd_savesnap (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc == 2) {
+        char const *name = Tcl_GetString (objv[1]);
+        if (strcasecmp (name, "help") == 0) {
+            puts ("");
+            puts (" savesnap <filename>");
+            puts ("   save memory, registers and tty state to file");
+            puts ("   processor must be stopped");
+            puts ("");
+            return TCL_OK;
+        }
+        if (simlib == NULL) {
+            Tcl_SetResult (interp, (char *) "only for sim library", TCL_STATIC);
+            return TCL_ERROR;
+        }
+        int rc = simlib->savesnap (name);
+        if (rc != 0) {
+            Tcl_SetResultF (interp, "error saving %s: %s", name, strerror (rc));
+            return TCL_ERROR;
+        }
+        return TCL_OK;
+    }
+    Tcl_SetResult (interp, (char *) "bad number of arguments", TCL_STATIC);
+    return TCL_ERROR;
+}
+
 // set gpio pin
 static int cmd_setpin (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
@@ -740,7 +906,7 @@ static int showstatus (int argc, char **argv)
     struct sockaddr_in server;
     memset (&server, 0, sizeof server);
     server.sin_family = AF_INET;
-    server.sin_port   = htons (UDPPORT);
+    server.sin_port   = htons (udpport);
     if (! inet_aton (ipaddr, &server.sin_addr)) {
         struct hostent *he = gethostbyname (ipaddr);
         if (he == NULL) {
@@ -852,6 +1018,21 @@ static int showstatus (int argc, char **argv)
 
 
 
+// get udp port for status from envar pipan8l_udpport, default UDPPORT
+// several simulators can run at once by giving each a different port or 0 for none
+static int getudpport ()
+{
+    char const *env = getenv ("pipan8l_udpport");
+    if ((env == NULL) || (env[0] == 0)) return UDPPORT;
+    char *p;
+    int port = strtol (env, &p, 0);
+    if ((*p != 0) || (port < 0) || (port > 65535)) {
+        fprintf (stderr, "bad pipan8l_udpport %s\n", env);
+        exit (1);
+    }
+    return port;
+}
+
 // pass state of processor to whoever asks via udp
 static void *udpthread (void *dummy)
 {
@@ -867,9 +1048,9 @@ static void *udpthread (void *dummy)
     struct sockaddr_in server;
     memset (&server, 0, sizeof server);
     server.sin_family = AF_INET;
-    server.sin_port   = htons (UDPPORT);
+    server.sin_port   = htons (udpport);
     if (bind (udpfd, (sockaddr *) &server, sizeof server) < 0) {
-        fprintf (stderr, "udpthread: error binding to %d: %m\n", UDPPORT);
+        fprintf (stderr, "udpthread: error binding to %d: %m\n", udpport);
         ABORT ();
     }
 
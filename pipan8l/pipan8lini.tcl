@@ -12,6 +12,7 @@ proc helpini {} {
     puts "  dumpit                  - dump registers and switches"
     puts "  dumpmem <start> <stop>  - dump memory in octal"
     puts "  escapechr               - convert character to escape"
+    puts "  expectttyidle <ms> ...  - expect match, timing out when tty idle for ms"
     puts "  fastxmem                - set fastest extended memory timing"
     puts "  flicksw <switch>        - flick momentary switch on then off"
     puts "  getenv                  - get environment variable"
@@ -34,6 +35,9 @@ proc helpini {} {
     puts "  stepit                  - step one cycle then dump"
     puts "  steploop                - step one cycle, dump, then loop on enter key"
     puts "  stopandreset            - stop and reset cpu"
+    puts "  ttycharnot <char>       - regex matching any char but the given one"
+    puts "  ttyliteral <string>     - regex matching the given string exactly"
+    puts "  ttyprintnot <char>      - regex matching any printable char but the given one"
     puts "  wait                    - wait for CTRLC or STOP"
     puts "  waitforttypr            - wait for prompt string on tty"
     puts "  wrmem <addr> <data>     - write memory at the given address"
@@ -88,35 +92,45 @@ proc checkttymatch {nskip line {tmsec 30000}} {
     }
 
     set len [string length $nowtsp]
-    set nmatched 0
-    set skipped ""
-    while {$nmatched < $len} {
-        set ch [readttychartimed $tmsec]
-        if {$ch == ""} {
-            puts ""
-            error "checkttymatch: timed out waiting for '$line'"
+    if {$len == 0} {return ""}
+
+    # chars skipped can't be the first char of the line so there is only one way to match
+    # success: skipped chars then whole line with any whitespace between chars
+    # failure: too many chars skipped or line mismatches after its first char
+    set wsp "\[\001- \]"
+    set first [string index $nowtsp 0]
+    set skip "^$wsp*(([ttyprintnot $first]$wsp*){0,$nskip})"
+    set success "$skip[ttyliteral $first]"
+    set nest ""
+    for {set i $len} {[incr i -1] > 0} {} {
+        set ch [string index $nowtsp $i]
+        append success "$wsp*[ttyliteral [string index $nowtsp [expr {$len - $i}]]]"
+        if {$nest == ""} {
+            set nest [ttyprintnot $ch]
+        } else {
+            set nest "([ttyprintnot $ch]|[ttyliteral $ch]$wsp*$nest)"
         }
-        puts -nonewline $ch
-        flush stdout
-        if {$ch <= " "} continue
-        if {$ch == [string index $nowtsp $nmatched]} {
-            incr nmatched
-            continue
-        }
-        append skipped [string range $nowtsp 0 [expr {$nmatched - 1}]]
-        append skipped $ch
-        if {[string length $skipped] > $nskip} {
-            while true {
-                set ch [readttychartimed $tmsec]
-                if {$ch == ""} break
-                puts -nonewline $ch
-                flush stdout
-                if {$ch == "\n"} break
-            }
-            puts ""
-            error "checkttymatch: failed to match '$line'"
+    }
+    set failure "^$wsp*([ttyprintnot $first]$wsp*){$nskip}[ttyprintnot $first]"
+    if {$nest != ""} {append failure "|$skip[ttyliteral $first]$wsp*$nest"}
+
+    set rc [expectttyidle $tmsec $success $failure]
+    if {$rc == ""} {
+        puts ""
+        error "checkttymatch: timed out waiting for '$line'"
+    }
+    puts -nonewline [lindex $rc 1]
+    flush stdout
+    if {[lindex $rc 0] != 0} {
+        set rest ""
+        if {[string index [lindex $rc 1] end] != "\n"} {
+            expectttyidle $tmsec -before rest "\n"
+            puts -nonewline $rest
         }
+        puts ""
+        error "checkttymatch: failed to match '$line'"
     }
+    regsub -all $wsp [lindex $rc 2] "" skipped
     return $skipped
 }
 
@@ -162,6 +176,7 @@ proc closettypipes {} {
     global wrkbpipe rdprpipe
     chan close $wrkbpipe
     while {[readttychartimed 100] != ""} { }
+    expect stop
     chan close $rdprpipe
     set wrkbpipe ""
     set rdprpipe ""
@@ -255,6 +270,16 @@ proc escapechr {ch} {
     return [string range $ch 0 0]
 }
 
+# expect match with the given args, timing out only when tty has printed nothing for tmsec
+# - same as the per-char timeout of readttychartimed so long outputs don't time out
+proc expectttyidle {tmsec args} {
+    while true {
+        set rcvd [lindex [expect stats] 0]
+        set rc [uplevel 1 [concat [list expect match -timeout $tmsec] $args]]
+        if {($rc != "") || [ctrlcflag] || ([lindex [expect stats] 0] == $rcvd)} {return $rc}
+    }
+}
+
 # flick momentary switch on then off
 if {[libname] == "i2cz"} {
     # z8lpanel does not have flushit or bncy
@@ -304,18 +329,12 @@ proc getenv {varname {defvalu ""}} {
 # read rest of line from tty printer, terminated by <CR> or <LF>
 # - call openttypipes first
 proc getrestofttyline {{tmsec 30000}} {
-    set skipped ""
-    while true {
-        set ch [readttychartimed $tmsec]
-        if {$ch == ""} {
-            error "getrestofttyline: timed out reading to end of line"
-        }
-        puts -nonewline $ch
-        flush stdout
-        if {$ch == "\r"} break
-        if {$ch == "\n"} break
-        append skipped $ch
+    set rc [expectttyidle $tmsec -before skipped "\[\r\n\]"]
+    if {$rc == ""} {
+        error "getrestofttyline: timed out reading to end of line"
     }
+    puts -nonewline "$skipped[lindex $rc 1]"
+    flush stdout
     return $skipped
 }
 
@@ -694,17 +713,23 @@ proc octal {val} {
 ;# function to open tty port available as pipes
 ;# - using pipan8l with real PDP-8/L: softlink /tmp/pipan8l_ttykb and _ttypr to real tty port eg /dev/ttyACM0
 ;# - using pipan8l with built-in simulator (-sim option): simlib.cc creates named pipes /tmp/pipan8l_ttykb and _ttypr
+;# - envar pipan8l_ttypipes overrides the /tmp/pipan8l_tty prefix so several simulators can run at once
 proc openttypipes {} {
     global wrkbpipe rdprpipe
 
     # running as pipan8l on raspi chip either plugged into PDP-8/L front panel or simulating PDP-8/L
     # if real PDP-8/L, /tmp/pipan8l_ttypr and /tmp/pipan8l_ttykb must be softlinked to the serial port connected to the PDPs TTY boards
     # if simulating (pipan8l -sim), simlib.cc creates named pipes and we just access them
-    set rdprpipe [open "/tmp/pipan8l_ttypr" "r"]
-    set wrkbpipe [open "/tmp/pipan8l_ttykb" "w"]
+    set ttypipes "/tmp/pipan8l_tty"
+    if {[info exists ::env(pipan8l_ttypipes)] && ($::env(pipan8l_ttypipes) != "")} {
+        set ttypipes $::env(pipan8l_ttypipes)
+    }
+    set rdprpipe [open "${ttypipes}pr" "r"]
+    set wrkbpipe [open "${ttypipes}kb" "w"]
     chan configure $rdprpipe -translation binary
     chan configure $wrkbpipe -translation binary
     chan configure $rdprpipe -blocking 0
+    expect start $rdprpipe
     while {[readttychartimed 500] != ""} { }
 }
 
@@ -719,14 +744,9 @@ proc postinc name {
 }
 
 ;# read character from tty with timeout (see openttypipes)
+;# printer pipe is read into a buffer by the expect command's thread, which also strips parity and nulls
 proc readttychartimed {msec} {
-    global rdprpipe
-    while true {
-        set ii [readchar $rdprpipe $msec]
-        if {$ii == ""} return ""
-        set ii [expr {$ii & 0177}]
-        if {$ii != 0} {return [inttochar $ii]}
-    }
+    return [expect getc $msec]
 }
 
 # deposit rim loader in memory
@@ -881,6 +901,26 @@ proc stopandreset {} {
     setsw step 0
 }
 
+# regex bracket expression matching any char but the given one
+proc ttycharnot {ch} {
+    if {$ch == "]"} {return "\[^\]\]"}
+    return "\[^$ch\]"
+}
+
+# regex matching the given string exactly
+proc ttyliteral {str} {
+    regsub -all {[][\\^$.|?*+(){}]} $str {\\&} str
+    return $str
+}
+
+# regex bracket expression matching any printable char but the given one
+# - control characters and space are not printable
+proc ttyprintnot {ch} {
+    if {$ch == "]"} {return "\[^\]\001- \]"}
+    if {$ch == "-"} {return "\[^-\001- \]"}
+    return "\[^\001- $ch\]"
+}
+
 # wait for control-C or processor stopped
 # returns "CTRLC" or "STOP"
 proc wait {} {
@@ -893,18 +933,36 @@ proc wait {} {
 }
 
 ;# function to wait for the given string from the tty (see openttypipes)
+;# - skips control characters and whitespace before the first char
 proc waitforttypr {msec str} {
+
+    # success: the whole string
+    # failure: some leading part of string then the wrong char, which is captured
+    set pats [list "^\[\001- \]*[ttyliteral $str]"]
     set len [string length $str]
     for {set i 0} {$i < $len} {incr i} {
-        while true {
-            set ch [readttychartimed $msec]
-            if {$ch > " "} break
-            if {$i > 0} break
-        }
         set ex [string index $str $i]
-        if {$ch != $ex} {
-            error "waitforttypr: expected char [escapechr $ex] on tty but got [escapechr $ch]"
+        if {$i == 0} {
+            set wrong [ttyprintnot $ex]
+        } else {
+            set wrong [ttycharnot $ex]
         }
+        lappend pats "^\[\001- \]*[ttyliteral [string range $str 0 [expr {$i - 1}]]]($wrong)"
+    }
+
+    # wait as long as it takes for first printable char, then msec between chars
+    while true {
+        set rc [eval [list expectttyidle $msec] $pats]
+        if {$rc != ""} break
+        regsub "^\[\001- \]*" [expect flush] "" got
+        if {($got != "") || [ctrlcflag]} {
+            for {set i 0} {[string index $got $i] == [string index $str $i]} {incr i} { }
+            error "waitforttypr: expected char [escapechr [string index $str $i]] on tty but got [escapechr ""]"
+        }
+    }
+    if {[lindex $rc 0] != 0} {
+        set ex [string index $str [expr {[lindex $rc 0] - 1}]]
+        error "waitforttypr: expected char [escapechr $ex] on tty but got [escapechr [lindex $rc 2]]"
     }
 }
 
@@ -0,0 +1,204 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Decode binary trace ring file written by pipan8l -sim with envar pipan8l_simtrace=<filename>
+// Prints same format as pipan8l_simtrace=1
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "disassemble.h"
+#include "simtrace.h"
+
+static bool intronly;
+static uint16_t irmask;
+static uint16_t irvalue;
+static uint64_t addrlo = 0;
+static uint64_t addrhi = 077777;
+static uint64_t cyclo  = 0;
+static uint64_t cychi  = 0xFFFFFFFFFFFFFFFFULL;
+
+static bool parserange (char const *str, uint64_t *lo, uint64_t *hi, int base);
+static bool matches (SimTraceRec const *rec);
+
+int main (int argc, char **argv)
+{
+    bool showcycle = false;
+    char const *filename = NULL;
+    uint64_t last = 0;
+
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("     Decode binary trace ring file written by pipan8l -sim");
+            puts ("");
+            puts ("  ./pipan8ltrace [-addr <lo>[-<hi>]] [-cycles <lo>[-<hi>]] [-intr] [-ir <value>[/<mask>]] [-last <n>] [-showcycle] <tracefile>");
+            puts ("     -addr      : only instructions fetched from the given octal address range, eg 10200-10377");
+            puts ("     -cycles    : only instructions fetched in the given decimal memory cycle range");
+            puts ("     -intr      : only interrupts");
+            puts ("     -ir        : only instructions matching octal value under octal mask, mask default 7777");
+            puts ("     -last      : only the last n matching records");
+            puts ("     -showcycle : print memory cycle count at beginning of each line");
+            puts ("     <tracefile> : file given by envar pipan8l_simtrace=<tracefile>");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-addr") == 0) {
+            if ((++ i >= argc) || ! parserange (argv[i], &addrlo, &addrhi, 8)) {
+                fprintf (stderr, "missing or bad -addr range\n");
+                return 1;
+            }
+            continue;
+        }
+        if (strcasecmp (argv[i], "-cycles") == 0) {
+            if ((++ i >= argc) || ! parserange (argv[i], &cyclo, &cychi, 10)) {
+                fprintf (stderr, "missing or bad -cycles range\n");
+                return 1;
+            }
+            continue;
+        }
+        if (strcasecmp (argv[i], "-intr") == 0) {
+            intronly = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-ir") == 0) {
+            char *p;
+            if (++ i >= argc) goto badir;
+            irvalue = strtoul (argv[i], &p, 8);
+            irmask  = 07777;
+            if (*p == '/') irmask = strtoul (p + 1, &p, 8);
+            if ((*p != 0) || (irvalue > 07777) || (irmask > 07777)) goto badir;
+            irvalue &= irmask;
+            continue;
+        badir:
+            fprintf (stderr, "missing or bad -ir value\n");
+            return 1;
+        }
+        if (strcasecmp (argv[i], "-last") == 0) {
+            char *p;
+            if ((++ i >= argc) || ((last = strtoull (argv[i], &p, 0)) == 0) || (*p != 0)) {
+                fprintf (stderr, "missing or bad -last count\n");
+                return 1;
+            }
+            continue;
+        }
+        if (strcasecmp (argv[i], "-showcycle") == 0) {
+            showcycle = true;
+            continue;
+        }
+        if ((argv[i][0] == '-') || (filename != NULL)) {
+            fprintf (stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+        filename = argv[i];
+    }
+    if (filename == NULL) {
+        fprintf (stderr, "missing tracefile\n");
+        return 1;
+    }
+
+    // map the file and validate header
+    int fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf (stderr, "error opening %s: %m\n", filename);
+        return 1;
+    }
+    struct stat statbuf;
+    if (fstat (fd, &statbuf) < 0) {
+        fprintf (stderr, "error statting %s: %m\n", filename);
+        return 1;
+    }
+    if ((uint64_t) statbuf.st_size < sizeof (SimTraceHdr)) {
+        fprintf (stderr, "%s too short for trace file\n", filename);
+        return 1;
+    }
+    void *ptr = mmap (NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        fprintf (stderr, "error mapping %s: %m\n", filename);
+        return 1;
+    }
+    close (fd);
+
+    SimTraceHdr const *hdr = (SimTraceHdr const *) ptr;
+    SimTraceRec const *recs = (SimTraceRec const *) (hdr + 1);
+    if ((memcmp (hdr->magic, SIMTRACE_MAGIC, sizeof hdr->magic) != 0) || (hdr->version != SIMTRACE_VERSION) ||
+            (hdr->recsize != sizeof *recs) || (hdr->nrecs == 0) || ((hdr->nrecs & (hdr->nrecs - 1)) != 0) ||
+            ((uint64_t) statbuf.st_size < sizeof *hdr + hdr->nrecs * sizeof *recs)) {
+        fprintf (stderr, "%s is not a version %d trace file\n", filename, SIMTRACE_VERSION);
+        return 1;
+    }
+
+    // get range of records still in ring
+    uint64_t end = hdr->next;
+    uint64_t beg = (end > hdr->nrecs) ? end - hdr->nrecs : 0;
+
+    // if -last, scan backward to find where to start printing
+    uint64_t idx;
+    if (last != 0) {
+        uint64_t count = 0;
+        for (idx = end; (idx > beg) && (count < last);) {
+            if (matches (&recs[(--idx)&(hdr->nrecs-1)])) count ++;
+        }
+        beg = idx;
+    }
+
+    // print the records
+    for (idx = beg; idx < end; idx ++) {
+        SimTraceRec const *rec = &recs[idx&(hdr->nrecs-1)];
+        if (! matches (rec)) continue;
+
+        if (showcycle) printf ("%12llu  ", (unsigned long long) rec->cycle);
+        if (rec->flags & SIMTRACE_INTR) {
+            printf ("SimLib::dofetch:  PC=%o.%04o  L.AC=%o.%04o  IF=%o  DF=%o  interrupt\n",
+                rec->addr >> 12, rec->addr & 07777, rec->lac >> 12, rec->lac & 07777, rec->addr >> 12, rec->dfld);
+        } else {
+            printf ("SimLib::dofetch:  PC=%o.%04o  L.AC=%o.%04o  IF=%o  DF=%o  IR=%04o  %s\n",
+                rec->addr >> 12, rec->addr & 07777, rec->lac >> 12, rec->lac & 07777, rec->addr >> 12, rec->dfld,
+                rec->ir, disassemble (rec->ir, rec->addr & 07777).c_str ());
+        }
+    }
+    return 0;
+}
+
+// see if record passes the command line filters
+static bool matches (SimTraceRec const *rec)
+{
+    if (intronly && ! (rec->flags & SIMTRACE_INTR)) return false;
+    if ((irmask != 0) && ((rec->flags & SIMTRACE_INTR) || ((rec->ir & irmask) != irvalue))) return false;
+    if ((rec->addr < addrlo) || (rec->addr > addrhi)) return false;
+    if ((rec->cycle < cyclo) || (rec->cycle > cychi)) return false;
+    return true;
+}
+
+// parse <lo>[-<hi>] range
+static bool parserange (char const *str, uint64_t *lo, uint64_t *hi, int base)
+{
+    char *p;
+    *lo = strtoull (str, &p, base);
+    *hi = *lo;
+    if (*p == '-') *hi = strtoull (p + 1, &p, base);
+    return (p != str) && (*p == 0) && (*lo <= *hi);
+}
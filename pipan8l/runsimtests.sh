@@ -0,0 +1,108 @@
+#!/bin/bash
+#
+#  Run test scripts in parallel on the pipan8l built-in simulator
+#  Each script gets its own pipan8l process, simulated PDP-8/L and tty pipes
+#  and the status udp port is turned off so they do not conflict
+#
+#    ./runsimtests.sh [-jobs <n>] [-logdir <dir>] [-prog <cmd>] [-timeout <sec>] [<script.tcl> ...]
+#
+#      -jobs    : number of tests to run at once, default number of cores
+#      -logdir  : where to put each test's output, default /tmp/runsimtests.<pid>
+#      -prog    : command to run each script with, default './pipan8l -sim'
+#      -timeout : seconds before killing a test, default 3600
+#      scripts  : default the ones that only need the processor and tty:
+#                   run-d01b.tcl run-d02b.tcl run-d04b.tcl run-d05b.tcl
+#                   run-d07b.tcl run-d1eb.tcl run-d1gb.tcl testsnap.tcl
+#                 the run-d scripts load their diagnostics from ../alltapes
+#
+#  The simulator has no TC08 or RK8JE, so run-d3ra.tcl, testos8dpack.tcl,
+#  testos8dtape.tcl and test-all.tcl are left out.  To run them on the board
+#  with the z8ltc08 and z8lrk8je daemons going, name them and the program:
+#    ./runsimtests.sh -jobs 1 -prog ./z8lsim run-d3ra.tcl test-all.tcl
+#
+#  Prints one json line per test in the order given then a totals line:
+#    {"test":"run-d01b.tcl","status":"pass","exit":0,"seconds":2.345,"log":"/tmp/runsimtests.123/run-d01b.tcl.log"}
+#    {"tests":8,"passed":8,"failed":0,"seconds":61.234}
+#  Exits with 0 if all passed, 1 otherwise
+#
+dd=`dirname $0`
+jobs=`nproc`
+logdir=/tmp/runsimtests.$$
+prog="./pipan8l -sim"
+timeout=3600
+scripts=()
+while [ "$1" != "" ]
+do
+    case "$1" in
+        -jobs)    jobs=$2    ; shift ;;
+        -logdir)  logdir=$2  ; shift ;;
+        -prog)    prog=$2    ; shift ;;
+        -timeout) timeout=$2 ; shift ;;
+        -\?)
+            sed -n '3,28s/^#//p' $0
+            exit 0 ;;
+        -*)
+            echo "unknown option $1" >&2
+            exit 1 ;;
+        *) scripts+=("$1") ;;
+    esac
+    shift
+done
+mkdir -p $logdir
+logdir=`cd $logdir && pwd`
+cd $dd
+if [ ${#scripts[@]} -eq 0 ]
+then
+    scripts=(run-d01b.tcl run-d02b.tcl run-d04b.tcl run-d05b.tcl run-d07b.tcl run-d1eb.tcl run-d1gb.tcl testsnap.tcl)
+fi
+
+# run one test script, leave result line in <logdir>/<script>.json
+function runone
+{
+    local script=$1
+    local index=$2
+    local log=$logdir/$script.log
+    local pipes=/tmp/pipan8l_$$_${index}_tty
+    local start=`date +%s.%N`
+    pipan8l_ttypipes=$pipes pipan8l_udpport=0 timeout $timeout $prog $script < /dev/null > $log 2>&1
+    local rc=$?
+    local stop=`date +%s.%N`
+    rm -f ${pipes}kb ${pipes}pr
+    local status=pass
+    if [ $rc -ne 0 ]
+    then
+        status=fail
+    fi
+    local secs=`echo "$start $stop" | awk '{ printf "%.3f", $2 - $1 }'`
+    echo "{\"test\":\"$script\",\"status\":\"$status\",\"exit\":$rc,\"seconds\":$secs,\"log\":\"$log\"}" > $logdir/$script.json
+}
+
+start=`date +%s.%N`
+index=0
+for script in "${scripts[@]}"
+do
+    while [ `jobs -rp | wc -l` -ge $jobs ]
+    do
+        wait -n
+    done
+    runone $script $index &
+    index=$((index+1))
+done
+wait
+stop=`date +%s.%N`
+
+passed=0
+failed=0
+for script in "${scripts[@]}"
+do
+    cat $logdir/$script.json
+    if grep -q '"status":"pass"' $logdir/$script.json
+    then
+        passed=$((passed+1))
+    else
+        failed=$((failed+1))
+    fi
+done
+secs=`echo "$start $stop" | awk '{ printf "%.3f", $2 - $1 }'`
+echo "{\"tests\":${#scripts[@]},\"passed\":$passed,\"failed\":$failed,\"seconds\":$secs}"
+[ $failed -eq 0 ]
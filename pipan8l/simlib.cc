@@ -26,11 +26,25 @@
 // to access the teletype:
 //  write keyboard characters to pipe /tmp/pipan8l_ttykb
 //  read printer characters from pipe /tmp/pipan8l_ttypr
+// each SimLib instance keeps its own state so several can run at once
+// given different pipe names with pipan8l_ttypipes
 
 // envars:
 //  pipan8l_memfields = memory fields 1..8, default 2
+//  pipan8l_simdecode = 0 to step through each cycle instead of using pre-decoded instructions when running
+//  pipan8l_simidle = 0 to execute busy-wait loops instead of skipping ahead to the next event
+//                    always 0 when tracing so every instruction is traced
+//  pipan8l_simpoll = memory cycles between checks of the tty pipes, default 10000
+//  pipan8l_simtrace = 1 to print each instruction as executed
+//                     or name of binary trace ring file, decode with pipan8ltrace
+//  pipan8l_simtracesize = number of records in trace ring file, default 1M, rounded up to power of 2
 //  pipan8l_ttycps = teletype chars per sec 1..1000000, default 10
+//  pipan8l_ttypipes = pipe name prefix, kb and pr are appended, default /tmp/pipan8l_tty
 
+// tty timing is done in virtual time, ie, memory cycles executed,
+// so the host clock is never read and the pipes are only checked occasionally
+
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
@@ -38,8 +52,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <sys/time.h>
 #include <tcl.h>
 #include <unistd.h>
 
@@ -52,6 +66,32 @@
 #define ABORT() do { fprintf (stderr, "abort() %s:%d\n", __FILE__, __LINE__); abort (); } while (0)
 #define ASSERT(cond) do { if (__builtin_constant_p (cond)) { if (!(cond)) asm volatile ("assert failure line %c0" :: "i"(__LINE__)); } else { if (!(cond)) ABORT (); } } while (0)
 
+#define NSPERCYCLE 1600         // PDP-8/L memory cycle time
+#define NEVER 0xFFFFFFFFFFFFFFFFULL
+#define SKIPPOLL 100            // cycles between tty pipe checks when waiting for keyboard
+
+// snapshot file layout, written and mapped as is
+#define SNAPMAGIC "pipan8ls"
+#define SNAPVERSION 1
+struct SimSnap {
+    char magic[8];              // SNAPMAGIC
+    uint32_t version;           // SNAPVERSION
+    uint32_t size;              // sizeof (SimSnap)
+
+    uint64_t cyclecount;
+    uint64_t instrcount;
+    uint64_t eventdue[4];       // cycles from cyclecount to each event, 0xFFF... if not scheduled
+
+    uint16_t acreg, irtop, mareg, mbreg, pcreg, state;
+    uint16_t dfld, eareg, ifld, ifldafterjump, saveddfld, savedifld, memfields;
+    uint8_t lnreg, ionreg, idelay, intinhibiteduntiljump;
+    uint8_t kbflag, kbready, prflag, prfull, ttinten;
+    uint8_t kbchar, prchar;
+    uint8_t spare[3];
+
+    uint16_t memarray[MEMSIZE];
+};
+
 // which of the pins are outputs (switches)
 static uint16_t const wmsks[P_NU16S] = { P0_WMSK, P1_WMSK, P2_WMSK, P3_WMSK, P4_WMSK };
 
@@ -84,8 +124,26 @@ SimLib::SimLib ()
     memset (memarray, 0, sizeof memarray);
     memset (wrpads, 0, sizeof wrpads);
     traceon = false;
+    tracehdr  = NULL;
+    tracerecs = NULL;
+    tracemask = 0;
+    instrcount = 0;
+    usedecode = true;
+    useidle = true;
+    memset ((void *) idlecycles, 0, sizeof idlecycles);
+    for (int i = 0; i < MEMSIZE; i ++) {
+        decoded[i].handler = &SimLib::op_decode;
+        decoded[i].ea = 0;
+    }
+
+    cyclecount  = 0;
+    nexteventat = NEVER;
+    for (int i = 0; i < EV_COUNT; i ++) eventat[i] = NEVER;
+    cycperch    = 0;
+    pollcycles  = 10000;
 
     kbflag    = false;
+    kbready   = true;
     prflag    = false;
     prfull    = false;
     ttinten   = true;
@@ -94,8 +152,6 @@ SimLib::SimLib ()
     prwritefd = -1;
     kbchar    = 0;
     prchar    = 0;
-    kbnextus  = 0;
-    prnextus  = 0;
 
     intinhibiteduntiljump = false;
     dfld          = 0;
@@ -123,27 +179,44 @@ void SimLib::openpads ()
 
     // maybe turn tracing on
     char const *trenv = getenv ("pipan8l_simtrace");
-    traceon = (trenv != NULL) && (trenv[0] & 1);
+    if ((trenv != NULL) && (strcmp (trenv, "0") != 0) && (strcmp (trenv, "1") != 0) && (trenv[0] != 0)) {
+        opentrace (trenv);
+    } else {
+        traceon = (trenv != NULL) && (trenv[0] & 1);
+    }
+
+    // maybe use slow cycle-by-cycle stepping when running
+    char const *dcenv = getenv ("pipan8l_simdecode");
+    usedecode = (dcenv == NULL) || (dcenv[0] == 0) || (dcenv[0] & 1);
+    char const *idenv = getenv ("pipan8l_simidle");
+    useidle = (idenv == NULL) || (idenv[0] == 0) || (idenv[0] & 1);
+
+    // skipped loop instructions would not be traced
+    if (traceon || (tracerecs != NULL)) useidle = false;
 
     // create named pipes for tty's keyboard and printer
     // tcl script can read printer output from pipan8l_ttypr
     // and can send keyboard input to pipan8l_ttykb to debug test scripts
-    unlink ("/tmp/pipan8l_ttykb");
-    unlink ("/tmp/pipan8l_ttypr");
-    if (mkfifo ("/tmp/pipan8l_ttykb", 0666) < 0) {
-        fprintf (stderr, "SimLib::openpads: error creating /tmp/pipan8l_ttykb fifo: %m\n");
+    char const *tpenv = getenv ("pipan8l_ttypipes");
+    if ((tpenv == NULL) || (tpenv[0] == 0)) tpenv = "/tmp/pipan8l_tty";
+    kbpipename = std::string (tpenv) + "kb";
+    prpipename = std::string (tpenv) + "pr";
+    unlink (kbpipename.c_str ());
+    unlink (prpipename.c_str ());
+    if (mkfifo (kbpipename.c_str (), 0666) < 0) {
+        fprintf (stderr, "SimLib::openpads: error creating %s fifo: %m\n", kbpipename.c_str ());
         ABORT ();
     }
-    if (mkfifo ("/tmp/pipan8l_ttypr", 0666) < 0) {
-        fprintf (stderr, "SimLib::openpads: error creating /tmp/pipan8l_ttypr fifo: %m\n");
+    if (mkfifo (prpipename.c_str (), 0666) < 0) {
+        fprintf (stderr, "SimLib::openpads: error creating %s fifo: %m\n", prpipename.c_str ());
         ABORT ();
     }
 
     // open them in non-blocking mode on this end
     // use non-blocking mode so we don't get stuck in the open() call
-    kbreadfd = open ("/tmp/pipan8l_ttykb", O_RDONLY | O_NONBLOCK);
+    kbreadfd = open (kbpipename.c_str (), O_RDONLY | O_NONBLOCK);
     if (kbreadfd < 0) {
-        fprintf (stderr, "SimLib::openpads: error opening /tmp/pipan8l_ttykb fifo: %m\n");
+        fprintf (stderr, "SimLib::openpads: error opening %s fifo: %m\n", kbpipename.c_str ());
         ABORT ();
     }
     pthread_t tid;
@@ -155,10 +228,184 @@ void SimLib::openpads ()
         int cps = atoi (env);
         if (cps < 1) cps = 1;
         if (cps > 1000000) cps = 1000000;
-        usperch = 1000000 / cps;
+        cycperch = (1000000000 / NSPERCYCLE + cps - 1) / cps;
     } else {
-        usperch = 100000;
+        cycperch = (1000000000 / NSPERCYCLE + 9) / 10;
+    }
+
+    env = getenv ("pipan8l_simpoll");
+    if ((env != NULL) && (env[0] != 0)) {
+        int pc = atoi (env);
+        if (pc < 1) pc = 1;
+        pollcycles = pc;
+    }
+    schedevent (EV_HOSTPOLL, cyclecount + pollcycles);
+}
+
+// save processor, memory and tty state to snapshot file
+//  output:
+//   returns 0: successful
+//        else: errno code
+int SimLib::savesnap (char const *filename)
+{
+    if (runreg) return EBUSY;
+    stopswitch ();
+
+    int fd = open (filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return errno;
+    if (ftruncate (fd, sizeof (SimSnap)) < 0) {
+        int rc = errno;
+        close (fd);
+        return rc;
+    }
+    void *ptr = mmap (NULL, sizeof (SimSnap), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int rc = (ptr == MAP_FAILED) ? errno : 0;
+    close (fd);
+    if (rc != 0) return rc;
+
+    SimSnap *snap = (SimSnap *) ptr;
+    ASSERT (EV_COUNT <= 4);
+    memcpy (snap->magic, SNAPMAGIC, sizeof snap->magic);
+    snap->version    = SNAPVERSION;
+    snap->size       = sizeof *snap;
+    snap->cyclecount = cyclecount;
+    snap->instrcount = instrcount;
+    for (int ev = 0; ev < 4; ev ++) {
+        snap->eventdue[ev] = ((ev >= EV_COUNT) || (eventat[ev] == NEVER)) ? NEVER : eventat[ev] - cyclecount;
+    }
+    snap->acreg = acreg;
+    snap->irtop = irtop;
+    snap->mareg = mareg;
+    snap->mbreg = mbreg;
+    snap->pcreg = pcreg;
+    snap->state = state;
+    snap->dfld  = dfld;
+    snap->eareg = eareg;
+    snap->ifld  = ifld;
+    snap->ifldafterjump = ifldafterjump;
+    snap->saveddfld = saveddfld;
+    snap->savedifld = savedifld;
+    snap->memfields = memfields;
+    snap->lnreg   = lnreg;
+    snap->ionreg  = ionreg;
+    snap->idelay  = idelay;
+    snap->intinhibiteduntiljump = intinhibiteduntiljump;
+    snap->kbflag  = kbflag;
+    snap->kbready = kbready;
+    snap->prflag  = prflag;
+    snap->prfull  = prfull;
+    snap->ttinten = ttinten;
+    snap->kbchar  = kbchar;
+    snap->prchar  = prchar;
+    memcpy (snap->memarray, memarray, sizeof snap->memarray);
+
+    rc = (msync (ptr, sizeof *snap, MS_SYNC) < 0) ? errno : 0;
+    munmap (ptr, sizeof *snap);
+    return rc;
+}
+
+// check snapshot values that get used as memory indices
+//  output:
+//   returns NULL: all ok
+//           else: name of bad value
+static char const *snapbad (SimSnap const *snap)
+{
+    if (snap->dfld  >= snap->memfields) return "DF";
+    if (snap->eareg >= snap->memfields) return "EA";
+    if (snap->ifld  >= snap->memfields) return "IF";
+    if (snap->ifldafterjump >= snap->memfields) return "IF after jump";
+    if (snap->saveddfld >= snap->memfields) return "saved DF";
+    if (snap->savedifld >= snap->memfields) return "saved IF";
+    if (snap->acreg > 07777) return "AC";
+    if (snap->irtop > 7) return "IR";
+    if (snap->mareg > 07777) return "MA";
+    if (snap->mbreg > 07777) return "MB";
+    if (snap->pcreg > 07777) return "PC";
+    for (int i = 0; i < MEMSIZE; i ++) {
+        if (snap->memarray[i] > 07777) return "memory word";
+    }
+    return NULL;
+}
+
+// load processor, memory and tty state from snapshot file
+//  output:
+//   returns 0: successful
+//        else: errno code, state unchanged
+int SimLib::loadsnap (char const *filename)
+{
+    if (runreg) return EBUSY;
+    stopswitch ();
+
+    int fd = open (filename, O_RDONLY);
+    if (fd < 0) return errno;
+    struct stat statbuf;
+    if (fstat (fd, &statbuf) < 0) {
+        int rc = errno;
+        close (fd);
+        return rc;
+    }
+    if (statbuf.st_size != sizeof (SimSnap)) {
+        close (fd);
+        return EINVAL;
+    }
+    void *ptr = mmap (NULL, sizeof (SimSnap), PROT_READ, MAP_SHARED, fd, 0);
+    int rc = (ptr == MAP_FAILED) ? errno : 0;
+    close (fd);
+    if (rc != 0) return rc;
+
+    SimSnap const *snap = (SimSnap const *) ptr;
+    if ((memcmp (snap->magic, SNAPMAGIC, sizeof snap->magic) != 0) || (snap->version != SNAPVERSION) ||
+            (snap->size != sizeof *snap) || (snap->state > BRK) || (snap->memfields < 1) || (snap->memfields > 8)) {
+        munmap (ptr, sizeof *snap);
+        return EINVAL;
+    }
+    char const *bad = snapbad (snap);
+    if (bad != NULL) {
+        fprintf (stderr, "SimLib::loadsnap: %s: %s out of range\n", filename, bad);
+        munmap (ptr, sizeof *snap);
+        return EINVAL;
     }
+
+    cyclecount = snap->cyclecount;
+    instrcount = snap->instrcount;
+    nexteventat = NEVER;
+    for (int ev = 0; ev < EV_COUNT; ev ++) {
+        eventat[ev] = NEVER;
+        if (snap->eventdue[ev] != NEVER) schedevent ((Event) ev, cyclecount + snap->eventdue[ev]);
+    }
+    if (eventat[EV_HOSTPOLL] == NEVER) schedevent (EV_HOSTPOLL, cyclecount + pollcycles);
+    acreg = snap->acreg;
+    irtop = snap->irtop;
+    mareg = snap->mareg;
+    mbreg = snap->mbreg;
+    pcreg = snap->pcreg;
+    state = (State) snap->state;
+    dfld  = snap->dfld;
+    eareg = snap->eareg;
+    ifld  = snap->ifld;
+    ifldafterjump = snap->ifldafterjump;
+    saveddfld = snap->saveddfld;
+    savedifld = snap->savedifld;
+    memfields = snap->memfields;
+    lnreg   = snap->lnreg;
+    ionreg  = snap->ionreg;
+    idelay  = snap->idelay;
+    intinhibiteduntiljump = snap->intinhibiteduntiljump;
+    kbflag  = snap->kbflag;
+    kbready = snap->kbready;
+    prflag  = snap->prflag;
+    prfull  = snap->prfull;
+    ttinten = snap->ttinten;
+    ttintrq = ttinten & (kbflag | prflag);
+    kbchar  = snap->kbchar;
+    prchar  = snap->prchar;
+    memcpy (memarray, snap->memarray, sizeof memarray);
+    munmap (ptr, sizeof *snap);
+
+    for (int i = 0; i < MEMSIZE; i ++) {
+        decoded[i].handler = &SimLib::op_decode;
+    }
+    return 0;
 }
 
 // O_NONBLOCK doesn't seem to work with O_WRONLY so do in blocking style then modify
@@ -168,9 +415,10 @@ void *SimLib::openttyprpipe (void *zhis)
 
     // O_NONBLOCK gets non-existing device error
     // so wait here until reader connects
-    int fd = open ("/tmp/pipan8l_ttypr", O_WRONLY);
+    SimLib *me = (SimLib *) zhis;
+    int fd = open (me->prpipename.c_str (), O_WRONLY);
     if (fd < 0) {
-        fprintf (stderr, "SimLib::openpads: error opening /tmp/pipan8l_ttypr fifo: %m\n");
+        fprintf (stderr, "SimLib::openpads: error opening %s fifo: %m\n", me->prpipename.c_str ());
         ABORT ();
     }
 
@@ -180,7 +428,7 @@ void *SimLib::openttyprpipe (void *zhis)
     fprintf (stderr, "SimLib::openpads: tty connected\n");
 
     // ok to let main program use it now
-    ((SimLib *)zhis)->prwritefd = fd;
+    me->prwritefd = fd;
 
     return NULL;
 }
@@ -380,8 +628,37 @@ void *SimLib::runthreadwrap (void *zhis)
 
 void SimLib::runthread ()
 {
+    // step to end of instruction in progress
     do singlestep ();
-    while (runreg);
+    while (runreg && ! atinstrboundary ());
+
+    // then run whole instructions
+    if (usedecode) fastrun ();
+    else while (runreg) singlestep ();
+}
+
+// see if singlestep() has completed an instruction
+bool SimLib::atinstrboundary ()
+{
+    switch (state) {
+        case NUL: return true;
+        case FET: return ((mbreg & 07400) == 05000) || (irtop >= 6);   // direct JMP, IOT, OPR done in fetch
+        case DEF: return irtop == 5;                                    // indirect JMP done in defer
+        case EXE: return true;
+        default: return false;
+    }
+}
+
+// run instructions using pre-decoded table until runreg is cleared
+// leaves state and registers as singlestep() would at end of each instruction
+void SimLib::fastrun ()
+{
+    while (runreg) {
+        if (fetchinstr ()) {
+            SimOp const *op = &decoded[(ifld<<12)|mareg];
+            (this->*op->handler) (op->ea);
+        }
+    }
 }
 
 // step through to end of next state
@@ -418,6 +695,7 @@ void SimLib::singlestep ()
             // and if it's a JMP, do the jump at end of defer cycle
             if (mbreg & 00400) {
                 state = DEF;
+                cyclecount ++;
                 mbreg = readmem (ifld, mareg);
                 if ((mareg & 07770) == 00010) {
                     writemem (ifld, mareg, (mbreg + 1) & 07777);
@@ -466,8 +744,34 @@ void SimLib::singlestep ()
 // get us to the end of FET state for next instruction
 void SimLib::dofetch ()
 {
-    polltty ();
+    if (! fetchinstr ()) return;
+
+    // we can do direct JMP, IOT and OPR as part of the fetch
+    if ((mbreg & 07400) == 05000) {
+        intinhibiteduntiljump = false;
+        ifld  = ifldafterjump;
+        pcreg = ((mbreg & 00200) ? (mareg & 07600) : 0) | (mbreg & 00177);
+    } else if (irtop == 6) {
+        doioinst ();
+    } else if (irtop == 7) {
+        dooperate ();
+    }
+}
+
+// either do interrupt or fetch next instruction
+//  output:
+//   returns false: interrupt done, at end of EXE state
+//            true: instruction fetched, at end of FET state
+//                  mareg = address instruction was fetched from
+//                  mbreg = instruction
+//                  irtop = top 3 bits of instruction
+//                  pcreg = incremented
+inline bool SimLib::fetchinstr ()
+{
+    if (cyclecount >= nexteventat) runevents ();
+    cyclecount ++;
     if (ionreg && ttintrq && ! intinhibiteduntiljump) {
+        if (tracehdr != NULL) tracefetch ((ifld << 12) | pcreg, 0, SIMTRACE_ION | SIMTRACE_INTRQ | SIMTRACE_INTR);
         if (traceon) printf ("SimLib::dofetch:  PC=%o.%04o  L.AC=%o.%04o  IF=%o  DF=%o  interrupt\n",
                 ifld, pcreg, lnreg, acreg, ifld, dfld);
 
@@ -480,30 +784,24 @@ void SimLib::dofetch ()
         mareg  = 0;
         writemem (0, 0, pcreg);
         pcreg  = 1;
-        return;
+        return false;
     }
     ionreg = idelay;
 
     state = FET;
     mbreg = readmem (ifld, pcreg);
+    if (tracehdr != NULL) tracefetch ((eareg << 12) | mareg, mbreg,
+        (ionreg ? SIMTRACE_ION : 0) | (intinhibiteduntiljump ? SIMTRACE_INHIB : 0) | (ttintrq ? SIMTRACE_INTRQ : 0));
     irtop = mbreg >> 9;
     pcreg = (pcreg + 1) & 07777;
+    instrcount ++;
 
     if ((irtop & 6) == 4) intinhibiteduntiljump = false;
 
     if (traceon) printf ("SimLib::dofetch:  PC=%o.%04o  L.AC=%o.%04o  IF=%o  DF=%o  IR=%04o  %s\n",
             eareg, mareg, lnreg, acreg, ifld, dfld, mbreg, disassemble (mbreg, mareg).c_str ());
 
-    // we can do direct JMP, IOT and OPR as part of the fetch
-    if ((mbreg & 07400) == 05000) {
-        intinhibiteduntiljump = false;
-        ifld  = ifldafterjump;
-        pcreg = ((mbreg & 00200) ? (mareg & 07600) : 0) | (mbreg & 00177);
-    } else if (irtop == 6) {
-        doioinst ();
-    } else if (irtop == 7) {
-        dooperate ();
-    }
+    return true;
 }
 
 // at end of FET or DEF state, perform memory reference instruction
@@ -513,38 +811,56 @@ void SimLib::domemref ()
 {
     state = EXE;
     switch (irtop) {
-        case 0: {
-            acreg &= readmem (eareg, mareg);
-            break;
-        }
-        case 1: {
-            acreg += readmem (eareg, mareg);
-            lnreg ^= acreg >> 12;
-            acreg &= 07777;
-            break;
-        }
-        case 2: {
-            mbreg = (readmem (eareg, mareg) + 1) & 07777;
-            writemem (eareg, mareg, mbreg);
-            if (mbreg == 0) pcreg = (pcreg + 1) & 07777;
-            break;
-        }
-        case 3: {
-            writemem (eareg, mareg, acreg);
-            acreg = 0;
-            break;
-        }
-        case 4: {
-            intinhibiteduntiljump = false;
-            ifld  = ifldafterjump;
-            writemem (ifld, mareg, pcreg);
-            pcreg = (mareg + 1) & 07777;
-            break;
-        }
+        case 0: memand (); break;
+        case 1: memtad (); break;
+        case 2: memisz (); break;
+        case 3: memdca (); break;
+        case 4: memjms (); break;
         default: ABORT ();
     }
 }
 
+// execute memory reference instructions
+//  input:
+//   eareg,mareg = operand address
+void SimLib::memand ()
+{
+    cyclecount ++;
+    acreg &= readmem (eareg, mareg);
+}
+
+void SimLib::memtad ()
+{
+    cyclecount ++;
+    acreg += readmem (eareg, mareg);
+    lnreg ^= acreg >> 12;
+    acreg &= 07777;
+}
+
+void SimLib::memisz ()
+{
+    cyclecount ++;
+    mbreg = (readmem (eareg, mareg) + 1) & 07777;
+    writemem (eareg, mareg, mbreg);
+    if (mbreg == 0) pcreg = (pcreg + 1) & 07777;
+}
+
+void SimLib::memdca ()
+{
+    cyclecount ++;
+    writemem (eareg, mareg, acreg);
+    acreg = 0;
+}
+
+void SimLib::memjms ()
+{
+    cyclecount ++;
+    intinhibiteduntiljump = false;
+    ifld  = ifldafterjump;
+    writemem (ifld, mareg, pcreg);
+    pcreg = (mareg + 1) & 07777;
+}
+
 // read memory location
 // set eareg, mareg, mbreg
 uint16_t SimLib::readmem (uint16_t field, uint16_t addr)
@@ -569,72 +885,76 @@ void SimLib::writemem (uint16_t field, uint16_t addr, uint16_t data)
     if (field < memfields) {
         uint16_t xaddr = (eareg << 12) | mareg;
         memarray[xaddr] = mbreg;
+        decoded[xaddr].handler = &SimLib::op_decode;
     }
 }
 
 // end of fetch with operate instruciton, do the operation as part of fetch cycle
 void SimLib::dooperate ()
 {
-    if (! (mbreg & 00400)) {
+    if (! (mbreg & 00400)) dogroup1 ();
+    else if (! (mbreg & 00001)) dogroup2 ();
+    else {
+        fprintf (stderr, "dooperate: EAE %04o at %o.%04o\n", mbreg, eareg, mareg);
+    }
+}
+
+void SimLib::dogroup1 ()
+{
+    if (mbreg & 00200) acreg  = 0;
+    if (mbreg & 00100) lnreg  = false;
+    if (mbreg & 00040) acreg ^= 07777;
+    if (mbreg & 00020) lnreg ^= true;
+    if (mbreg & 00001) {
+        lnreg ^= (++ acreg) >> 12;
+        acreg &= 07777;
+    }
 
-        if (mbreg & 00200) acreg  = 0;
-        if (mbreg & 00100) lnreg  = false;
-        if (mbreg & 00040) acreg ^= 07777;
-        if (mbreg & 00020) lnreg ^= true;
-        if (mbreg & 00001) {
-            lnreg ^= (++ acreg) >> 12;
+    switch ((mbreg >> 1) & 7) {
+        case 0: break;
+        case 1: {                           // BSW
+            acreg = ((acreg & 077) << 6) | (acreg >> 6);
+            break;
+        }
+        case 2: {                           // RAL
+            acreg = (acreg << 1) | (lnreg ? 1 : 0);
+            lnreg = (acreg & 010000) != 0;
             acreg &= 07777;
+            break;
         }
-
-        switch ((mbreg >> 1) & 7) {
-            case 0: break;
-            case 1: {                           // BSW
-                acreg = ((acreg & 077) << 6) | (acreg >> 6);
-                break;
-            }
-            case 2: {                           // RAL
-                acreg = (acreg << 1) | (lnreg ? 1 : 0);
-                lnreg = (acreg & 010000) != 0;
-                acreg &= 07777;
-                break;
-            }
-            case 3: {                           // RTL
-                acreg = (acreg << 2) | (lnreg ? 2 : 0) | (acreg >> 11);
-                lnreg = (acreg & 010000) != 0;
-                acreg &= 07777;
-                break;
-            }
-            case 4: {                           // RAR
-                uint16_t oldac = acreg;
-                acreg = (acreg >> 1) | (lnreg ? 04000 : 0);
-                lnreg = (oldac & 1) != 0;
-                break;
-            }
-            case 5: {                           // RTR
-                acreg = (acreg >> 2) | (lnreg ? 02000 : 0) | ((acreg & 3) << 11);
-                lnreg = (acreg & 010000) != 0;
-                acreg &= 07777;
-                break;
-            }
+        case 3: {                           // RTL
+            acreg = (acreg << 2) | (lnreg ? 2 : 0) | (acreg >> 11);
+            lnreg = (acreg & 010000) != 0;
+            acreg &= 07777;
+            break;
+        }
+        case 4: {                           // RAR
+            uint16_t oldac = acreg;
+            acreg = (acreg >> 1) | (lnreg ? 04000 : 0);
+            lnreg = (oldac & 1) != 0;
+            break;
+        }
+        case 5: {                           // RTR
+            acreg = (acreg >> 2) | (lnreg ? 02000 : 0) | ((acreg & 3) << 11);
+            lnreg = (acreg & 010000) != 0;
+            acreg &= 07777;
+            break;
         }
     }
+}
 
-    else if (! (mbreg & 00001)) {
-        bool skip = false;
-        if ((mbreg & 0100) && (acreg & 04000)) skip = true;     // SMA
-        if ((mbreg & 0040) && (acreg ==    0)) skip = true;     // SZA
-        if ((mbreg & 0020) &&           lnreg) skip = true;     // SNL
-        if  (mbreg & 0010)                     skip = ! skip;   // reverse
-        if (skip) pcreg = (pcreg + 1) & 07777;
-
-        if (mbreg & 00200) acreg  = 0;
-        if (mbreg & 00004) acreg |= swreg;
-        if (mbreg & 00002) runreg = false;
-    }
-
-    else {
-        fprintf (stderr, "dooperate: EAE %04o at %o.%04o\n", mbreg, eareg, mareg);
-    }
+void SimLib::dogroup2 ()
+{
+    bool skip = false;
+    if ((mbreg & 0100) && (acreg & 04000)) skip = true;     // SMA
+    if ((mbreg & 0040) && (acreg ==    0)) skip = true;     // SZA
+    if ((mbreg & 0020) &&           lnreg) skip = true;     // SNL
+    if  (mbreg & 0010)                     skip = ! skip;   // reverse
+    if (skip) pcreg = (pcreg + 1) & 07777;
+
+    if (mbreg & 00200) acreg  = 0;
+    if (mbreg & 00004) acreg |= swreg;
+    if (mbreg & 00002) runreg = false;
 }
 
 // end of fetch with I/O instruction, do the I/O as part of the fetch cycle
@@ -647,16 +967,24 @@ void SimLib::doioinst ()
         case 06002: idelay = false; ionreg = false; break;
 
         // tty access
-        case 06031: if (kbflag) pcreg = (pcreg + 1) & 07777; break;
+        case 06031: {
+            if (kbflag) pcreg = (pcreg + 1) & 07777;
+
+            // waiting for keyboard, check the pipe sooner than usual
+            else if (kbready && (eventat[EV_HOSTPOLL] > cyclecount + SKIPPOLL)) {
+                schedevent (EV_HOSTPOLL, cyclecount + SKIPPOLL);
+            }
+            break;
+        }
         case 06032: acreg = 0; kbflag = 0; break;
         case 06034: acreg |= kbchar; break;
         case 06035: ttinten = acreg & 1; break;
         case 06036: acreg = kbchar; kbflag = 0; break;
         case 06041: if (prflag) pcreg = (pcreg + 1) & 07777; break;
         case 06042: prflag = 0; break;
-        case 06044: prchar = acreg; prfull = 1; break;
+        case 06044: prchar = acreg; prfull = 1; schedevent (EV_PRDONE, cyclecount + cycperch); break;
         case 06045: if (ttintrq) pcreg = (pcreg + 1) & 07777; break;
-        case 06046: prchar = acreg; prflag = 0; prfull = 1; break;
+        case 06046: prchar = acreg; prflag = 0; prfull = 1; schedevent (EV_PRDONE, cyclecount + cycperch); break;
 
         // extended memory
         case 06201: case 06202: case 06203:
@@ -693,40 +1021,274 @@ void SimLib::doioinst ()
             ifldafterjump = savedifld;
             break;
     }
+
+    ttintrq = ttinten & (kbflag | prflag);
 }
 
-// update tty state
-void SimLib::polltty ()
+// pre-decoded instruction handlers
+// called by fastrun() at end of fetch to finish the instruction
+// leave registers and state as singlestep() would
+//  input:
+//   ea = address within field from memory reference instruction
+
+// first time executing instruction since written, fill in table entry then execute it
+void SimLib::op_decode (uint16_t ea)
 {
-    struct timeval nowtv;
-    if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-    uint64_t nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
+    static OpHandler const directs[6] = {
+        &SimLib::op_and_d, &SimLib::op_tad_d, &SimLib::op_isz_d, &SimLib::op_dca_d, &SimLib::op_jms_d, &SimLib::op_jmp_d };
+    static OpHandler const indirects[6] = {
+        &SimLib::op_and_i, &SimLib::op_tad_i, &SimLib::op_isz_i, &SimLib::op_dca_i, &SimLib::op_jms_i, &SimLib::op_jmp_i };
+
+    SimOp *op = &decoded[(ifld<<12)|mareg];
+    op->ea = ((mbreg & 00200) ? (mareg & 07600) : 0) | (mbreg & 00177);
+    if (irtop < 6) op->handler = ((mbreg & 00400) ? indirects : directs)[irtop];
+    else if (irtop == 6) op->handler = &SimLib::op_iot;
+    else if (! (mbreg & 00400)) op->handler = &SimLib::op_group1;
+    else if (! (mbreg & 00001)) op->handler = &SimLib::op_group2;
+    else op->handler = &SimLib::op_eae;
+    (this->*op->handler) (op->ea);
+}
 
-    if (prfull && (nowus >= prnextus) && (prwritefd >= 0)) {
-        int rc = write (prwritefd, &prchar, 1);
-        if (rc > 0) {
-            prflag   = 1;
-            prfull   = 0;
-            prnextus = nowus + usperch;
-        } else if ((rc == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
-            if (rc == 0) fprintf (stderr, "SimLib::polltty: eof writing to tty pipe\n");
-            else fprintf (stderr, "SimLib::polltty: error writing to tty pipe: %m\n");
+void SimLib::op_and_d (uint16_t ea) { state = EXE; eareg = ifld; mareg = ea; memand (); }
+void SimLib::op_tad_d (uint16_t ea) { state = EXE; eareg = ifld; mareg = ea; memtad (); }
+void SimLib::op_isz_d (uint16_t ea) { state = EXE; eareg = ifld; mareg = ea; memisz (); }
+void SimLib::op_dca_d (uint16_t ea) { state = EXE; eareg = ifld; mareg = ea; memdca (); }
+void SimLib::op_jms_d (uint16_t ea) { state = EXE; eareg = ifld; mareg = ea; memjms (); }
+
+void SimLib::op_jmp_d (uint16_t ea)
+{
+    intinhibiteduntiljump = false;
+    ifld  = ifldafterjump;
+    pcreg = ea;
+    if (useidle && (eareg == ifld) && ((ea == mareg) || (ea == ((mareg - 1) & 07777)))) idleloop ();
+}
+
+void SimLib::op_and_i (uint16_t ea) { deferred (ea); state = EXE; eareg = dfld; mareg = mbreg; memand (); }
+void SimLib::op_tad_i (uint16_t ea) { deferred (ea); state = EXE; eareg = dfld; mareg = mbreg; memtad (); }
+void SimLib::op_isz_i (uint16_t ea) { deferred (ea); state = EXE; eareg = dfld; mareg = mbreg; memisz (); }
+void SimLib::op_dca_i (uint16_t ea) { deferred (ea); state = EXE; eareg = dfld; mareg = mbreg; memdca (); }
+void SimLib::op_jms_i (uint16_t ea) { deferred (ea); state = EXE; eareg = dfld; mareg = mbreg; memjms (); }
+
+void SimLib::op_jmp_i (uint16_t ea)
+{
+    deferred (ea);
+    intinhibiteduntiljump = false;
+    ifld  = ifldafterjump;
+    pcreg = mbreg;
+}
+
+void SimLib::op_iot (uint16_t ea) { doioinst (); }
+void SimLib::op_group1 (uint16_t ea) { dogroup1 (); }
+void SimLib::op_group2 (uint16_t ea) { dogroup2 (); }
+void SimLib::op_eae (uint16_t ea) { dooperate (); }
+
+// do defer cycle for indirect memory reference
+//  input:
+//   ea = address of pointer in instruction field
+//  output:
+//   mbreg = pointer, incremented if autoindex
+inline void SimLib::deferred (uint16_t ea)
+{
+    state = DEF;
+    cyclecount ++;
+    mbreg = readmem (ifld, ea);
+    if ((ea & 07770) == 00010) {
+        writemem (ifld, ea, (mbreg + 1) & 07777);
+    }
+}
+
+// just did a JMP . or JMP .-1, skip ahead through busy-wait loop
+// runs the loop up to the next event, leaving state as if it was executed
+//  input:
+//   mareg = address of JMP instruction
+//   mbreg = JMP instruction
+//   pcreg = jump target
+//  output:
+//   cyclecount, instrcount advanced
+void SimLib::idleloop ()
+{
+    // interrupt would be taken on next fetch
+    if (idelay && ttintrq) return;
+    if (ifld >= memfields) return;
+    if (cyclecount >= nexteventat) return;
+    uint64_t avail = nexteventat - cyclecount;
+
+    // JMP . just loops until an interrupt or the operator stops it
+    if (pcreg == mareg) {
+        cyclecount += avail;
+        instrcount += avail;
+        idlecycles[IDLE_JMPSELF] += avail;
+        return;
+    }
+
+    uint16_t jmpaddr = mareg;
+    uint16_t jmpinst = mbreg;
+    uint16_t inst = memarray[(ifld<<12)|pcreg];
+    switch (inst) {
+
+        // KSF, TSF, TSK loops wait for an event to set the flag
+        case 06031: if (kbflag)  return; goto skipflag;
+        case 06041: if (prflag)  return; goto skipflag;
+        case 06045: if (ttintrq) return; goto skipflag;
+        skipflag: {
+            uint64_t k = avail / 2;
+            cyclecount += k * 2;
+            instrcount += k * 2;
+            idlecycles[IDLE_SKIPFLAG] += k * 2;
+            break;
+        }
+
+        // ISZ x; JMP .-1 delay loop, count x up to just short of zero
+        default: {
+            if ((inst & 07400) != 02000) break;
+            uint16_t x = ((inst & 00200) ? (pcreg & 07600) : 0) | (inst & 00177);
+            if ((x == pcreg) || (x == jmpaddr)) break;
+            uint16_t v = memarray[(ifld<<12)|x];
+            uint64_t n = (010000 - v) & 07777;
+            if (n == 0) n = 010000;
+            uint64_t k = n - 1;
+            if (k > avail / 3) k = avail / 3;
+            if (k == 0) break;
+            writemem (ifld, x, v + k);
+            eareg = ifld;
+            mareg = jmpaddr;
+            mbreg = jmpinst;
+            cyclecount += k * 3;
+            instrcount += k * 2;
+            idlecycles[IDLE_ISZLOOP] += k * 3;
+            break;
+        }
+    }
+}
+
+// create binary trace ring file and map it
+void SimLib::opentrace (char const *filename)
+{
+    uint64_t nrecs = 1 << 20;
+    char const *szenv = getenv ("pipan8l_simtracesize");
+    if ((szenv != NULL) && (szenv[0] != 0)) {
+        char *p;
+        uint64_t n = strtoull (szenv, &p, 0);
+        if ((*p != 0) || (n < 1) || (n > (1ULL << 32))) {
+            fprintf (stderr, "SimLib::opentrace: trace size %s must be in range 1..%llu\n", szenv, 1ULL << 32);
             ABORT ();
         }
+        for (nrecs = 1; nrecs < n; nrecs *= 2) { }
+    }
+
+    int fd = open (filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf (stderr, "SimLib::opentrace: error creating %s: %m\n", filename);
+        ABORT ();
+    }
+    uint64_t size = sizeof *tracehdr + nrecs * sizeof *tracerecs;
+    if (ftruncate (fd, size) < 0) {
+        fprintf (stderr, "SimLib::opentrace: error extending %s: %m\n", filename);
+        ABORT ();
+    }
+    void *ptr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        fprintf (stderr, "SimLib::opentrace: error mapping %s: %m\n", filename);
+        ABORT ();
+    }
+    close (fd);
+
+    tracehdr  = (SimTraceHdr *) ptr;
+    tracerecs = (SimTraceRec *) (tracehdr + 1);
+    tracemask = nrecs - 1;
+    memcpy (tracehdr->magic, SIMTRACE_MAGIC, sizeof tracehdr->magic);
+    tracehdr->version = SIMTRACE_VERSION;
+    tracehdr->recsize = sizeof *tracerecs;
+    tracehdr->nrecs   = nrecs;
+    tracehdr->next    = 0;
+    fprintf (stderr, "SimLib::opentrace: tracing last %llu instructions to %s\n", (unsigned long long) nrecs, filename);
+}
+
+// write fetch or interrupt to trace ring file
+inline void SimLib::tracefetch (uint16_t addr, uint16_t ir, uint8_t flags)
+{
+    uint64_t next = tracehdr->next;
+    SimTraceRec *rec = &tracerecs[next&tracemask];
+    rec->cycle = cyclecount;
+    rec->addr  = addr;
+    rec->ir    = ir;
+    rec->lac   = (lnreg << 12) | acreg;
+    rec->dfld  = dfld;
+    rec->flags = flags;
+    tracehdr->next = next + 1;
+}
+
+// schedule event at the given cyclecount, replacing any previous time for that event
+void SimLib::schedevent (Event ev, uint64_t at)
+{
+    eventat[ev] = at;
+    if (nexteventat > at) nexteventat = at;
+}
+
+// process all events that are due
+void SimLib::runevents ()
+{
+    for (int ev = 0; ev < EV_COUNT; ev ++) {
+        if (eventat[ev] > cyclecount) continue;
+        eventat[ev] = NEVER;
+        switch (ev) {
+
+            // time to check the pipes
+            case EV_HOSTPOLL: {
+                pollhost ();
+                schedevent (EV_HOSTPOLL, cyclecount + pollcycles);
+                break;
+            }
+
+            // printer finished printing character, send it to pipe
+            // if pipe not open or full, try again later
+            case EV_PRDONE: {
+                int rc = (prwritefd < 0) ? -1 : write (prwritefd, &prchar, 1);
+                if (rc > 0) {
+                    prflag = 1;
+                    prfull = 0;
+                } else if ((prwritefd >= 0) && ((rc == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))) {
+                    if (rc == 0) fprintf (stderr, "SimLib::runevents: eof writing to tty pipe\n");
+                    else fprintf (stderr, "SimLib::runevents: error writing to tty pipe: %m\n");
+                    ABORT ();
+                } else {
+                    schedevent (EV_PRDONE, cyclecount + pollcycles);
+                }
+                break;
+            }
+
+            // keyboard can accept another character
+            case EV_KBREADY: {
+                kbready = true;
+                break;
+            }
+
+            default: ABORT ();
+        }
+    }
+
+    nexteventat = NEVER;
+    for (int ev = 0; ev < EV_COUNT; ev ++) {
+        if (nexteventat > eventat[ev]) nexteventat = eventat[ev];
     }
 
-    if (nowus >= kbnextus) {
+    ttintrq = ttinten & (kbflag | prflag);
+}
+
+// check keyboard pipe for another character
+void SimLib::pollhost ()
+{
+    if (kbready) {
         int rc = read (kbreadfd, &kbchar, 1);
         if (rc > 0) {
-            kbflag   = 1;
-            kbnextus = nowus + usperch;
+            kbflag  = 1;
+            kbready = false;
+            schedevent (EV_KBREADY, cyclecount + cycperch);
         } else if ((rc < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
-            fprintf (stderr, "SimLib::polltty: error reading from tty pipe: %m\n");
+            fprintf (stderr, "SimLib::pollhost: error reading from tty pipe: %m\n");
             ABORT ();
         }
     }
-
-    ttintrq = ttinten & (kbflag | prflag);
 }
 
 char const *SimLib::ststr ()
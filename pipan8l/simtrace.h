@@ -0,0 +1,55 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// binary instruction trace ring file written by simlib.cc, read by pipan8ltrace.cc
+//  file = SimTraceHdr followed by nrecs SimTraceRecs
+//  record for fetch number n is at index n % nrecs
+
+#ifndef _SIMTRACE_H
+#define _SIMTRACE_H
+
+#include <stdint.h>
+
+#define SIMTRACE_MAGIC "pipan8lt"
+#define SIMTRACE_VERSION 1
+
+#define SIMTRACE_ION   0x01     // interrupts enabled at time of fetch
+#define SIMTRACE_INHIB 0x02     // interrupts inhibited until jump
+#define SIMTRACE_INTRQ 0x04     // interrupt requested
+#define SIMTRACE_INTR  0x08     // interrupt taken instead of fetch, ir not valid
+
+struct SimTraceHdr {
+    char magic[8];              // SIMTRACE_MAGIC
+    uint32_t version;           // SIMTRACE_VERSION
+    uint32_t recsize;           // sizeof (SimTraceRec)
+    uint64_t nrecs;             // number of records in ring, power of 2
+    uint64_t next;              // number of records ever written
+};
+
+struct SimTraceRec {
+    uint64_t cycle;             // memory cycle count including the fetch
+    uint16_t addr;              // IF<<12 | PC instruction fetched from (or PC saved by interrupt)
+    uint16_t ir;                // instruction
+    uint16_t lac;               // L<<12 | AC before executing instruction
+    uint8_t dfld;               // data field
+    uint8_t flags;              // SIMTRACE_* flags
+};
+
+#endif
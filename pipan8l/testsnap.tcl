@@ -0,0 +1,139 @@
+;# ./pipan8l -sim testsnap.tcl
+;# test savesnap/loadsnap round trip on the built-in simulator
+;# saves a snapshot, scrambles registers and memory, loads snapshot back and compares
+
+puts ""
+puts "testsnap: snapshot save/load test"
+
+set snapfile "/tmp/testsnap_[pid].snap"
+
+;# deposit words starting at the given address, leaves MA at the end
+proc depwords {addr words} {
+    setsw ifld [expr {$addr >> 12}]
+    setsw dfld [expr {$addr >> 12}]
+    setsw sr [expr {$addr & 07777}]
+    flicksw ldad
+    foreach word $words {
+        setsw sr $word
+        flicksw dep
+    }
+}
+
+;# read words starting at the given address
+proc exwords {addr count} {
+    setsw ifld [expr {$addr >> 12}]
+    setsw dfld [expr {$addr >> 12}]
+    setsw sr [expr {$addr & 07777}]
+    flicksw ldad
+    set words {}
+    for {set i 0} {$i < $count} {incr i} {
+        flicksw exam
+        lappend words [getreg mb]
+    }
+    return $words
+}
+
+;# run program at 0200 until it halts
+proc runprog {} {
+    setsw ifld 0
+    setsw dfld 0
+    setsw sr 0200
+    flicksw ldad
+    flicksw start
+    for {set i 0} {[getreg run]} {incr i} {
+        if {$i > 100} {
+            puts "testsnap: program did not halt"
+            exit 1
+        }
+        after 10
+    }
+}
+
+proc getregs {} {
+    return [list [getreg ac] [getreg link] [getreg ma] [getreg mb] [getreg ir]]
+}
+
+;# CLA CLL; TAD 0210; CML; HLT with 0210 = given value
+proc loadprog {acval} {
+    depwords 0200 {07300 01210 07020 07402}
+    depwords 0210 [list $acval]
+}
+
+;# random data in both fields
+set data0 {}
+set data1 {}
+for {set i 0} {$i < 64} {incr i} {
+    lappend data0 [expr {int (rand () * 4096)}]
+    lappend data1 [expr {int (rand () * 4096)}]
+}
+
+setsw step 0
+flicksw stop
+depwords 000400 $data0
+depwords 010400 $data1
+loadprog 01234
+runprog
+set regs [getregs]
+set mem0 [exwords 000400 64]
+set mem1 [exwords 010400 64]
+if {($mem0 != $data0) || ($mem1 != $data1)} {
+    puts "testsnap: memory readback failed before save"
+    exit 1
+}
+
+;# readback moved MA and MB, so run again to get the registers back then save
+runprog
+if {[getregs] != $regs} {
+    puts "testsnap: registers not repeatable before save"
+    exit 1
+}
+savesnap $snapfile
+
+;# scramble everything
+depwords 000400 [lrepeat 64 0]
+depwords 010400 [lrepeat 64 07777]
+loadprog 04321
+runprog
+if {[getregs] == $regs} {
+    puts "testsnap: registers did not change after scramble"
+    exit 1
+}
+
+;# load snapshot back, check registers before reading memory moves MA and MB
+loadsnap $snapfile
+file delete $snapfile
+set newregs [getregs]
+if {$newregs != $regs} {
+    puts "testsnap: registers were <$regs> after load <$newregs>"
+    exit 1
+}
+if {[exwords 000400 64] != $data0} {
+    puts "testsnap: field 0 memory differs after load"
+    exit 1
+}
+if {[exwords 010400 64] != $data1} {
+    puts "testsnap: field 1 memory differs after load"
+    exit 1
+}
+if {[exwords 00210 1] != 01234} {
+    puts "testsnap: program data differs after load"
+    exit 1
+}
+
+;# snapshot with a bad IF must be rejected
+savesnap $snapfile
+set fp [open $snapfile r+]
+fconfigure $fp -translation binary
+seek $fp 80
+puts -nonewline $fp [binary format s 9]
+close $fp
+set rc [catch {loadsnap $snapfile} msg]
+file delete $snapfile
+if {! $rc} {
+    puts "testsnap: snapshot with bad field was accepted"
+    exit 1
+}
+puts "testsnap: bad snapshot rejected: $msg"
+
+puts "testsnap: success"
+exit 0
@@ -41,8 +41,12 @@ static uint32_t volatile *cmemat;
 static uint32_t volatile *extmem;
 static uint32_t volatile *pdpat;
 static uint32_t volatile *xmemat;
+static Z8LPage *z8p;
 
 static void siginthand (int signum);
+static void burstwrite (uint16_t startat, uint16_t stopat);
+static bool burstread (uint16_t startat, uint16_t stopat, uint32_t *errors);
+static bool skipaddr (uint16_t xaddr);
 static void writemem (uint16_t xaddr, uint16_t wdata, bool do3cyc, bool cainc);
 static uint16_t readmem (uint16_t xaddr, bool do3cyc, bool cainc);
 static void waitcmemidle ();
@@ -87,11 +91,11 @@ int main (int argc, char **argv)
         return 1;
     }
 
-    Z8LPage z8p;
-    pdpat  = z8p.findev ("8L", NULL, NULL, true);
-    cmemat = z8p.findev ("CM", NULL, NULL, true);
-    xmemat = z8p.findev ("XM", NULL, NULL, true);
-    extmem = z8p.extmem ();
+    z8p    = new Z8LPage ();
+    pdpat  = z8p->findev ("8L", NULL, NULL, true);
+    cmemat = z8p->findev ("CM", NULL, NULL, true);
+    xmemat = z8p->findev ("XM", NULL, NULL, true);
+    extmem = z8p->extmem ();
 
     printf ("8L VERSION=%08X\n", pdpat[0]);
     printf ("CM VERSION=%08X\n", cmemat[0]);
@@ -146,24 +150,30 @@ int main (int argc, char **argv)
         }
 
         // write memory using cmem interface (break cycles)
-        for (int i = startat; i <= stopat; i ++) {
+        // without 3-cycles, do it a block at a time
+        if (! test3cyc) {
+            burstwrite (startat, stopat);
             if (exitflag) goto done;
-
-            // don't overwrite the DOTJMPDOT instruction
-            if (i == DOTJMPDOT) continue;
-            if (i == DOTJMPDOT+1) continue;
-
-            // don't work on the idwc/idca words
-            if (i == idwc) continue;
-            if (i == idca) continue;
-
-            // get a random number and tell cmem interface to write it to memory via dma cycle
-            bool do3cycls = test3cyc && randbits (1);
-            bool docaincr = do3cycls && testcain && randbits (1);
-            uint16_t randata;
-            do randata = randbits (12);
-            while (randata == DOTJMPDOT);
-            writemem (i, randata, do3cycls, docaincr);
+        } else {
+            for (int i = startat; i <= stopat; i ++) {
+                if (exitflag) goto done;
+
+                // don't overwrite the DOTJMPDOT instruction
+                if (i == DOTJMPDOT) continue;
+                if (i == DOTJMPDOT+1) continue;
+
+                // don't work on the idwc/idca words
+                if (i == idwc) continue;
+                if (i == idca) continue;
+
+                // get a random number and tell cmem interface to write it to memory via dma cycle
+                bool do3cycls = test3cyc && randbits (1);
+                bool docaincr = do3cycls && testcain && randbits (1);
+                uint16_t randata;
+                do randata = randbits (12);
+                while (randata == DOTJMPDOT);
+                writemem (i, randata, do3cycls, docaincr);
+            }
         }
 
         // finish clocking write to 077777 (stopat) so readback via extmem[] will work
@@ -184,31 +194,37 @@ int main (int argc, char **argv)
         }
 
         // readback memory using cmem interface (break cycles) which can access all memory
-        for (int i = startat; i <= stopat; i ++) {
-            if (exitflag) goto done;
-
-            if (i == DOTJMPDOT) continue;
-            if (i == DOTJMPDOT+1) continue;
-
-            // don't work on the idwc/idca words
-            if (i == idwc) continue;
-            if (i == idca) continue;
-
-            // read memory via DMA cycle
-            bool do3cycls = test3cyc && randbits (1);
-            bool docaincr = do3cycls && testcain && randbits (1);
-            uint16_t rdata = readmem (i, do3cycls, docaincr);
-
-            // verify value read vs value written
-            uint16_t wdata = shadow[i];
-            if (rdata != wdata) {
-                printf ("cmem error %05o was %04o should be %04o\n", i, rdata, wdata);
-                errors ++;
-                ABORT ();
+        if (! test3cyc) {
+            if (! burstread (startat, stopat, &errors)) goto done;
+        } else {
+            for (int i = startat; i <= stopat; i ++) {
+                if (exitflag) goto done;
+
+                if (i == DOTJMPDOT) continue;
+                if (i == DOTJMPDOT+1) continue;
+
+                // don't work on the idwc/idca words
+                if (i == idwc) continue;
+                if (i == idca) continue;
+
+                // read memory via DMA cycle
+                bool do3cycls = test3cyc && randbits (1);
+                bool docaincr = do3cycls && testcain && randbits (1);
+                uint16_t rdata = readmem (i, do3cycls, docaincr);
+
+                // verify value read vs value written
+                uint16_t wdata = shadow[i];
+                if (rdata != wdata) {
+                    printf ("cmem error %05o was %04o should be %04o\n", i, rdata, wdata);
+                    errors ++;
+                    ABORT ();
+                }
             }
         }
 
-        printf ("\npass %u complete %u errors\n\n", pass, errors);
+        printf ("\npass %u complete %u errors\n", pass, errors);
+        if (! test3cyc) printf ("  block dma %.0f words/sec\n", z8p->dmarate ());
+        putchar ('\n');
     }
 done:;
     putchar ('\n');
@@ -222,6 +238,68 @@ static void siginthand (int signum)
 
 
 
+// write random data to a range of memory using block DMA
+// splits the range at field boundaries and around the JMP . loop
+static void burstwrite (uint16_t startat, uint16_t stopat)
+{
+    uint16_t buf[4096];
+    uint16_t bufat = startat;
+    int nbuf = 0;
+
+    for (uint32_t i = startat; i <= stopat; i ++) {
+        if ((nbuf > 0) && (skipaddr (i) || ((i & 07777) == 0))) {
+            z8p->dmawrite (bufat, buf, nbuf);
+            nbuf = 0;
+            if (exitflag) return;
+        }
+        if (skipaddr (i)) continue;
+        if (nbuf == 0) bufat = i;
+        uint16_t randata;
+        do randata = randbits (12);
+        while (randata == DOTJMPDOT);
+        shadow[i] = randata;
+        buf[nbuf++] = randata;
+    }
+    if (nbuf > 0) z8p->dmawrite (bufat, buf, nbuf);
+}
+
+// read back a range of memory using block DMA and verify against shadow[]
+//  returns false: exit requested
+//           true: range verified
+static bool burstread (uint16_t startat, uint16_t stopat, uint32_t *errors)
+{
+    uint16_t buf[4096];
+    uint16_t bufat = startat;
+    int nbuf = 0;
+
+    for (uint32_t i = startat; i <= stopat + 1U; i ++) {
+        if ((nbuf > 0) && ((i > stopat) || skipaddr (i) || ((i & 07777) == 0))) {
+            z8p->dmaread (bufat, buf, nbuf);
+            for (int j = 0; j < nbuf; j ++) {
+                uint16_t rdata = buf[j];
+                uint16_t wdata = shadow[bufat+j];
+                if (rdata != wdata) {
+                    printf ("cmem error %05o was %04o should be %04o\n", bufat + j, rdata, wdata);
+                    ++ *errors;
+                    ABORT ();
+                }
+            }
+            nbuf = 0;
+            if (exitflag) return false;
+        }
+        if ((i > stopat) || skipaddr (i)) continue;
+        if (nbuf == 0) bufat = i;
+        nbuf ++;
+    }
+    return true;
+}
+
+// the JMP . loop and the word after it must be left alone
+static bool skipaddr (uint16_t xaddr)
+{
+    return (xaddr == DOTJMPDOT) || (xaddr == DOTJMPDOT + 1);
+}
+
 // write data to memory via DMA cycle
 //  input:
 //   xaddr = 15-bit address to write to
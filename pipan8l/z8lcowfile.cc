@@ -0,0 +1,290 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Copy-on-write overlay of a shared read-only base image, see z8lcowfile.h
+// Both files are mapped to memory so reads and writes are just pointer lookups
+//  the caller transfers directly to/from the returned block pointer
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "z8lcowfile.h"
+#include "z8limgfile.h"
+#include "z8lutil.h"
+
+Z8LCowFile::Z8LCowFile ()
+{
+    deltafd     = -1;
+    copyblocks  = 0;
+    deltawrites = 0;
+    basefd      = -1;
+    basemap     = NULL;
+    deltamap    = NULL;
+    zeroblock   = NULL;
+    basebytes   = 0;
+    deltabytes  = 0;
+    hdr         = NULL;
+    bitmap      = NULL;
+    bitmapdirty = false;
+    dirtybeg    = 0;
+    dirtyend    = 0;
+}
+
+Z8LCowFile::~Z8LCowFile ()
+{
+    close ();
+}
+
+// open base and delta files
+//  input:
+//   basename  = read-only base image, must exist
+//   deltaname = delta file, created if it doesn't exist
+//   blocksize = bytes per block
+//   nblocks   = blocks in whole image
+//  output:
+//   returns NULL: successful
+//           else: error message, caller must free()
+char *Z8LCowFile::open (char const *basename, char const *deltaname, uint32_t blocksize, uint32_t nblocks)
+{
+    char *errmsg = NULL;
+    struct stat basestat, deltastat;
+    uint32_t pagesize = getpagesize ();
+    uint32_t dataoffs = (sizeof *hdr + (nblocks + 7) / 8 + pagesize - 1) & - pagesize;
+
+    close ();
+
+    basefd = ::open (basename, O_RDONLY);
+    if (basefd < 0) {
+        if (asprintf (&errmsg, "error opening base %s: %m", basename) < 0) ABORT ();
+        goto failed;
+    }
+    errmsg = lockfile (basefd, F_RDLCK);
+    if (errmsg != NULL) goto failed;
+    if (Z8LImgFile::isimage (basefd)) {
+        if (asprintf (&errmsg, "base %s is an image file, unpack it with z8limage first", basename) < 0) ABORT ();
+        goto failed;
+    }
+    if (fstat (basefd, &basestat) < 0) {
+        if (asprintf (&errmsg, "error statting base %s: %m", basename) < 0) ABORT ();
+        goto failed;
+    }
+
+    deltafd = ::open (deltaname, O_RDWR | O_CREAT, 0666);
+    if (deltafd < 0) {
+        if (asprintf (&errmsg, "error opening delta %s: %m", deltaname) < 0) ABORT ();
+        goto failed;
+    }
+    errmsg = lockfile (deltafd, F_WRLCK);
+    if (errmsg != NULL) goto failed;
+    if (fstat (deltafd, &deltastat) < 0) {
+        if (asprintf (&errmsg, "error statting delta %s: %m", deltaname) < 0) ABORT ();
+        goto failed;
+    }
+
+    // existing delta file, make sure it matches image geometry and base hasn't been modified
+    //  check before extending it in case it is some other kind of file
+    if (deltastat.st_size != 0) {
+        Z8LCowHdr oldhdr;
+        if ((pread (deltafd, &oldhdr, sizeof oldhdr, 0) != (int) sizeof oldhdr) ||
+                (memcmp (oldhdr.magic, Z8LCOW_MAGIC, sizeof oldhdr.magic) != 0) || (oldhdr.version != Z8LCOW_VERSION)) {
+            if (asprintf (&errmsg, "%s is not a version %d delta file", deltaname, Z8LCOW_VERSION) < 0) ABORT ();
+            goto failed;
+        }
+        if ((oldhdr.blocksize != blocksize) || (oldhdr.nblocks != nblocks) || (oldhdr.dataoffs != dataoffs)) {
+            if (asprintf (&errmsg, "delta %s is for %u blocks of %u bytes, not %u of %u",
+                    deltaname, oldhdr.nblocks, oldhdr.blocksize, nblocks, blocksize) < 0) ABORT ();
+            goto failed;
+        }
+        if ((oldhdr.basesize != (uint64_t) basestat.st_size) ||
+                (oldhdr.basemtimens != basestat.st_mtim.tv_sec * 1000000000ULL + basestat.st_mtim.tv_nsec)) {
+            if (asprintf (&errmsg, "base %s modified since delta %s created", basename, deltaname) < 0) ABORT ();
+            goto failed;
+        }
+    }
+
+    // make sure the delta file covers all the slots, doesn't use any disk space for unwritten blocks
+    deltabytes = dataoffs + (uint64_t) nblocks * blocksize;
+    if (((uint64_t) deltastat.st_size < deltabytes) && (ftruncate (deltafd, deltabytes) < 0)) {
+        if (asprintf (&errmsg, "error extending delta %s: %m", deltaname) < 0) ABORT ();
+        goto failed;
+    }
+    deltamap = (uint8_t *) mmap (NULL, deltabytes, PROT_READ | PROT_WRITE, MAP_SHARED, deltafd, 0);
+    if (deltamap == MAP_FAILED) {
+        deltamap = NULL;
+        if (asprintf (&errmsg, "error mapping delta %s: %m", deltaname) < 0) ABORT ();
+        goto failed;
+    }
+    hdr = (Z8LCowHdr *) deltamap;
+
+    // keep working copy of bitmap in private memory so a bit can't reach the file before its block
+    //  flush() writes it out after the blocks are on disk
+    bitmap = (uint8_t *) malloc ((nblocks + 7) / 8);
+    if (bitmap == NULL) ABORT ();
+    memcpy (bitmap, hdr + 1, (nblocks + 7) / 8);
+
+    // new delta file, remember which base it goes with
+    if (deltastat.st_size == 0) {
+        memcpy (hdr->magic, Z8LCOW_MAGIC, sizeof hdr->magic);
+        hdr->version     = Z8LCOW_VERSION;
+        hdr->blocksize   = blocksize;
+        hdr->nblocks     = nblocks;
+        hdr->dataoffs    = dataoffs;
+        hdr->basesize    = basestat.st_size;
+        hdr->basemtimens = basestat.st_mtim.tv_sec * 1000000000ULL + basestat.st_mtim.tv_nsec;
+        strncpy (hdr->basename, basename, sizeof hdr->basename - 1);
+        if (msync (deltamap, dataoffs, MS_SYNC) < 0) {
+            if (asprintf (&errmsg, "error writing delta %s header: %m", deltaname) < 0) ABORT ();
+            goto failed;
+        }
+    }
+
+    // map whole base file, blocks past its end read as zeroes
+    basebytes = basestat.st_size;
+    if (basebytes > (uint64_t) nblocks * blocksize) basebytes = (uint64_t) nblocks * blocksize;
+    if (basebytes > 0) {
+        basemap = (uint8_t *) mmap (NULL, basebytes, PROT_READ, MAP_SHARED, basefd, 0);
+        if (basemap == MAP_FAILED) {
+            basemap = NULL;
+            if (asprintf (&errmsg, "error mapping base %s: %m", basename) < 0) ABORT ();
+            goto failed;
+        }
+    }
+    zeroblock = (uint8_t *) calloc (1, blocksize);
+    if (zeroblock == NULL) ABORT ();
+
+    copyblocks  = 0;
+    deltawrites = 0;
+    return NULL;
+
+failed:;
+    close ();
+    return errmsg;
+}
+
+// flush and close files
+void Z8LCowFile::close ()
+{
+    if (deltamap != NULL) {
+        flush ();
+        munmap (deltamap, deltabytes);
+        deltamap = NULL;
+    }
+    if (basemap != NULL) {
+        munmap (basemap, basebytes);
+        basemap = NULL;
+    }
+    if (deltafd >= 0) ::close (deltafd);
+    if (basefd >= 0) ::close (basefd);
+    free (zeroblock);
+    free (bitmap);
+    deltafd   = -1;
+    basefd    = -1;
+    zeroblock = NULL;
+    hdr       = NULL;
+    bitmap    = NULL;
+}
+
+// get pointer to block contents for reading
+//  from delta if block has been written, else from base
+uint8_t const *Z8LCowFile::rdblock (uint32_t blkno)
+{
+    ASSERT (blkno < hdr->nblocks);
+    if (bitmap[blkno/8] & (1U << (blkno % 8))) {
+        return deltamap + hdr->dataoffs + (uint64_t) blkno * hdr->blocksize;
+    }
+    uint64_t offs = (uint64_t) blkno * hdr->blocksize;
+    if (offs + hdr->blocksize <= basebytes) return basemap + offs;
+    return zeroblock;
+}
+
+// get pointer to block contents for writing
+//  copies block from base to delta the first time it is written
+uint8_t *Z8LCowFile::wrblock (uint32_t blkno)
+{
+    ASSERT (blkno < hdr->nblocks);
+    uint8_t *slot = deltamap + hdr->dataoffs + (uint64_t) blkno * hdr->blocksize;
+    if (! (bitmap[blkno/8] & (1U << (blkno % 8)))) {
+        uint64_t offs = (uint64_t) blkno * hdr->blocksize;
+        if (offs < basebytes) {
+            uint64_t len = basebytes - offs;
+            memcpy (slot, basemap + offs, (len < hdr->blocksize) ? len : hdr->blocksize);
+        }
+        bitmap[blkno/8] |= 1U << (blkno % 8);
+        bitmapdirty = true;
+        copyblocks ++;
+    }
+    if (dirtybeg >= dirtyend) {
+        dirtybeg = blkno;
+        dirtyend = blkno + 1;
+    } else {
+        if (dirtybeg > blkno) dirtybeg = blkno;
+        if (dirtyend <= blkno) dirtyend = blkno + 1;
+    }
+    deltawrites ++;
+    return slot;
+}
+
+// write blocks modified since last flush to the delta file
+//  data is synced before the bitmap is written so a bit is never set for a block that didn't make it
+//  returns number of bytes flushed
+uint32_t Z8LCowFile::flush ()
+{
+    uint32_t nbytes = 0;
+    uint32_t pagesize = getpagesize ();
+
+    if (dirtybeg < dirtyend) {
+        uint64_t beg = (hdr->dataoffs + (uint64_t) dirtybeg * hdr->blocksize) & - (uint64_t) pagesize;
+        uint64_t end = hdr->dataoffs + (uint64_t) dirtyend * hdr->blocksize;
+        dirtybeg = dirtyend = 0;
+        if (msync (deltamap + beg, end - beg, MS_SYNC) < 0) {
+            fprintf (stderr, "Z8LCowFile::flush: error flushing delta blocks: %m\n");
+        }
+        nbytes += end - beg;
+    }
+
+    if (bitmapdirty) {
+        bitmapdirty = false;
+        uint32_t bitmapbytes = (hdr->nblocks + 7) / 8;
+        if ((pwrite (deltafd, bitmap, bitmapbytes, sizeof *hdr) != (int) bitmapbytes) || (fdatasync (deltafd) < 0)) {
+            fprintf (stderr, "Z8LCowFile::flush: error writing delta bitmap: %m\n");
+        }
+        nbytes += bitmapbytes;
+    }
+
+    return nbytes;
+}
+
+// number of blocks present in delta file
+uint32_t Z8LCowFile::deltablocks ()
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < (hdr->nblocks + 7) / 8; i ++) {
+        count += __builtin_popcount (bitmap[i]);
+    }
+    return count;
+}
+
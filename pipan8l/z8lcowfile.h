@@ -0,0 +1,76 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// copy-on-write overlay of a read-only base disk or tape image
+//  delta file = Z8LCowHdr, block bitmap, then a slot for every block at dataoffs + blkno * blocksize
+//  only slots for blocks that have been written get filled in so the delta file stays sparse
+//  reads come from the delta slot if the block's bitmap bit is set, otherwise from the base file
+//  base file is locked shared so several deltas can share it, delta file is locked exclusive
+// used by z8lrk8je and z8ltc08, merged back with z8lcowmerge
+
+#ifndef _Z8LCOWFILE_H
+#define _Z8LCOWFILE_H
+
+#include <stdint.h>
+
+#define Z8LCOW_MAGIC "z8lcowdf"
+#define Z8LCOW_VERSION 1
+
+struct Z8LCowHdr {
+    char magic[8];              // Z8LCOW_MAGIC
+    uint32_t version;           // Z8LCOW_VERSION
+    uint32_t blocksize;         // bytes per block
+    uint32_t nblocks;           // blocks in whole image
+    uint32_t dataoffs;          // offset of block 0 slot, page aligned, bitmap follows header
+    uint64_t basesize;          // size of base file when delta was created
+    uint64_t basemtimens;       // modification time of base file when delta was created
+    char basename[256];         // base file name as given when delta was created
+};
+
+struct Z8LCowFile {
+    Z8LCowFile ();
+    ~Z8LCowFile ();
+    char *open (char const *basename, char const *deltaname, uint32_t blocksize, uint32_t nblocks);
+    void close ();
+    uint8_t const *rdblock (uint32_t blkno);
+    uint8_t *wrblock (uint32_t blkno);
+    uint32_t flush ();
+    uint32_t deltablocks ();
+
+    int deltafd;                // delta file, -1 if not open
+
+    uint64_t copyblocks;        // blocks copied from base on first write
+    uint64_t deltawrites;       // blocks written to delta
+
+private:
+    int basefd;
+    uint8_t *basemap;           // base file contents, NULL if base is empty
+    uint8_t *deltamap;          // whole delta file, header, bitmap and slots
+    uint8_t *zeroblock;         // returned for blocks beyond end of short base file
+    uint64_t basebytes;
+    uint64_t deltabytes;
+    Z8LCowHdr *hdr;
+    uint8_t *bitmap;            // private copy of delta bitmap, written to file by flush()
+    bool bitmapdirty;           // bitmap bits set since last flush
+    uint32_t dirtybeg;          // block range written since last flush
+    uint32_t dirtyend;          // ... dirtybeg >= dirtyend if nothing written
+};
+
+#endif
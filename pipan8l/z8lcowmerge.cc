@@ -0,0 +1,220 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Show, merge or commit copy-on-write delta files written by z8lrk8je and z8ltc08
+//  ./z8lcowmerge [-base <basefile>] <deltafile>
+//  ./z8lcowmerge [-base <basefile>] -output <imagefile> <deltafile>
+//  ./z8lcowmerge [-base <basefile>] -commit <deltafile>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "z8lcowfile.h"
+#include "z8lutil.h"
+
+int main (int argc, char **argv)
+{
+    bool commit = false;
+    char const *basename = NULL;
+    char const *deltaname = NULL;
+    char const *outname = NULL;
+
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("     Show, merge or commit copy-on-write delta file written by z8lrk8je or z8ltc08");
+            puts ("");
+            puts ("  ./z8lcowmerge [-base <basefile>] [-commit | -output <imagefile>] <deltafile>");
+            puts ("     -base   : base file, default is name recorded in delta file");
+            puts ("     -commit : write delta blocks into base file then empty delta file");
+            puts ("     -output : write base file merged with delta blocks to new image file");
+            puts ("     else    : show base file name and number of blocks in delta file");
+            puts ("");
+            puts ("     Base and delta files must not be loaded in a drive.");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-base") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing -base filename\n");
+                return 1;
+            }
+            basename = argv[i];
+            continue;
+        }
+        if (strcasecmp (argv[i], "-commit") == 0) {
+            commit = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-output") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing -output filename\n");
+                return 1;
+            }
+            outname = argv[i];
+            continue;
+        }
+        if ((argv[i][0] == '-') || (deltaname != NULL)) {
+            fprintf (stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+        deltaname = argv[i];
+    }
+    if (deltaname == NULL) {
+        fprintf (stderr, "missing deltafile\n");
+        return 1;
+    }
+    if (commit && (outname != NULL)) {
+        fprintf (stderr, "-commit and -output are mutually exclusive\n");
+        return 1;
+    }
+
+    // read and validate delta header and bitmap
+    int deltafd = open (deltaname, commit ? O_RDWR : O_RDONLY);
+    if (deltafd < 0) {
+        fprintf (stderr, "error opening %s: %m\n", deltaname);
+        return 1;
+    }
+    char *lockerr = lockfile (deltafd, commit ? F_WRLCK : F_RDLCK);
+    if (lockerr != NULL) {
+        fprintf (stderr, "error locking %s: %s\n", deltaname, lockerr);
+        return 1;
+    }
+    Z8LCowHdr hdr;
+    if ((pread (deltafd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) ||
+            (memcmp (hdr.magic, Z8LCOW_MAGIC, sizeof hdr.magic) != 0) || (hdr.version != Z8LCOW_VERSION) ||
+            (hdr.dataoffs < sizeof hdr + (hdr.nblocks + 7) / 8)) {
+        fprintf (stderr, "%s is not a version %d delta file\n", deltaname, Z8LCOW_VERSION);
+        return 1;
+    }
+    uint32_t bitmapbytes = (hdr.nblocks + 7) / 8;
+    uint8_t *bitmap = (uint8_t *) malloc (bitmapbytes);
+    if (bitmap == NULL) ABORT ();
+    if (pread (deltafd, bitmap, bitmapbytes, sizeof hdr) != (int) bitmapbytes) {
+        fprintf (stderr, "error reading %s bitmap: %m\n", deltaname);
+        return 1;
+    }
+    uint32_t nblocks = 0;
+    for (uint32_t i = 0; i < bitmapbytes; i ++) nblocks += __builtin_popcount (bitmap[i]);
+
+    if (basename == NULL) basename = hdr.basename;
+
+    if (! commit && (outname == NULL)) {
+        printf ("base %s\nblocks %u of %u, %u bytes each\n", basename, nblocks, hdr.nblocks, hdr.blocksize);
+        return 0;
+    }
+
+    // open base, make sure it hasn't changed since delta was created
+    int basefd = open (basename, commit ? O_RDWR : O_RDONLY);
+    if (basefd < 0) {
+        fprintf (stderr, "error opening %s: %m\n", basename);
+        return 1;
+    }
+    lockerr = lockfile (basefd, commit ? F_WRLCK : F_RDLCK);
+    if (lockerr != NULL) {
+        fprintf (stderr, "error locking %s: %s\n", basename, lockerr);
+        return 1;
+    }
+    struct stat basestat;
+    if (fstat (basefd, &basestat) < 0) {
+        fprintf (stderr, "error statting %s: %m\n", basename);
+        return 1;
+    }
+    if ((hdr.basesize != (uint64_t) basestat.st_size) ||
+            (hdr.basemtimens != basestat.st_mtim.tv_sec * 1000000000ULL + basestat.st_mtim.tv_nsec)) {
+        fprintf (stderr, "base %s modified since delta %s created\n", basename, deltaname);
+        return 1;
+    }
+
+    uint8_t *buff = (uint8_t *) malloc (hdr.blocksize);
+    if (buff == NULL) ABORT ();
+
+    // copy delta blocks into the base file in place
+    if (commit) {
+        for (uint32_t blkno = 0; blkno < hdr.nblocks; blkno ++) {
+            if (! (bitmap[blkno/8] & (1U << (blkno % 8)))) continue;
+            if (pread (deltafd, buff, hdr.blocksize, hdr.dataoffs + (uint64_t) blkno * hdr.blocksize) != (int) hdr.blocksize) {
+                fprintf (stderr, "error reading %s block %u: %m\n", deltaname, blkno);
+                return 1;
+            }
+            if (pwrite (basefd, buff, hdr.blocksize, (uint64_t) blkno * hdr.blocksize) != (int) hdr.blocksize) {
+                fprintf (stderr, "error writing %s block %u: %m\n", basename, blkno);
+                return 1;
+            }
+        }
+        if ((fsync (basefd) < 0) || (fstat (basefd, &basestat) < 0)) {
+            fprintf (stderr, "error flushing %s: %m\n", basename);
+            return 1;
+        }
+
+        // empty the delta file and match it to the updated base
+        memset (bitmap, 0, bitmapbytes);
+        hdr.basesize    = basestat.st_size;
+        hdr.basemtimens = basestat.st_mtim.tv_sec * 1000000000ULL + basestat.st_mtim.tv_nsec;
+        if ((pwrite (deltafd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) ||
+                (pwrite (deltafd, bitmap, bitmapbytes, sizeof hdr) != (int) bitmapbytes) ||
+                (ftruncate (deltafd, hdr.dataoffs) < 0) || (fsync (deltafd) < 0)) {
+            fprintf (stderr, "error emptying %s: %m\n", deltaname);
+            return 1;
+        }
+        printf ("committed %u blocks to %s\n", nblocks, basename);
+        return 0;
+    }
+
+    // write whole merged image to new file
+    int outfd = open (outname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (outfd < 0) {
+        fprintf (stderr, "error creating %s: %m\n", outname);
+        return 1;
+    }
+    for (uint32_t blkno = 0; blkno < hdr.nblocks; blkno ++) {
+        int rc;
+        if (bitmap[blkno/8] & (1U << (blkno % 8))) {
+            rc = pread (deltafd, buff, hdr.blocksize, hdr.dataoffs + (uint64_t) blkno * hdr.blocksize);
+            if (rc != (int) hdr.blocksize) {
+                fprintf (stderr, "error reading %s block %u: %m\n", deltaname, blkno);
+                return 1;
+            }
+        } else {
+            rc = pread (basefd, buff, hdr.blocksize, (uint64_t) blkno * hdr.blocksize);
+            if (rc < 0) {
+                fprintf (stderr, "error reading %s block %u: %m\n", basename, blkno);
+                return 1;
+            }
+            memset (buff + rc, 0, hdr.blocksize - rc);
+        }
+        if (write (outfd, buff, hdr.blocksize) != (int) hdr.blocksize) {
+            fprintf (stderr, "error writing %s: %m\n", outname);
+            return 1;
+        }
+    }
+    if (fsync (outfd) < 0) {
+        fprintf (stderr, "error flushing %s: %m\n", outname);
+        return 1;
+    }
+    printf ("merged %u blocks into %s\n", nblocks, outname);
+    return 0;
+}
@@ -282,6 +282,10 @@
 #define CM_ADDR0 (1U <<  0)
 #define CM_DATA0 (1U << 16)
 
+#define CM2_BUSYONARM (31U << 0)
+#define CM2_XMIDLE  (1U <<  5)
+#define CM2_XMBLOCK (1U <<  6)
+#define CM2_BRKCYCL (1U <<  7)
 #define CM2_NOBRK (1U << 29)
 #define CM2_CAINC (1U << 30)
 #define CM2_3CYCL (1U << 31)
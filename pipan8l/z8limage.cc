@@ -0,0 +1,250 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Convert raw disk and tape files to and from sparse/compressed image files read by z8lrk8je and z8ltc08
+//  ./z8limage -pack -rk|-tc [-compress] <rawfile> <imagefile>
+//  ./z8limage -unpack <imagefile> <rawfile>
+//  ./z8limage <imagefile>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "z8limgfile.h"
+#include "z8lutil.h"
+
+#define RK_BLOCKSIZE 512        // RK05 sector, 256 words
+#define RK_NBLOCKS (203*32)
+#define TC_BLOCKSIZE (129*2)    // TU56 block, 129 words
+#define TC_NBLOCKS 1474
+
+int main (int argc, char **argv)
+{
+    bool pack = false;
+    bool unpack = false;
+    char const *inname = NULL;
+    char const *outname = NULL;
+    uint32_t blocksize = 0;
+    uint32_t flags = 0;
+    uint32_t nblocks = 0;
+
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("     Convert raw disk and tape files to and from image files");
+            puts ("");
+            puts ("  ./z8limage -pack -rk|-tc [-compress] <rawfile> <imagefile>");
+            puts ("     -pack     : write raw file to new image file");
+            puts ("     -rk       : raw file is an RK05 pack, 6496 blocks of 256 words");
+            puts ("     -tc       : raw file is a TU56 tape, 1474 blocks of 129 words");
+            puts ("     -compress : compress blocks that get smaller, including ones written later");
+            puts ("");
+            puts ("  ./z8limage -unpack <imagefile> <rawfile>");
+            puts ("     write image file to new raw file");
+            puts ("");
+            puts ("  ./z8limage <imagefile>");
+            puts ("     show number of blocks stored and space used");
+            puts ("");
+            puts ("     All-zero blocks are not stored in image files.  Image files can be loaded");
+            puts ("     in z8lrk8je and z8ltc08 drives same as raw files.  Rewritten blocks go in");
+            puts ("     space freed by earlier rewrites, else are appended.  Unpack then pack an image");
+            puts ("     to squeeze out leftover free space.");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-compress") == 0) {
+            flags |= Z8LIMG_COMPRESS;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-pack") == 0) {
+            pack = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-rk") == 0) {
+            blocksize = RK_BLOCKSIZE;
+            nblocks   = RK_NBLOCKS;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-tc") == 0) {
+            blocksize = TC_BLOCKSIZE;
+            nblocks   = TC_NBLOCKS;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-unpack") == 0) {
+            unpack = true;
+            continue;
+        }
+        if (argv[i][0] == '-') {
+            fprintf (stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+        if (inname == NULL) inname = argv[i];
+        else if (outname == NULL) outname = argv[i];
+        else {
+            fprintf (stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (pack && unpack) {
+        fprintf (stderr, "-pack and -unpack are mutually exclusive\n");
+        return 1;
+    }
+    if ((inname == NULL) || ((pack || unpack) != (outname != NULL))) {
+        fprintf (stderr, "bad number of filenames, use -? for help\n");
+        return 1;
+    }
+    if (pack && (blocksize == 0)) {
+        fprintf (stderr, "-pack requires -rk or -tc\n");
+        return 1;
+    }
+
+    int infd = open (inname, O_RDONLY);
+    if (infd < 0) {
+        fprintf (stderr, "error opening %s: %m\n", inname);
+        return 1;
+    }
+    char *lockerr = lockfile (infd, F_RDLCK);
+    if (lockerr != NULL) {
+        fprintf (stderr, "error locking %s: %s\n", inname, lockerr);
+        return 1;
+    }
+
+    // raw to image
+    if (pack) {
+        if (Z8LImgFile::isimage (infd)) {
+            fprintf (stderr, "%s is already an image file\n", inname);
+            return 1;
+        }
+        int outfd = open (outname, O_RDWR | O_CREAT, 0666);
+        if (outfd < 0) {
+            fprintf (stderr, "error creating %s: %m\n", outname);
+            return 1;
+        }
+
+        // truncating output would wipe out input before it is read
+        //  and our own read lock wouldn't block the write lock
+        struct stat instat, outstat;
+        if ((fstat (infd, &instat) < 0) || (fstat (outfd, &outstat) < 0)) {
+            fprintf (stderr, "error statting %s or %s: %m\n", inname, outname);
+            return 1;
+        }
+        if ((instat.st_dev == outstat.st_dev) && (instat.st_ino == outstat.st_ino)) {
+            fprintf (stderr, "%s and %s are the same file\n", inname, outname);
+            return 1;
+        }
+        lockerr = lockfile (outfd, F_WRLCK);
+        if (lockerr != NULL) {
+            fprintf (stderr, "error locking %s: %s\n", outname, lockerr);
+            return 1;
+        }
+        if (ftruncate (outfd, 0) < 0) {
+            fprintf (stderr, "error truncating %s: %m\n", outname);
+            return 1;
+        }
+        Z8LImgFile img;
+        char *errmsg = img.create (outfd, blocksize, nblocks, flags);
+        if (errmsg != NULL) {
+            fprintf (stderr, "error creating %s: %s\n", outname, errmsg);
+            return 1;
+        }
+
+        // short raw file reads as zeroes past its end
+        uint64_t imgbytes = (uint64_t) nblocks * blocksize;
+        for (uint64_t ofs = 0; ofs < imgbytes;) {
+            int rc = pread (infd, img.image + ofs, imgbytes - ofs, ofs);
+            if (rc < 0) {
+                fprintf (stderr, "error reading %s: %m\n", inname);
+                return 1;
+            }
+            if (rc == 0) break;
+            ofs += rc;
+        }
+        for (uint32_t blkno = 0; blkno < nblocks; blkno ++) img.markdirty (blkno);
+        img.flush ();
+
+        uint32_t compblocks;
+        uint64_t storedbytes;
+        uint32_t stored = img.storedblocks (&compblocks, &storedbytes);
+        printf ("packed %u of %u blocks (%u compressed) into %llu bytes\n", stored, nblocks, compblocks, (long long unsigned) storedbytes);
+        img.close ();
+        return 0;
+    }
+
+    // read image header to get geometry
+    Z8LImgHdr hdr;
+    if ((pread (infd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) || (memcmp (hdr.magic, Z8LIMG_MAGIC, sizeof hdr.magic) != 0)) {
+        fprintf (stderr, "%s is not an image file\n", inname);
+        return 1;
+    }
+    Z8LImgFile img;
+    char *errmsg = img.open (infd, false, hdr.blocksize, hdr.nblocks);
+    if (errmsg != NULL) {
+        fprintf (stderr, "error reading %s: %s\n", inname, errmsg);
+        return 1;
+    }
+
+    // image to raw
+    if (unpack) {
+        int outfd = open (outname, O_WRONLY | O_CREAT, 0666);
+        if (outfd < 0) {
+            fprintf (stderr, "error creating %s: %m\n", outname);
+            return 1;
+        }
+        lockerr = lockfile (outfd, F_WRLCK);
+        if (lockerr != NULL) {
+            fprintf (stderr, "error locking %s: %s\n", outname, lockerr);
+            return 1;
+        }
+        if (ftruncate (outfd, 0) < 0) {
+            fprintf (stderr, "error truncating %s: %m\n", outname);
+            return 1;
+        }
+        uint64_t imgbytes = (uint64_t) hdr.nblocks * hdr.blocksize;
+        for (uint64_t ofs = 0; ofs < imgbytes;) {
+            int rc = pwrite (outfd, img.image + ofs, imgbytes - ofs, ofs);
+            if (rc <= 0) {
+                fprintf (stderr, "error writing %s: %m\n", outname);
+                return 1;
+            }
+            ofs += rc;
+        }
+        if (fsync (outfd) < 0) {
+            fprintf (stderr, "error flushing %s: %m\n", outname);
+            return 1;
+        }
+        printf ("unpacked %u blocks of %u bytes into %s\n", hdr.nblocks, hdr.blocksize, outname);
+        return 0;
+    }
+
+    // just show info
+    uint32_t compblocks;
+    uint64_t storedbytes;
+    uint32_t stored = img.storedblocks (&compblocks, &storedbytes);
+    printf ("blocks %u of %u bytes, %scompressed\n", hdr.nblocks, hdr.blocksize, ((hdr.flags & Z8LIMG_COMPRESS) ? "" : "not "));
+    printf ("stored %u (%u compressed), zero %u\n", stored, compblocks, hdr.nblocks - stored);
+    printf ("stored bytes %llu, file bytes %llu, raw bytes %llu\n", (long long unsigned) storedbytes,
+        (long long unsigned) lseek (infd, 0, SEEK_END), (long long unsigned) hdr.nblocks * hdr.blocksize);
+    return 0;
+}
@@ -0,0 +1,431 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Sparse, optionally compressed disk or tape image, see z8limgfile.h
+// Compression needs zlib (HASZLIB=1), without it compressed images can't be opened
+//  and blocks are always stored uncompressed
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if HASZLIB
+#include <zlib.h>
+#endif
+
+#include "z8limgfile.h"
+#include "z8lutil.h"
+
+Z8LImgFile::Z8LImgFile ()
+{
+    image        = NULL;
+    fd           = -1;
+    blockwrites  = 0;
+    readwrite    = false;
+    index        = NULL;
+    freelist     = NULL;
+    nfree        = 0;
+    maxfree      = 0;
+    dirty        = NULL;
+    dirtybeg     = 0;
+    dirtyend     = 0;
+    memset (&hdr, 0, sizeof hdr);
+}
+
+Z8LImgFile::~Z8LImgFile ()
+{
+    close ();
+}
+
+// see if file is an image file
+//  input:
+//   fd = file to check
+//  output:
+//   returns true: file starts with Z8LIMG_MAGIC
+//          false: some other file, presumably raw
+bool Z8LImgFile::isimage (int fd)
+{
+    char magic[8];
+    return (pread (fd, magic, sizeof magic, 0) == (int) sizeof magic) && (memcmp (magic, Z8LIMG_MAGIC, sizeof magic) == 0);
+}
+
+// sort stored blocks by where they are in the file
+static int cmpspace (void const *a, void const *b)
+{
+    uint64_t aoffs = ((Z8LImgFree const *) a)->offset;
+    uint64_t boffs = ((Z8LImgFree const *) b)->offset;
+    return (aoffs < boffs) ? -1 : (aoffs > boffs);
+}
+
+// open existing image file and decompress it into memory
+//  input:
+//   fd = image file, open and locked by caller
+//   readwrite = false: read only, flush() does nothing
+//                true: blocks marked dirty get written back
+//   blocksize = bytes per block
+//   nblocks   = blocks in whole image
+//  output:
+//   returns NULL: successful, fd now belongs to this object
+//           else: error message, caller must free() and close fd
+char *Z8LImgFile::open (int fd, bool readwrite, uint32_t blocksize, uint32_t nblocks)
+{
+    char *errmsg = NULL;
+    uint8_t *buff = NULL;
+
+    close ();
+
+    if ((pread (fd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) ||
+            (memcmp (hdr.magic, Z8LIMG_MAGIC, sizeof hdr.magic) != 0) || (hdr.version != Z8LIMG_VERSION)) {
+        if (asprintf (&errmsg, "not a version %d image file", Z8LIMG_VERSION) < 0) ABORT ();
+        return errmsg;
+    }
+    if ((hdr.blocksize != blocksize) || (hdr.nblocks != nblocks)) {
+        if (asprintf (&errmsg, "image is %u blocks of %u bytes, not %u of %u",
+                hdr.nblocks, hdr.blocksize, nblocks, blocksize) < 0) ABORT ();
+        return errmsg;
+    }
+#if ! HASZLIB
+    if (hdr.flags & Z8LIMG_COMPRESS) {
+        if (asprintf (&errmsg, "compressed image but built without zlib") < 0) ABORT ();
+        return errmsg;
+    }
+#endif
+
+    index = (Z8LImgIdx *) malloc (nblocks * sizeof *index);
+    image = (uint8_t *) calloc (nblocks, blocksize);
+    dirty = (uint8_t *) calloc ((nblocks + 7) / 8, 1);
+    buff  = (uint8_t *) malloc (blocksize);
+    if ((index == NULL) || (image == NULL) || (dirty == NULL) || (buff == NULL)) ABORT ();
+
+    if (pread (fd, index, nblocks * sizeof *index, sizeof hdr) != (int) (nblocks * sizeof *index)) {
+        if (asprintf (&errmsg, "error reading index: %m") < 0) ABORT ();
+        goto failed;
+    }
+
+    // read stored blocks, zero blocks were already cleared by calloc()
+    for (uint32_t blkno = 0; blkno < nblocks; blkno ++) {
+        Z8LImgIdx *idx = &index[blkno];
+        if (idx->offset == 0) continue;
+        if ((idx->length == 0) || (idx->length > blocksize) || (idx->length > idx->space) ||
+                (idx->offset < sizeof hdr + nblocks * sizeof *index) || (idx->offset + idx->space > hdr.dataend)) {
+            if (asprintf (&errmsg, "bad index entry for block %u", blkno) < 0) ABORT ();
+            goto failed;
+        }
+        uint8_t *blkptr = image + (uint64_t) blkno * blocksize;
+        int rc = pread (fd, (idx->length == blocksize) ? blkptr : buff, idx->length, idx->offset);
+        if (rc != (int) idx->length) {
+            if (rc >= 0) errno = EIO;
+            if (asprintf (&errmsg, "error reading block %u: %m", blkno) < 0) ABORT ();
+            goto failed;
+        }
+#if HASZLIB
+        if (idx->length < blocksize) {
+            uLongf destlen = blocksize;
+            if ((uncompress (blkptr, &destlen, buff, idx->length) != Z_OK) || (destlen != blocksize)) {
+                if (asprintf (&errmsg, "error decompressing block %u", blkno) < 0) ABORT ();
+                goto failed;
+            }
+        }
+#endif
+    }
+
+    // gaps between stored blocks are free for rewritten blocks
+    if (readwrite) {
+        Z8LImgFree *used = (Z8LImgFree *) malloc (nblocks * sizeof *used);
+        if (used == NULL) ABORT ();
+        uint32_t nused = 0;
+        for (uint32_t blkno = 0; blkno < nblocks; blkno ++) {
+            if (index[blkno].offset == 0) continue;
+            used[nused].offset  = index[blkno].offset;
+            used[nused++].space = index[blkno].space;
+        }
+        qsort (used, nused, sizeof *used, cmpspace);
+        uint64_t offset = sizeof hdr + nblocks * sizeof *index;
+        for (uint32_t i = 0; i < nused; i ++) {
+            if (used[i].offset < offset) {
+                free (used);
+                if (asprintf (&errmsg, "overlapping blocks at %llu", (long long unsigned) used[i].offset) < 0) ABORT ();
+                goto failed;
+            }
+            if (used[i].offset > offset) freespace (offset, used[i].offset - offset);
+            offset = used[i].offset + used[i].space;
+        }
+        if (hdr.dataend > offset) freespace (offset, hdr.dataend - offset);
+        free (used);
+    }
+
+    free (buff);
+    this->fd = fd;
+    this->readwrite = readwrite;
+    blockwrites  = 0;
+    return NULL;
+
+failed:;
+    free (buff);
+    close ();
+    return errmsg;
+}
+
+// create new empty image file, all blocks zero
+//  input:
+//   fd = file to write image to, open and locked by caller, truncated to zero length
+//   blocksize = bytes per block
+//   nblocks   = blocks in whole image
+//   flags     = Z8LIMG_* flags
+//  output:
+//   returns NULL: successful, fd now belongs to this object
+//           else: error message, caller must free() and close fd
+char *Z8LImgFile::create (int fd, uint32_t blocksize, uint32_t nblocks, uint32_t flags)
+{
+    char *errmsg = NULL;
+
+    close ();
+
+#if ! HASZLIB
+    if (flags & Z8LIMG_COMPRESS) {
+        if (asprintf (&errmsg, "built without zlib, can't compress") < 0) ABORT ();
+        return errmsg;
+    }
+#endif
+
+    memset (&hdr, 0, sizeof hdr);
+    memcpy (hdr.magic, Z8LIMG_MAGIC, sizeof hdr.magic);
+    hdr.version   = Z8LIMG_VERSION;
+    hdr.blocksize = blocksize;
+    hdr.nblocks   = nblocks;
+    hdr.flags     = flags;
+    hdr.dataend   = sizeof hdr + nblocks * sizeof *index;
+
+    index = (Z8LImgIdx *) calloc (nblocks, sizeof *index);
+    image = (uint8_t *) calloc (nblocks, blocksize);
+    dirty = (uint8_t *) calloc ((nblocks + 7) / 8, 1);
+    if ((index == NULL) || (image == NULL) || (dirty == NULL)) ABORT ();
+
+    if ((pwrite (fd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) ||
+            (pwrite (fd, index, nblocks * sizeof *index, sizeof hdr) != (int) (nblocks * sizeof *index))) {
+        if (asprintf (&errmsg, "error writing header: %m") < 0) ABORT ();
+        close ();
+        return errmsg;
+    }
+
+    this->fd = fd;
+    readwrite    = true;
+    blockwrites  = 0;
+    return NULL;
+}
+
+// flush and close file
+void Z8LImgFile::close ()
+{
+    if (fd >= 0) {
+        flush ();
+        ::close (fd);
+        fd = -1;
+    }
+    free (image);
+    free (index);
+    free (freelist);
+    free (dirty);
+    image    = NULL;
+    index    = NULL;
+    freelist = NULL;
+    nfree    = 0;
+    maxfree  = 0;
+    dirty    = NULL;
+    dirtybeg = 0;
+    dirtyend = 0;
+}
+
+// block in image[] has been modified, write it out on next flush()
+void Z8LImgFile::markdirty (uint32_t blkno)
+{
+    ASSERT (blkno < hdr.nblocks);
+    dirty[blkno/8] |= 1U << (blkno % 8);
+    if (dirtybeg >= dirtyend) {
+        dirtybeg = blkno;
+        dirtyend = blkno + 1;
+    } else {
+        if (dirtybeg > blkno) dirtybeg = blkno;
+        if (dirtyend <= blkno) dirtyend = blkno + 1;
+    }
+}
+
+// store blocks modified since last flush
+//  all-zero blocks just get their index entry cleared
+//  others are compressed if enabled and it helps, then put in free space or appended
+//  then after the data is synced the changed index entries and header are written
+//  then after those are synced the old space is free for the next flush
+//  returns number of bytes written
+uint32_t Z8LImgFile::flush ()
+{
+    if ((fd < 0) || ! readwrite || (dirtybeg >= dirtyend)) return 0;
+
+    uint32_t blocksize = hdr.blocksize;
+    uint32_t nbytes    = 0;
+    uint32_t beg       = dirtybeg;
+    uint32_t end       = dirtyend;
+    uint32_t nold      = 0;
+    dirtybeg = dirtyend = 0;
+
+    // space of old copies, the index on disk still points to it until the end
+    Z8LImgFree *oldspace = (Z8LImgFree *) malloc ((end - beg) * sizeof *oldspace);
+    if (oldspace == NULL) ABORT ();
+
+#if HASZLIB
+    uLong complen = compressBound (blocksize);
+    uint8_t *compbuf = (uint8_t *) malloc (complen);
+    if (compbuf == NULL) ABORT ();
+#endif
+
+    for (uint32_t blkno = beg; blkno < end; blkno ++) {
+        if (! (dirty[blkno/8] & (1U << (blkno % 8)))) continue;
+        dirty[blkno/8] &= ~ (1U << (blkno % 8));
+
+        Z8LImgIdx *idx = &index[blkno];
+        uint8_t const *blkptr = image + (uint64_t) blkno * blocksize;
+        if (idx->offset != 0) {
+            oldspace[nold].offset  = idx->offset;
+            oldspace[nold++].space = idx->space;
+        }
+
+        // all zeroes, don't store anything
+        uint32_t i;
+        for (i = 0; i < blocksize; i ++) if (blkptr[i] != 0) break;
+        if (i >= blocksize) {
+            memset (idx, 0, sizeof *idx);
+            continue;
+        }
+
+        // compress if enabled and it makes it smaller
+        uint8_t const *data = blkptr;
+        uint32_t length = blocksize;
+#if HASZLIB
+        if (hdr.flags & Z8LIMG_COMPRESS) {
+            uLongf destlen = complen;
+            if ((compress2 (compbuf, &destlen, blkptr, blocksize, Z_BEST_SPEED) == Z_OK) && (destlen < blocksize)) {
+                data   = compbuf;
+                length = destlen;
+            }
+        }
+#endif
+
+        // never overwrite the old copy so it stays good until the index entry is switched over
+        if (! allocspace (length, &idx->offset)) {
+            idx->offset = hdr.dataend;
+            hdr.dataend += length;
+        }
+        idx->length = length;
+        idx->space  = length;
+        if (pwrite (fd, data, length, idx->offset) != (int) length) {
+            fprintf (stderr, "Z8LImgFile::flush: error writing block %u: %m\n", blkno);
+        }
+        nbytes += length;
+        blockwrites ++;
+    }
+
+#if HASZLIB
+    free (compbuf);
+#endif
+
+    // data is written, now write index entries pointing to it
+    if (fdatasync (fd) < 0) {
+        fprintf (stderr, "Z8LImgFile::flush: error flushing blocks: %m\n");
+    }
+    uint32_t idxbytes = (end - beg) * sizeof *index;
+    if ((pwrite (fd, &index[beg], idxbytes, sizeof hdr + beg * sizeof *index) != (int) idxbytes) ||
+            (pwrite (fd, &hdr, sizeof hdr, 0) != (int) sizeof hdr) || (fdatasync (fd) < 0)) {
+        fprintf (stderr, "Z8LImgFile::flush: error writing index: %m\n");
+    } else {
+        // nothing on disk points to the old copies any more
+        // if the index write failed they stay in use until the image is opened again
+        for (uint32_t i = 0; i < nold; i ++) freespace (oldspace[i].offset, oldspace[i].space);
+    }
+    free (oldspace);
+    nbytes += idxbytes + sizeof hdr;
+
+    return nbytes;
+}
+
+// find free space for a block
+//  input:
+//   length = bytes needed
+//  output:
+//   returns false: no free space big enough, append to end of file
+//            true: *offset_r = where to put block, space no longer free
+bool Z8LImgFile::allocspace (uint32_t length, uint64_t *offset_r)
+{
+    for (uint32_t i = 0; i < nfree; i ++) {
+        Z8LImgFree *fre = &freelist[i];
+        if (fre->space >= length) {
+            *offset_r    = fre->offset;
+            fre->offset += length;
+            fre->space  -= length;
+            if (fre->space == 0) *fre = freelist[--nfree];
+            return true;
+        }
+    }
+    return false;
+}
+
+// add space to free list, merging with free space either side of it
+void Z8LImgFile::freespace (uint64_t offset, uint64_t space)
+{
+    for (uint32_t i = 0; i < nfree;) {
+        Z8LImgFree *fre = &freelist[i];
+        if ((fre->offset + fre->space == offset) || (offset + space == fre->offset)) {
+            if (offset > fre->offset) offset = fre->offset;
+            space += fre->space;
+            *fre = freelist[--nfree];
+        } else {
+            i ++;
+        }
+    }
+    if (nfree >= maxfree) {
+        maxfree  = maxfree * 2 + 16;
+        freelist = (Z8LImgFree *) realloc (freelist, maxfree * sizeof *freelist);
+        if (freelist == NULL) ABORT ();
+    }
+    freelist[nfree].offset  = offset;
+    freelist[nfree++].space = space;
+}
+
+// count stored blocks
+//  output:
+//   returns blocks not elided as zeroes
+//   *compblocks  = how many of those are stored compressed
+//   *storedbytes = total space they occupy in file
+uint32_t Z8LImgFile::storedblocks (uint32_t *compblocks, uint64_t *storedbytes)
+{
+    uint32_t count = 0;
+    *compblocks  = 0;
+    *storedbytes = 0;
+    for (uint32_t blkno = 0; blkno < hdr.nblocks; blkno ++) {
+        Z8LImgIdx const *idx = &index[blkno];
+        if (idx->offset == 0) continue;
+        count ++;
+        if (idx->length < hdr.blocksize) ++ *compblocks;
+        *storedbytes += idx->space;
+    }
+    return count;
+}
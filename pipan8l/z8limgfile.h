@@ -0,0 +1,94 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// sparse, optionally compressed disk or tape image
+//  file = Z8LImgHdr, Z8LImgIdx for each block, then stored blocks in any order
+//  all-zero blocks take no space, other blocks are zlib compressed if Z8LIMG_COMPRESS is set
+//   and that makes them smaller, else stored as is
+//  a rewritten block never overwrites its old copy, it goes in free space or is appended to the end
+//   old space becomes free once the index entry pointing elsewhere is on disk
+// whole image is kept uncompressed in memory while loaded, blocks marked dirty are stored by flush()
+//  data goes out before the index entries that point to it
+// used by z8lrk8je and z8ltc08, converted to and from raw files with z8limage
+
+#ifndef _Z8LIMGFILE_H
+#define _Z8LIMGFILE_H
+
+#include <stdint.h>
+
+#define Z8LIMG_MAGIC "z8limage"
+#define Z8LIMG_VERSION 1
+
+#define Z8LIMG_COMPRESS 0x01    // compress blocks when storing them
+
+struct Z8LImgHdr {
+    char magic[8];              // Z8LIMG_MAGIC
+    uint32_t version;           // Z8LIMG_VERSION
+    uint32_t blocksize;         // bytes per block
+    uint32_t nblocks;           // blocks in whole image
+    uint32_t flags;             // Z8LIMG_* flags
+    uint64_t dataend;           // end of stored blocks, where next appended block goes
+};
+
+struct Z8LImgIdx {
+    uint64_t offset;            // where stored block is in file, 0 if block is all zeroes
+    uint32_t length;            // stored length, blocksize if stored uncompressed
+    uint32_t space;             // bytes reserved at offset, same as length
+};
+
+struct Z8LImgFree {
+    uint64_t offset;            // where free space is in file
+    uint64_t space;             // number of bytes free there
+};
+
+struct Z8LImgFile {
+    Z8LImgFile ();
+    ~Z8LImgFile ();
+    char *open (int fd, bool readwrite, uint32_t blocksize, uint32_t nblocks);
+    char *create (int fd, uint32_t blocksize, uint32_t nblocks, uint32_t flags);
+    void close ();
+    void markdirty (uint32_t blkno);
+    uint32_t flush ();
+    uint32_t storedblocks (uint32_t *compblocks, uint64_t *storedbytes);
+    Z8LImgHdr const *header () { return &hdr; }
+
+    static bool isimage (int fd);
+
+    uint8_t *image;             // whole image contents, nblocks * blocksize bytes
+    int fd;                     // image file, -1 if not open, closed by close()
+
+    uint64_t blockwrites;       // blocks stored by flush()
+
+private:
+    bool readwrite;
+    Z8LImgHdr hdr;
+    Z8LImgIdx *index;
+    Z8LImgFree *freelist;       // space in file not used by any index entry on disk
+    uint32_t nfree;             // ... number of entries in use
+    uint32_t maxfree;           // ... number of entries allocated
+    uint8_t *dirty;             // bitmap of blocks written since last flush
+    uint32_t dirtybeg;          // block range written since last flush
+    uint32_t dirtyend;          // ... dirtybeg >= dirtyend if nothing written
+
+    bool allocspace (uint32_t length, uint64_t *offset_r);
+    void freespace (uint64_t offset, uint64_t space);
+};
+
+#endif
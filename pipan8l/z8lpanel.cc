@@ -35,6 +35,7 @@
 #include <unistd.h>
 
 #include "assemble.h"
+#include "cmd_expect.h"
 #include "cmd_pin.h"
 #include "disassemble.h"
 #include "i2czlib.h"
@@ -56,6 +57,7 @@ static Tcl_ObjCmdProc cmd_setsw;
 static TclFunDef const fundefs[] = {
     { cmd_assemop,    "assemop",    "assemble instruction" },
     { cmd_disasop,    "disasop",    "disassemble instruction" },
+    { CMD_EXPECT },
     { cmd_getreg,     "getreg",     "get register value" },
     { cmd_getsw,      "getsw",      "get switch value" },
     { cmd_gettod,     "gettod",     "get current time in us precision" },
@@ -38,23 +38,17 @@ proc helpini {} {
 
 # override the tty access functions in pipan8lini.tcl
 # these access the tty directly via the pdp8ltty.v registers
-proc closettypipes {} { }
+# printer is read into a buffer by the expect command's thread, which also strips parity and nulls
+proc closettypipes {} {
+    expect stop
+}
 
-proc openttypipes {} { }
+proc openttypipes {} {
+    expect start tty
+}
 
 proc readttychartimed {msec} {
-    for {set i 0} {$i < $msec} {incr i} {
-        after 1
-        set prfull [pin get pr_full]
-        if {$prfull} {
-            set prchar [pin get pr_char set pr_full 0 pr_flag 1]
-            set prchar [expr {$prchar & 0177}]
-            if {$prchar != 0} {
-                return [inttochar $prchar]
-            }
-        }
-    }
-    return ""
+    return [expect getc $msec]
 }
 
 proc sendchartottykb {ch} {
@@ -171,11 +171,10 @@ int main (int argc, char **argv)
         printf ("\r%u byte%s so far ", nbytes, ((nbytes == 1) ? "" : "s"));
         fflush (stdout);
 
-        uint32_t ptpreg;
-        do {
-            usleep (1000000 / cps);
-            if (ctrlcflag) goto done;
-        } while (! ((ptpreg = ptpat[1]) & PTP_BUSY));
+        usleep (1000000 / cps);
+        do if (ctrlcflag) goto done;
+        while (! z8p.waitdev (&ptpat[1], PTP_BUSY, 0, 100000));
+        uint32_t ptpreg = ptpat[1];
 
         uint8_t wrbyte = ptpreg & ~ mask;
         if ((! remcr || (wrbyte != '\r')) && (! remdel || (wrbyte != 127)) && (! remnul || (wrbyte != 0))) {
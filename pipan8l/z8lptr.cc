@@ -131,8 +131,8 @@ int main (int argc, char **argv)
         printf ("\r%u/%u byte%s so far ", nbytes, fsize, ((nbytes == 1) ? "" : "s"));
         fflush (stdout);
 
-        do usleep (1000000 / cps);
-        while (! (ptrat[1] & PTR_STEP));
+        usleep (1000000 / cps);
+        while (! z8p.waitdev (&ptrat[1], PTR_STEP, 0, 1000000)) { }
         ptrat[1] = PTR_ENAB;
 
         uint8_t rdbyte;
@@ -148,8 +148,8 @@ int main (int argc, char **argv)
 
         if (((rdbyte & 0177) == '\n') && inscr && ! lastcr) {
             ptrat[1] = PTR_FLAG | PTR_ENAB | (rdbyte - '\n' + '\r') | mask;
-            do usleep (1000000 / cps);
-            while (! (ptrat[1] & PTR_STEP));
+            usleep (1000000 / cps);
+            while (! z8p.waitdev (&ptrat[1], PTR_STEP, 0, 1000000)) { }
         }
 
         lastcr = (rdbyte & 0177) == '\r';
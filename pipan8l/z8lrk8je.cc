@@ -20,7 +20,21 @@
 
 // Performs RK8JE disk I/O for the PDP-8/L Zynq I/O board
 
-//  ./z8lrk8je [-killit] [-loadro/-loadrw <driveno> <file>]... [<tclscriptfile>]
+//  ./z8lrk8je [-killit] [-loadro/-loadrw <driveno> <file>]... [-loadcow <driveno> <basefile> <deltafile>]... [-timescale <scale>] [<tclscriptfile>]
+
+// disk files are mapped into memory when loaded
+// sectors are transferred directly between the mapping and PDP memory
+// written sectors are flushed to the file every z8lrk8je_flushms milliseconds (default 1000),
+// when the drive is unloaded and on exit
+// each drive has its own lock held only briefly, the io thread holds a reference to the loaded file
+// instead, so loading, unloading and rkstats don't wait for an io in progress to complete
+// sequential reads are detected per drive and the following z8lrk8je_readahead sectors (default 32)
+// are faulted into memory by a helper thread while the pdp is processing the current one
+// the sector being read is also faulted in during the emulated seek and transfer time
+// rkloadrw/-loadcow with a delta file leave the base file untouched and write changed sectors
+// to the delta file instead (see z8lcowfile.h), use z8lcowmerge to merge them back
+// files made by z8limage (see z8limgfile.h) are recognized when loaded and decompressed into memory,
+// written sectors are compressed and stored back by the same flushes as for mapped files
 
 #include <errno.h>
 #include <fcntl.h>
@@ -31,11 +45,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <tcl.h>
 #include <unistd.h>
 
 #include "tclmain.h"
+#include "z8lcowfile.h"
+#include "z8limgfile.h"
 #include "z8ldefs.h"
 #include "z8lutil.h"
 
@@ -70,61 +87,133 @@
 #define ST_DSER (1U <<  1)    // drive status error
 #define ST_CYLR (1U <<  0)    // cylinder error
 
-static bool ros[4];
+// a loaded disk file
+// freed by whichever of unload or the io thread is last to let go of it
+struct DiskFile {
+    int refs;                   // one for being loaded in the drive plus one for each thread using it, protected by drive lock
+    int fd;
+    bool ro;                    // write-locked
+    uint16_t *map;              // file contents mapped to memory, or decompressed image contents
+    Z8LCowFile *cow;            // base and delta files instead of map if loaded copy-on-write
+    Z8LImgFile *img;            // image file map points into if loaded from a z8limage file
+    uint32_t mapbytes;          // size of mapping, less than full disk if short read-only file
+    uint32_t dirtybeg;          // byte range written since last flush
+    uint32_t dirtyend;          // ... dirtybeg >= dirtyend if nothing written
+};
+
+// drive lock is only held long enough to get a reference to the file or update counters
+// so loading, unloading and status never wait for an io to complete
+struct Drive {
+    pthread_mutex_t lock;
+    DiskFile *file;             // NULL if nothing loaded
+    uint64_t emulns;            // nanoseconds of seek and transfer time emulated at full scale
+    uint64_t waitns;            // nanoseconds actually waited
+    uint64_t requests;          // number of seek/read/write requests
+};
+
+static Drive drives[4];
 static int debug;
-static int fds[4];
-static uint32_t nsperus;
+static uint32_t flushms;
+static uint32_t volatile nsperus;   // real nanoseconds per emulated drive microsecond, 1000 for real RK05 timing
+
+static pthread_cond_t racond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t ralock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t raahead;            // sectors to read ahead when reading sequentially, 0 for just the one being read
+static uint16_t rabeg[4];           // per drive, sectors rabeg..ranext-1 have been faulted in
+static uint16_t ranext[4];          // ... next sector helper thread will fault in
+static uint16_t raend[4];           // ... helper thread faults in sectors up to but not including raend
+static uint16_t lastread[4];        // ... last sector read, to detect sequential reads
+static uint64_t rahits[4];          // ... reads of sectors already faulted in
+static uint64_t ramisses[4];        // ... reads of sectors not faulted in yet
+static uint64_t rasectors[4];       // ... sectors faulted in by helper thread
+
+static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t mappedbytes;        // bytes transferred to/from mapping without read/write syscalls
+static uint64_t flushcount;         // number of msync() calls
+static uint64_t flushbytes;         // bytes flushed by msync()
+static uint64_t flushns;            // total nanoseconds spent in msync()
+static uint64_t flushmaxns;         // longest msync() call
 
 // internal TCL commands
 static Tcl_ObjCmdProc cmd_rkloadro;
 static Tcl_ObjCmdProc cmd_rkloadrw;
+static Tcl_ObjCmdProc cmd_rkstats;
+static Tcl_ObjCmdProc cmd_rktimescale;
 static Tcl_ObjCmdProc cmd_rkunload;
 
 static TclFunDef const fundefs[] = {
     { cmd_rkloadro, "rkloadro", "<disknumber> <filename> - load file read-only" },
-    { cmd_rkloadrw, "rkloadrw", "<disknumber> <filename> - load file read/write" },
+    { cmd_rkloadrw, "rkloadrw", "<disknumber> <filename> [<deltafile>] - load file read/write" },
+    { cmd_rkstats,  "rkstats",  "[<disknumber>] - get transfer statistics" },
+    { cmd_rktimescale, "rktimescale", "[<scale>] - get/set seek and transfer time scale" },
     { cmd_rkunload, "rkunload", "<disknumber> - unload disk" },
     { NULL, NULL, NULL }
 };
 
 #define LOCKIT if (pthread_mutex_lock (&lock) != 0) ABORT ()
 #define UNLKIT if (pthread_mutex_unlock (&lock) != 0) ABORT ()
+#define DRLOCK(d) if (pthread_mutex_lock (&drives[d].lock) != 0) ABORT ()
+#define DRUNLK(d) if (pthread_mutex_unlock (&drives[d].lock) != 0) ABORT ()
+#define STLOCK if (pthread_mutex_lock (&statlock) != 0) ABORT ()
+#define STUNLK if (pthread_mutex_unlock (&statlock) != 0) ABORT ()
+#define RALOCK if (pthread_mutex_lock (&ralock) != 0) ABORT ()
+#define RAUNLK if (pthread_mutex_unlock (&ralock) != 0) ABORT ()
 
 static bool volatile exiting;
-static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;     // just for timed waits in io thread
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t volatile *rkat;
 static Z8LPage *z8p;
 
 static int loaddisk (bool readwrite, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
 static bool loadfile (Tcl_Interp *interp, bool readwrite, int diskno, char const *filenm);
+static bool loadcow (Tcl_Interp *interp, int diskno, char const *basenm, char const *deltanm);
+static bool loadimage (Tcl_Interp *interp, bool readwrite, int diskno, char const *filenm, int fd);
 static void *thread (void *dummy);
-static char *lockfile (int fd, int how);
+static void readahead (int diskno, uint16_t blknum);
+static void *rathread (void *dummy);
+static void racancel (int diskno);
 static int relockfile (int fd, int how);
 static bool writeformat (Tcl_Interp *interp, int fd);
+static bool settimescale (char const *str);
+static void installfile (int diskno, DiskFile *file);
+static DiskFile *getfile (int diskno);
+static void putfile (int diskno, DiskFile *file);
+static void flushfile (int diskno, DiskFile *file);
+static void closefile (int diskno, DiskFile *file);
+static uint64_t getnowns ();
+static void siginthand (int signum);
 
 int main (int argc, char **argv)
 {
-    memset (fds, -1, sizeof fds);
+    int loadargs[4];
+    memset (loadargs, -1, sizeof loadargs);
+    bool loadro[4];
+    for (int diskno = 0; diskno <= 3; diskno ++) {
+        if (pthread_mutex_init (&drives[diskno].lock, NULL) != 0) ABORT ();
+    }
 
     bool killit = false;
     bool loadit = false;
     int tclargs = argc;
+    nsperus = 1000;
     for (int i = 0; ++ i < argc;) {
         if (strcmp (argv[i], "-?") == 0) {
             puts ("");
             puts ("     Access RK8JE controller and drives");
             puts ("");
-            puts ("  ./z8lrk8je [-killit] [-loadro/-loadrw <driveno> <file>]... | [<tclscriptfile> [<scriptargs>...]]");
+            puts ("  ./z8lrk8je [-killit] [-loadro/-loadrw <driveno> <file>]... [-loadcow <driveno> <basefile> <deltafile>]... [-timescale <scale>] | [<tclscriptfile> [<scriptargs>...]]");
             puts ("     -killit : kill other process accessing RK8JE controller");
-            puts ("     -loadro/rw : load the given file in the given drive");
+            puts ("     -loadro/rw : load the given raw or z8limage file in the given drive");
+            puts ("     -loadcow : load read-only base file in the given drive, writes go to delta file");
+            puts ("     -timescale : scale seek and transfer times, 0=instant .. 1=real RK05, default 1");
             puts ("     <tclscriptfile> : execute script then exit");
             puts ("                else : read and process commands from stdin");
             puts ("");
-            puts ("     Use -loadro/-loadrw to statically load files in drives.");
+            puts ("     Use -loadro/-loadrw/-loadcow to statically load files in drives.");
             puts ("     Any <tclscriptfile> given is ignored.");
             puts ("");
-            puts ("     If no -loadro/rw options given, will use TCL commands to dynamically load");
+            puts ("     If no -loadro/rw/cow options given, will use TCL commands to dynamically load");
             puts ("     and unload drives.  If no <tclscriptfile> given, will read from stdin.");
             puts ("");
             return 0;
@@ -133,6 +222,13 @@ int main (int argc, char **argv)
             killit = true;
             continue;
         }
+        if (strcasecmp (argv[i], "-timescale") == 0) {
+            if ((++ i >= argc) || ! settimescale (argv[i])) {
+                fprintf (stderr, "missing or bad -timescale, must be number 0..1\n");
+                return 1;
+            }
+            continue;
+        }
         if ((strcasecmp (argv[i], "-loadro") == 0) || (strcasecmp (argv[i], "-loadrw") == 0)) {
             if ((i + 2 >= argc) || (argv[i+1][0] == '-') || (argv[i+2][0] == '-')) {
                 fprintf (stderr, "missing disknumber and/or filename for -loadro/rw\n");
@@ -144,12 +240,29 @@ int main (int argc, char **argv)
                 fprintf (stderr, "disknumber %s must be integer in range 0..3\n", argv[i+1]);
                 return 1;
             }
-            fds[diskno] = i;
-            ros[diskno] = strcasecmp (argv[i], "-loadro") == 0;
+            loadargs[diskno] = i;
+            loadro[diskno] = strcasecmp (argv[i], "-loadro") == 0;
             loadit = true;
             i += 2;
             continue;
         }
+        if (strcasecmp (argv[i], "-loadcow") == 0) {
+            if ((i + 3 >= argc) || (argv[i+1][0] == '-') || (argv[i+2][0] == '-') || (argv[i+3][0] == '-')) {
+                fprintf (stderr, "missing disknumber, basefile and/or deltafile for -loadcow\n");
+                return 1;
+            }
+            char *p;
+            int diskno = strtol (argv[i+1], &p, 0);
+            if ((*p != 0) || (diskno < 0) || (diskno > 3)) {
+                fprintf (stderr, "disknumber %s must be integer in range 0..3\n", argv[i+1]);
+                return 1;
+            }
+            loadargs[diskno] = i;
+            loadro[diskno] = false;
+            loadit = true;
+            i += 3;
+            continue;
+        }
         if (argv[i][0] == '-') {
             fprintf (stderr, "unknown option %s\n", argv[i]);
             return 1;
@@ -162,21 +275,38 @@ int main (int argc, char **argv)
     rkat = z8p->findev ("RK", NULL, NULL, true, killit);
     rkat[RK_FLG] = F_ENABLE;    // enable board to process io instructions
 
-    nsperus = 1000;
     debug = 0;
     char const *dbgenv = getenv ("z8lrk8je_debug");
     if (dbgenv != NULL) debug = atoi (dbgenv);
 
+    flushms = 1000;
+    char const *flsenv = getenv ("z8lrk8je_flushms");
+    if ((flsenv != NULL) && (flsenv[0] != 0)) flushms = atoi (flsenv);
+
+    raahead = 32;
+    char const *raenv = getenv ("z8lrk8je_readahead");
+    if ((raenv != NULL) && (raenv[0] != 0)) raahead = atoi (raenv);
+
+    // spawn thread to fault in sectors ahead of reads
+    pthread_t ratid;
+    if (pthread_create (&ratid, NULL, rathread, NULL) != 0) ABORT ();
+
     // if -load option, load files then just run io calls
     if (loadit) {
         for (int diskno = 0; diskno <= 3; diskno ++) {
-            int i = fds[diskno];
+            int i = loadargs[diskno];
             if (i >= 0) {
-                fds[diskno] = -1;
-                if (! loadfile (NULL, ! ros[diskno], diskno, argv[i+2])) return 1;
+                if (strcasecmp (argv[i], "-loadcow") == 0) {
+                    if (! loadcow (NULL, diskno, argv[i+2], argv[i+3])) return 1;
+                } else {
+                    if (! loadfile (NULL, ! loadro[diskno], diskno, argv[i+2])) return 1;
+                }
             }
         }
+        signal (SIGINT,  siginthand);
+        signal (SIGTERM, siginthand);
         thread (NULL);
+        for (int diskno = 0; diskno <= 3; diskno ++) installfile (diskno, NULL);
         return 0;
     }
 
@@ -190,17 +320,23 @@ int main (int argc, char **argv)
 
     exiting = true;
     pthread_join (threadid, NULL);
+    for (int diskno = 0; diskno <= 3; diskno ++) installfile (diskno, NULL);
 
     return rc;
 }
 
+static void siginthand (int signum)
+{
+    exiting = true;
+}
+
 // rkloadro <disknumber> <filename>
 static int cmd_rkloadro (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
     return loaddisk (false, interp, objc, objv);
 }
 
-// rkloadrw <disknumber> <filename>
+// rkloadrw <disknumber> <filename> [<deltafile>]
 static int cmd_rkloadrw (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
     return loaddisk (true, interp, objc, objv);
@@ -212,10 +348,13 @@ static int loaddisk (bool readwrite, Tcl_Interp *interp, int objc, Tcl_Obj *cons
         puts ("");
         puts ("  rkloadro <disknumber> <filenane>");
         puts ("  rkloadrw <disknumber> <filenane>");
+        puts ("  rkloadrw <disknumber> <basefilenane> <deltafilename>");
+        puts ("    base file opened read-only and can be shared");
+        puts ("    written sectors go to delta file, created if it doesn't exist");
         return TCL_OK;
     }
 
-    if (objc == 3) {
+    if ((objc == 3) || (readwrite && (objc == 4))) {
         int diskno;
         int rc = Tcl_GetIntFromObj (interp, objv[1], &diskno);
         if (rc != TCL_OK) return rc;
@@ -225,10 +364,13 @@ static int loaddisk (bool readwrite, Tcl_Interp *interp, int objc, Tcl_Obj *cons
         }
         char const *filenm = Tcl_GetString (objv[2]);
 
+        if (objc == 4) {
+            return loadcow (interp, diskno, filenm, Tcl_GetString (objv[3])) ? TCL_OK : TCL_ERROR;
+        }
         return loadfile (interp, readwrite, diskno, filenm) ? TCL_OK : TCL_ERROR;
     }
 
-    Tcl_SetResultF (interp, "rkloadro/rkloadrw <disknumber> <filename>");
+    Tcl_SetResultF (interp, "rkloadro <disknumber> <filename> / rkloadrw <disknumber> <filename> [<deltafile>]");
     return TCL_ERROR;
 }
 
@@ -248,6 +390,7 @@ static bool loadfile (Tcl_Interp *interp, bool readwrite, int diskno, char const
         free (lockerr);
         return false;
     }
+    if (Z8LImgFile::isimage (fd)) return loadimage (interp, readwrite, diskno, filenm, fd);
     long oldsize = lseek (fd, 0, SEEK_END);
     if (readwrite && (ftruncate (fd, NBLKS * 512) < 0)) {
         if (interp == NULL) fprintf (stderr, "error extending %s: %m\n", filenm);
@@ -259,12 +402,170 @@ static bool loadfile (Tcl_Interp *interp, bool readwrite, int diskno, char const
         close (fd);
         return false;
     }
+
+    // map whole disk, or what there is of a short read-only file
+    uint32_t nbytes = readwrite ? NBLKS * 512 : ((oldsize < NBLKS * 512) ? oldsize : NBLKS * 512);
+    void *ptr = NULL;
+    if (nbytes > 0) {
+        ptr = mmap (NULL, nbytes, readwrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            if (interp == NULL) fprintf (stderr, "error mapping %s: %m\n", filenm);
+            else Tcl_SetResultF (interp, "%m");
+            close (fd);
+            return false;
+        }
+    }
+
     fprintf (stderr, "IODevRK8JE::loadfile: drive %d loaded with read%s file %s\n", diskno, (readwrite ? "/write" : "-only"), filenm);
-    LOCKIT;
-    close (fds[diskno]);
-    fds[diskno] = fd;
-    ros[diskno] = ! readwrite;
-    UNLKIT;
+    DiskFile *file = new DiskFile ();
+    file->fd = fd;
+    file->ro = ! readwrite;
+    file->map = (uint16_t *) ptr;
+    file->mapbytes = nbytes;
+    installfile (diskno, file);
+    return true;
+}
+
+// load image file made by z8limage, already opened and locked by loadfile()
+static bool loadimage (Tcl_Interp *interp, bool readwrite, int diskno, char const *filenm, int fd)
+{
+    Z8LImgFile *img = new Z8LImgFile ();
+    char *errmsg = img->open (fd, readwrite, 512, NBLKS);
+    if (errmsg != NULL) {
+        if (interp == NULL) fprintf (stderr, "error loading %s: %s\n", filenm, errmsg);
+        else Tcl_SetResultF (interp, "%s", errmsg);
+        free (errmsg);
+        delete img;
+        close (fd);
+        return false;
+    }
+
+    fprintf (stderr, "IODevRK8JE::loadimage: drive %d loaded with read%s image %s\n", diskno, (readwrite ? "/write" : "-only"), filenm);
+    DiskFile *file = new DiskFile ();
+    file->fd = fd;
+    file->ro = ! readwrite;
+    file->map = (uint16_t *) img->image;
+    file->img = img;
+    file->mapbytes = NBLKS * 512;
+    installfile (diskno, file);
+    return true;
+}
+
+// load read-only base file with writes going to delta file
+static bool loadcow (Tcl_Interp *interp, int diskno, char const *basenm, char const *deltanm)
+{
+    Z8LCowFile *cow = new Z8LCowFile ();
+    char *errmsg = cow->open (basenm, deltanm, 512, NBLKS);
+    if (errmsg != NULL) {
+        if (interp == NULL) fprintf (stderr, "%s\n", errmsg);
+        else Tcl_SetResultF (interp, "%s", errmsg);
+        free (errmsg);
+        delete cow;
+        return false;
+    }
+
+    fprintf (stderr, "IODevRK8JE::loadcow: drive %d loaded with base %s delta %s (%u blocks)\n", diskno, basenm, deltanm, cow->deltablocks ());
+    DiskFile *file = new DiskFile ();
+    file->fd = cow->deltafd;
+    file->cow = cow;
+    file->mapbytes = NBLKS * 512;
+    installfile (diskno, file);
+    return true;
+}
+
+// rkstats [<disknumber>]
+static int cmd_rkstats (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if ((objc == 2) && (strcasecmp (Tcl_GetString (objv[1]), "help") == 0)) {
+        puts ("");
+        puts ("  rkstats - get statistics as name value pairs");
+        puts ("    mappedbytes : bytes transferred to/from disk file mapping without read/write calls");
+        puts ("    flushcount  : number of flushes of written sectors to disk files");
+        puts ("    flushbytes  : bytes flushed");
+        puts ("    flushavgus  : average microseconds per flush");
+        puts ("    flushmaxus  : longest flush in microseconds");
+        puts ("  rkstats <disknumber> - get drive statistics as name value pairs");
+        puts ("    requests : number of seek, read and write requests");
+        puts ("    emulus   : microseconds of seek and transfer time a real RK05 would take");
+        puts ("    waitus   : microseconds actually waited, per rktimescale");
+        puts ("    deltablocks : sectors in delta file if loaded with one");
+        puts ("    rahits      : reads of sectors already faulted into memory by read-ahead");
+        puts ("    ramisses    : reads of sectors not faulted in yet");
+        puts ("    rasectors   : sectors faulted in by read-ahead");
+        return TCL_OK;
+    }
+
+    if (objc == 2) {
+        int diskno;
+        int rc = Tcl_GetIntFromObj (interp, objv[1], &diskno);
+        if (rc != TCL_OK) return rc;
+        if ((diskno < 0) || (diskno > 3)) {
+            Tcl_SetResultF (interp, "disknumber %d not in range 0..3", diskno);
+            return TCL_ERROR;
+        }
+        // never hold drive and read-ahead locks at the same time
+        Drive *drive = &drives[diskno];
+        DRLOCK (diskno);
+        uint64_t requests = drive->requests;
+        uint64_t emulns   = drive->emulns;
+        uint64_t waitns   = drive->waitns;
+        uint32_t deltablocks = ((drive->file == NULL) || (drive->file->cow == NULL)) ? 0 : drive->file->cow->deltablocks ();
+        DRUNLK (diskno);
+        RALOCK;
+        uint64_t hits    = rahits[diskno];
+        uint64_t misses  = ramisses[diskno];
+        uint64_t sectors = rasectors[diskno];
+        RAUNLK;
+        Tcl_SetResultF (interp, "requests %llu emulus %llu waitus %llu deltablocks %u rahits %llu ramisses %llu rasectors %llu",
+            (long long unsigned) requests, (long long unsigned) (emulns / 1000), (long long unsigned) (waitns / 1000), deltablocks,
+            (long long unsigned) hits, (long long unsigned) misses, (long long unsigned) sectors);
+        return TCL_OK;
+    }
+
+    if (objc == 1) {
+        STLOCK;
+        Tcl_SetResultF (interp, "mappedbytes %llu flushcount %llu flushbytes %llu flushavgus %llu flushmaxus %llu",
+            (long long unsigned) mappedbytes, (long long unsigned) flushcount, (long long unsigned) flushbytes,
+            (long long unsigned) ((flushcount == 0) ? 0 : flushns / flushcount / 1000), (long long unsigned) (flushmaxns / 1000));
+        STUNLK;
+        return TCL_OK;
+    }
+
+    Tcl_SetResultF (interp, "rkstats [<disknumber>]");
+    return TCL_ERROR;
+}
+
+// rktimescale [<scale>]
+static int cmd_rktimescale (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if ((objc == 2) && (strcasecmp (Tcl_GetString (objv[1]), "help") == 0)) {
+        puts ("");
+        puts ("  rktimescale [<scale>] - get/set seek and transfer time scale");
+        puts ("    0 = instant, 1 = real RK05 timing, fractions in between");
+        puts ("    returns previous scale");
+        return TCL_OK;
+    }
+
+    if (objc <= 2) {
+        Tcl_SetResultF (interp, "%.3f", nsperus / 1000.0);
+        if ((objc == 2) && ! settimescale (Tcl_GetString (objv[1]))) {
+            Tcl_SetResultF (interp, "bad scale %s, must be number 0..1", Tcl_GetString (objv[1]));
+            return TCL_ERROR;
+        }
+        return TCL_OK;
+    }
+
+    Tcl_SetResultF (interp, "rktimescale [<scale>]");
+    return TCL_ERROR;
+}
+
+// set time scale from string 0..1
+static bool settimescale (char const *str)
+{
+    char *p;
+    double scale = strtod (str, &p);
+    if ((p == str) || (*p != 0) || ! (scale >= 0.0) || (scale > 1.0)) return false;
+    nsperus = (uint32_t) (scale * 1000.0 + 0.5);
     return true;
 }
 
@@ -280,10 +581,7 @@ static int cmd_rkunload (ClientData clientdata, Tcl_Interp *interp, int objc, Tc
             return TCL_ERROR;
         }
         fprintf (stderr, "IODevRK8JE::scriptcmd: drive %d unloaded\n", diskno);
-        LOCKIT;
-        close (fds[diskno]);
-        fds[diskno] = -1;
-        UNLKIT;
+        installfile (diskno, NULL);
         return TCL_OK;
     }
 
@@ -324,14 +622,28 @@ void *thread (void *dummy)
                             // <00> : cylinder address error
 
     uint16_t lastdas[4];
+    uint64_t lastflushns;
 
     memset (lastdas, 0, sizeof lastdas);
+    lastflushns = getnowns ();
 
     if (debug > 1) fprintf (stderr, "IODevRK8JE::thread*: thread started\r\n");
 
     while (! exiting) {
-        usleep (1000);
-        LOCKIT;
+        z8p->waitdev (&rkat[RK_FLG], F_STRTIO, 0, 100000);
+
+        // maybe it's time to flush written sectors to disk files
+        if (getnowns () - lastflushns >= flushms * 1000000ULL) {
+            for (int diskno = 0; diskno <= 3; diskno ++) {
+                DiskFile *file = getfile (diskno);
+                if (file != NULL) {
+                    flushfile (diskno, file);
+                    putfile (diskno, file);
+                }
+            }
+            lastflushns = getnowns ();
+        }
+
         if (rkat[RK_FLG] & F_STRTIO) {
             rkat[RK_FLG] = F_ENABLE | F_STBUSY;
 
@@ -340,31 +652,40 @@ void *thread (void *dummy)
             diskaddr = rkat[RK_DAD];
             memaddr  = rkat[RK_MEM];
 
-            int cyldiff, fd, rc;
+            int cyldiff, rc;
             struct timespec endts, nowts;
-            uint16_t blknum, diskno, icnt, wcnt, xma;
-            uint16_t temp[256];
-            uint64_t delns, endns, nowns;
+            DiskFile *file;
+            Drive *drive;
+            uint16_t blknum, diskno, wcnt, xma;
+            uint16_t *blkptr;
+            uint64_t begns, delns, emulus, endns, nowns;
 
             blknum = ((command & 1) << 12) | diskaddr;
             wcnt   = (command & 00100) ? 128 : 256;
             xma    = ((command << 9) & 070000) | memaddr;
             diskno = (command >> 1) & 3;
+            drive  = &drives[diskno];
 
             if (debug > 0) fprintf (stderr, "IODevRK8JE::thread*: startio sts=%04o mem=%05o dsk=%o dad=%04o wct=%u blk=%05o cmd=%o\r\n",
                 status, xma, diskno, diskaddr, wcnt, blknum, command >> 9);
 
             // maybe just setting write-locked mode
             if ((command >> 9) == 2) {
-                if (! ros[diskno]) {
-                    ros[diskno] = true;
-                    fd = fds[diskno];
-                    if (relockfile (fd, F_RDLCK) < 0) {
+                file = getfile (diskno);
+                if (file == NULL) {
+                    SETST (ST_DONE | ST_FLNR);                                  // file not ready
+                    goto iodone;
+                }
+                if (! file->ro) {
+                    file->ro = true;
+                    if (relockfile (file->fd, F_RDLCK) < 0) {
                         fprintf (stderr, "IODevRK8JE::thread: error downgrading to shared lock on disk %u: %m\n", diskno);
+                        putfile (diskno, file);
                         SETST (ST_DONE | ST_FLNR);                              // file not ready
                         goto iodone;
                     }
                 }
+                putfile (diskno, file);
                 SETST (ST_DONE);
                 goto iodone;
             }
@@ -380,27 +701,44 @@ void *thread (void *dummy)
             if (cyldiff < 0) cyldiff = - cyldiff;
             if (cyldiff > 0) SETST (ST_HDIM);                                   // head in motion
 
+            // start faulting in the sector and maybe the ones after it while waiting
+            if ((command >> 9) <= 1) readahead (diskno, blknum);
+
             // wait for a while to simulate the slow disk drive
             // can be cancelled by DCLR clearing the busy bit
-            // unlocked during wait, ioinstr() won't change anything while busy set (except DCLR that clears busy)
-            delns = (((cyldiff > 0) ? (cyldiff * SEEKRATE + SETTLEUS) : 0) + wcnt * XFERRATE) * (uint64_t) nsperus;
-            if (clock_gettime (CLOCK_REALTIME, &nowts) < 0) ABORT ();
-            nowns = (uint64_t) nowts.tv_sec * 1000000000 + nowts.tv_nsec;
-            endns = nowns + delns;
-            endts.tv_sec  = endns / 1000000000;
-            endts.tv_nsec = endns % 1000000000;
-            do {
-                rc = pthread_cond_timedwait (&cond, &lock, &endts);
-                if ((rc != 0) && (rc != ETIMEDOUT)) ABORT ();
-                if (! (rkat[RK_FLG] & F_STBUSY)) goto ioabrt;                   // DCLR cleared busy so we're done
+            // ioinstr() won't change anything while busy set (except DCLR that clears busy)
+            // no drive locked during wait so disks can be loaded and unloaded
+            // scaled by rktimescale, skip waiting altogether if zero
+            emulus = ((cyldiff > 0) ? (cyldiff * SEEKRATE + SETTLEUS) : 0) + wcnt * XFERRATE;
+            delns  = emulus * nsperus;
+            begns  = nowns = 0;
+            if (delns > 0) {
                 if (clock_gettime (CLOCK_REALTIME, &nowts) < 0) ABORT ();
-                nowns = (uint64_t) nowts.tv_sec * 1000000000 + nowts.tv_nsec;
-            } while (nowns < endns);
+                begns = nowns = (uint64_t) nowts.tv_sec * 1000000000 + nowts.tv_nsec;
+                endns = nowns + delns;
+                endts.tv_sec  = endns / 1000000000;
+                endts.tv_nsec = endns % 1000000000;
+                LOCKIT;
+                do {
+                    rc = pthread_cond_timedwait (&cond, &lock, &endts);
+                    if ((rc != 0) && (rc != ETIMEDOUT)) ABORT ();
+                    if (clock_gettime (CLOCK_REALTIME, &nowts) < 0) ABORT ();
+                    nowns = (uint64_t) nowts.tv_sec * 1000000000 + nowts.tv_nsec;
+                    if (! (rkat[RK_FLG] & F_STBUSY)) break;                    // DCLR cleared busy so we're done
+                } while (nowns < endns);
+                UNLKIT;
+            }
+            DRLOCK (diskno);
+            drive->requests ++;
+            drive->emulns += emulus * 1000;
+            drive->waitns += nowns - begns;
+            DRUNLK (diskno);
+            if (! (rkat[RK_FLG] & F_STBUSY)) continue;
             lastdas[diskno] = blknum;                                           // remember head position for next seek time calculation
 
             // error if no file loaded
-            fd = fds[diskno];
-            if (fd < 0) {
+            file = getfile (diskno);
+            if (file == NULL) {
                 SETST (ST_DONE | ST_FLNR);                                      // file not ready
                 goto iodone;
             }
@@ -415,23 +753,22 @@ void *thread (void *dummy)
                 }
                 case 0: {
                     if (debug > 1) fprintf (stderr, "IODevRK8JE::thread*: %u reading %u words at %u into %05o (%u ms)\r\n", diskno, wcnt, blknum, xma, (uint32_t) ((delns + 500000) / 1000000));
-                    ASSERT (wcnt * 2 <= sizeof temp);
-                    rc = pread (fd, temp, wcnt * 2, blknum * 512);
-                    if (rc < wcnt * 2) {
+                    if (blknum * 512U + wcnt * 2 > file->mapbytes) {
                         SETST (ST_DONE | ST_CRCR);                              // crc error
-                        if (rc < 0) {
-                            fprintf (stderr, "IODevRK8JE::thread: error reading %u words from disk %u at %05o: %m\n", wcnt, diskno, blknum);
-                        } else {
-                            fprintf (stderr, "IODevRK8JE::thread: only read %d bytes of %u words from disk %u at %05o\n", rc, wcnt, diskno, blknum);
-                        }
+                        fprintf (stderr, "IODevRK8JE::thread: only %u bytes in disk %u reading %u words at %05o\n", file->mapbytes, diskno, wcnt, blknum);
                         break;
                     }
-                    for (icnt = 0; icnt < wcnt; icnt ++) {
-                        uint16_t xaddr = (xma & 070000) | ((xma + icnt) & 007777);
-                        z8p->dmacycle (CM_ENAB | (temp[icnt] & 07777) * CM_DATA0 | CM_WRITE | xaddr * CM_ADDR0, 0);
+                    if (file->cow != NULL) {
+                        z8p->xferwrite (xma, (uint16_t const *) file->cow->rdblock (blknum), wcnt);
+                    } else {
+                        z8p->xferwrite (xma, file->map + blknum * 256, wcnt);
                     }
+                    STLOCK;
+                    mappedbytes += wcnt * 2;
+                    STUNLK;
                     memaddr = (memaddr + wcnt) & 07777;
-                    z8p->dmaflush ();
+                    if (debug > 1) fprintf (stderr, "IODevRK8JE::thread*: %u words direct %llu, dma %llu at %.0f words/sec\r\n", diskno,
+                        (long long unsigned) z8p->xferdirect, (long long unsigned) z8p->xferdma, z8p->dmarate ());
                     SETST (ST_DONE);                                            // done
                     break;
                 }
@@ -448,28 +785,32 @@ void *thread (void *dummy)
                 }
                 case 4: {
                     if (debug > 1) fprintf (stderr, "IODevRK8JE::thread*: %u writing %u words at %u from %05o (%u ms)\r\n", diskno, wcnt, blknum, xma, (uint32_t) ((delns + 500000) / 1000000));
-                    if (ros[diskno]) {
+                    if (file->ro) {
                         SETST (ST_DONE | ST_WLER);                              // write lock error
                         wcnt = 0;
                         break;
                     }
-                    ASSERT (wcnt * 2 <= sizeof temp);
-                    for (icnt = 0; icnt < wcnt; icnt ++) {
-                        uint16_t xaddr = (xma & 070000) | ((xma + icnt) & 007777);
-                        uint32_t cm = z8p->dmacycle (CM_ENAB | xaddr * CM_ADDR0, 0);
-                        temp[icnt] = (cm & CM_DATA) / CM_DATA0;
+                    if (file->cow != NULL) {
+                        blkptr = (uint16_t *) file->cow->wrblock (blknum);
+                    } else {
+                        blkptr = file->map + blknum * 256;
                     }
-                    if (wcnt < 256) memset (&temp[wcnt], 0, 512 - 2 * wcnt);
-                    rc = pwrite (fd, temp, 512, blknum * 512);
-                    if (rc < 512) {
-                        SETST (ST_DONE | ST_CRCR);                              // crc error
-                        if (rc < 0) {
-                            fprintf (stderr, "IODevRK8JE::thread: error writing %u words from disk %u at %05o: %m\n", wcnt, diskno, blknum);
+                    z8p->xferread (xma, blkptr, wcnt);
+                    if (wcnt < 256) memset (&blkptr[wcnt], 0, 512 - 2 * wcnt);
+                    if (file->img != NULL) {
+                        file->img->markdirty (blknum);
+                    } else if (file->cow == NULL) {         // delta file keeps track of its own dirty sectors
+                        if (file->dirtybeg >= file->dirtyend) {
+                            file->dirtybeg = blknum * 512;
+                            file->dirtyend = blknum * 512 + 512;
                         } else {
-                            fprintf (stderr, "IODevRK8JE::thread: only wrote %d bytes of %u words from disk %u at %05o\n", rc, wcnt, diskno, blknum);
+                            if (file->dirtybeg > blknum * 512U) file->dirtybeg = blknum * 512;
+                            if (file->dirtyend < blknum * 512U + 512) file->dirtyend = blknum * 512 + 512;
                         }
-                        break;
                     }
+                    STLOCK;
+                    mappedbytes += 512;
+                    STUNLK;
                     memaddr = (memaddr + wcnt) & 07777;
                     SETST (ST_DONE);                                            // done
                     break;
@@ -481,6 +822,7 @@ void *thread (void *dummy)
                     break;
                 }
             }
+            putfile (diskno, file);
 
             // update status
         iodone:;
@@ -489,41 +831,179 @@ void *thread (void *dummy)
             rkat[RK_MEM] = memaddr;     // update memory address register
             rkat[RK_FLG] = F_ENABLE;    // clear F_STBUSY (F_STRTIO is already clear), ie, let pdp write registers
             rkat[RK_STS] = status;      // update status register
-        ioabrt:;
         }
-        UNLKIT;
     }
 
     return NULL;
 }
 
-// try to lock the given file
+// pdp is about to read the given sector
+// count whether it was already faulted in and tell helper thread what to fault in next
+static void readahead (int diskno, uint16_t blknum)
+{
+    RALOCK;
+
+    if ((blknum >= rabeg[diskno]) && (blknum < ranext[diskno])) rahits[diskno] ++;
+                                                      else ramisses[diskno] ++;
+
+    // sequential includes reading the same sector again, eg, 128-word transfers
+    bool seq = (blknum == lastread[diskno]) || (blknum == lastread[diskno] + 1);
+    lastread[diskno] = blknum;
+
+    // start window over if sector not in or just after what the helper is working on
+    if ((blknum < rabeg[diskno]) || (blknum > ranext[diskno])) ranext[diskno] = blknum;
+    rabeg[diskno] = blknum;
+
+    uint32_t end = blknum + 1 + ((seq && (raahead > 0)) ? raahead : 0);
+    if (end > NBLKS) end = NBLKS;
+    raend[diskno] = end;
+    if (ranext[diskno] < end) {
+        if (pthread_cond_broadcast (&racond) != 0) ABORT ();
+    }
+
+    RAUNLK;
+}
+
+// helper thread that faults in sectors so reads don't wait for the disk file
+static void *rathread (void *dummy)
+{
+    RALOCK;
+    while (true) {
+        bool didsomething = false;
+        for (int diskno = 0; diskno <= 3; diskno ++) {
+            uint16_t blknum = ranext[diskno];
+            if (blknum >= raend[diskno]) continue;
+
+            // touch the sector without holding the lock so the io thread never waits behind a slow page fault
+            // it never spans a page boundary, file reference keeps it from being unmapped
+            RAUNLK;
+            uint8_t const volatile *ptr = NULL;
+            DiskFile *file = getfile (diskno);
+            if (file != NULL) {
+                if (file->cow != NULL) ptr = file->cow->rdblock (blknum);
+                else if (blknum * 512U < file->mapbytes) ptr = (uint8_t const *) (file->map + blknum * 256);
+                if (ptr != NULL) (void) *ptr;
+                putfile (diskno, file);
+            }
+            RALOCK;
+            didsomething = true;        // rescan before waiting, a wakeup may have come while unlocked
+
+            // io thread may have moved the window or drive may have been unloaded meanwhile
+            if ((ranext[diskno] != blknum) || (blknum >= raend[diskno])) continue;
+            if (ptr == NULL) {
+                raend[diskno] = blknum;
+                continue;
+            }
+            ranext[diskno] = blknum + 1;
+            rasectors[diskno] ++;
+        }
+        if (! didsomething && (pthread_cond_wait (&racond, &ralock) != 0)) ABORT ();
+    }
+    return NULL;
+}
+
+// stop reading ahead on the drive when it is unloaded
+static void racancel (int diskno)
+{
+    RALOCK;
+    rabeg[diskno]  = 0;
+    ranext[diskno] = 0;
+    raend[diskno]  = 0;
+    RAUNLK;
+}
+
+// load file in drive, replacing whatever was there
 //  input:
-//   fd = file to lock
-//   how = F_WRLCK: exclusive access
-//         F_RDLCK: shared access
-//  output:
-//   returns NULL: successful
-//           else: error message
-static char *lockfile (int fd, int how)
+//   file = file to load, NULL to just unload
+static void installfile (int diskno, DiskFile *file)
 {
-    struct flock flockit;
+    if (file != NULL) file->refs = 1;
+    DRLOCK (diskno);
+    DiskFile *oldfile = drives[diskno].file;
+    drives[diskno].file = file;
+    DRUNLK (diskno);
+    racancel (diskno);
+    if (oldfile != NULL) putfile (diskno, oldfile);
+}
 
-trylk:;
-    memset (&flockit, 0, sizeof flockit);
-    flockit.l_type   = how;
-    flockit.l_whence = SEEK_SET;
-    flockit.l_len    = 4096;
-    if (fcntl (fd, F_SETLK, &flockit) >= 0) return NULL;
+// get reference to file loaded in drive so it can't be closed while being used
+//  returns NULL if nothing loaded
+static DiskFile *getfile (int diskno)
+{
+    DRLOCK (diskno);
+    DiskFile *file = drives[diskno].file;
+    if (file != NULL) file->refs ++;
+    DRUNLK (diskno);
+    return file;
+}
+
+// release reference to file, closing it if drive has been unloaded and this was the last reference
+static void putfile (int diskno, DiskFile *file)
+{
+    DRLOCK (diskno);
+    bool last = (-- file->refs == 0);
+    DRUNLK (diskno);
+    if (last) closefile (diskno, file);
+}
+
+// flush sectors written since last flush to disk file
+// called by io thread or by last thread to release file
+static void flushfile (int diskno, DiskFile *file)
+{
+    uint32_t nbytes;
+    uint64_t startns = getnowns ();
+
+    if (file->cow != NULL) {
+        nbytes = file->cow->flush ();
+        if (nbytes == 0) return;
+    } else if (file->img != NULL) {
+        nbytes = file->img->flush ();
+        if (nbytes == 0) return;
+    } else {
+        if (file->dirtybeg >= file->dirtyend) return;
 
-    char *errmsg = NULL;
-    if (((errno == EACCES) || (errno == EAGAIN)) && (fcntl (fd, F_GETLK, &flockit) >= 0)) {
-        if (flockit.l_type == F_UNLCK) goto trylk;
-        if (asprintf (&errmsg, "locked by pid %d", (int) flockit.l_pid) < 0) ABORT ();
+        // msync() wants page-aligned address
+        uint32_t pagesize = getpagesize ();
+        uint32_t beg = file->dirtybeg & - pagesize;
+        uint32_t end = file->dirtyend;
+        file->dirtybeg = file->dirtyend = 0;
+
+        if (msync ((char *) file->map + beg, end - beg, MS_SYNC) < 0) {
+            fprintf (stderr, "IODevRK8JE::flushfile: error flushing disk %d: %m\n", diskno);
+        }
+        nbytes = end - beg;
+    }
+    uint64_t elapns = getnowns () - startns;
+
+    STLOCK;
+    flushcount ++;
+    flushbytes += nbytes;
+    flushns    += elapns;
+    if (flushmaxns < elapns) flushmaxns = elapns;
+    STUNLK;
+    if (debug > 1) fprintf (stderr, "IODevRK8JE::flushfile*: %d flushed %u bytes in %llu us\r\n", diskno, nbytes, (long long unsigned) (elapns / 1000));
+}
+
+// flush and close disk file after last reference released
+static void closefile (int diskno, DiskFile *file)
+{
+    flushfile (diskno, file);
+    if (file->cow != NULL) {
+        delete file->cow;           // closes file->fd
+    } else if (file->img != NULL) {
+        delete file->img;           // closes file->fd
     } else {
-        if (asprintf (&errmsg, "%m") < 0) ABORT ();
+        if (file->map != NULL) munmap (file->map, file->mapbytes);
+        close (file->fd);
     }
-    return errmsg;
+    delete file;
+}
+
+static uint64_t getnowns ()
+{
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_MONOTONIC, &nowts) < 0) ABORT ();
+    return (uint64_t) nowts.tv_sec * 1000000000 + nowts.tv_nsec;
 }
 
 static int relockfile (int fd, int how)
@@ -0,0 +1,296 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Play the part of the PDP issuing RK8JE or TC08 transfers using the software model of the zynq page
+// Measures throughput of the z8lrk8je or z8ltc08 daemon running with the same z8lpage_sim file
+//  export z8lpage_sim=/dev/shm/z8lpage
+//  ./z8lrk8je.x86_64 -loadrw 0 disk.rk05 &
+//  ./z8lsimdrive.x86_64 -rk -count 1000
+// Also measures Z8LPage::waitdev() wakeup latency of the polling and notify() backends
+//  ./z8lsimdrive.x86_64 -wake -count 1000
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "z8ldefs.h"
+#include "z8lutil.h"
+
+#define RK_STS 4
+#define ST_DONE 04000
+#define ST_SKIP 05677
+
+#define TC_STATB0 0x00010000
+#define IDWC 07754
+#define IDCA 07755
+
+static bool volatile exitflag;
+
+static void siginthand (int signum);
+static uint64_t getnowns ();
+static int driverk (Z8LPage *z8p, int count, bool write, int blksize);
+static int drivetc (Z8LPage *z8p, int count, bool write);
+static int drivewake (int count);
+static int wakeone (char const *name, Z8LWaiter *waiter, int count);
+static void *wakethread (void *dummy);
+
+int main (int argc, char **argv)
+{
+    bool rk = false;
+    bool tc = false;
+    bool wake = false;
+    bool write = false;
+    int blksize = 256;
+    int count = 100;
+
+    for (int i = 0; ++ i < argc;) {
+        if (strcmp (argv[i], "-?") == 0) {
+            puts ("");
+            puts ("     Drive RK8JE or TC08 daemon as the PDP would, using the software model");
+            puts ("");
+            puts ("  ./z8lsimdrive {-rk | -tc | -wake} [-count <n>] [-half] [-write]");
+            puts ("     -rk    : do RK8JE transfers, z8lrk8je must be running with drive 0 loaded");
+            puts ("     -tc    : do TC08 transfers, z8ltc08 must be running with drive 0 loaded");
+            puts ("     -wake  : measure waitdev() wakeup latency of polling and notify() backends");
+            puts ("     -count : number of blocks to transfer (or wakeups), default 100");
+            puts ("     -half  : RK8JE 128-word blocks instead of 256");
+            puts ("     -write : write blocks instead of read");
+            puts ("");
+            puts ("     Set envar z8lpage_sim to the same file for this and the daemon");
+            puts ("");
+            return 0;
+        }
+        if (strcasecmp (argv[i], "-count") == 0) {
+            if ((++ i >= argc) || ((count = atoi (argv[i])) <= 0)) {
+                fprintf (stderr, "missing or bad count\n");
+                return 1;
+            }
+            continue;
+        }
+        if (strcasecmp (argv[i], "-half") == 0) {
+            blksize = 128;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-rk") == 0) {
+            rk = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-tc") == 0) {
+            tc = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-wake") == 0) {
+            wake = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-write") == 0) {
+            write = true;
+            continue;
+        }
+        fprintf (stderr, "unknown option %s\n", argv[i]);
+        return 1;
+    }
+    if (rk + tc + wake != 1) {
+        fprintf (stderr, "specify exactly one of -rk, -tc or -wake\n");
+        return 1;
+    }
+
+    signal (SIGINT, siginthand);
+
+    if (wake) return drivewake (count);
+
+    if (getenv ("z8lpage_sim") == NULL) {
+        fprintf (stderr, "envar z8lpage_sim must be set, the PDP does the i/o instructions on the real board\n");
+        return 1;
+    }
+
+    Z8LPage *z8p = new Z8LPage ();
+    return rk ? driverk (z8p, count, write, blksize) : drivetc (z8p, count, write);
+}
+
+static void siginthand (int signum)
+{
+    exitflag = true;
+}
+
+static uint64_t getnowns ()
+{
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) abort ();
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// do RK8JE transfers of consecutive blocks on drive 0 to/from address 00000
+static int driverk (Z8LPage *z8p, int count, bool write, int blksize)
+{
+    uint32_t volatile *rkat = z8p->findev ("RK", NULL, NULL, false);
+
+    bool skip;
+    uint16_t command = (write ? 04000 : 00000) | ((blksize == 128) ? 00100 : 0);
+    uint64_t startns = getnowns ();
+    int nblocks;
+    for (nblocks = 0; (nblocks < count) && ! exitflag; nblocks ++) {
+        simrkiot (rkat, 06746, command, &skip);                 // DLDC
+        simrkiot (rkat, 06744, 0, &skip);                       // DLCA
+        simrkiot (rkat, 06743, nblocks & 07777, &skip);         // DLAG
+        while (true) {
+            simrkiot (rkat, 06741, 0, &skip);                   // DSKP
+            if (skip || exitflag) break;
+            z8p->waitdev (&rkat[RK_STS], ST_SKIP, 0, 100000);
+        }
+        uint16_t status = simrkiot (rkat, 06745, 0, &skip);     // DRST
+        if (status != ST_DONE) {
+            fprintf (stderr, "driverk: block %d status %04o\n", nblocks, status);
+            return 1;
+        }
+    }
+    uint64_t elapns = getnowns () - startns;
+
+    printf ("%d blocks of %d words in %.3f sec: %.1f blocks/sec, %.0f words/sec\n", nblocks, blksize,
+        elapns / 1.0e9, nblocks * 1.0e9 / elapns, nblocks * blksize * 1.0e9 / elapns);
+    return 0;
+}
+
+// do TC08 forward transfers of consecutive blocks on drive 0 to/from address 02000
+// the model's MA stays at 0 so the transfer area must not include it
+// ...else z8ltc08 thinks the transfer overwrites the running boot code and takes the slow path
+static int drivetc (Z8LPage *z8p, int count, bool write)
+{
+    uint32_t volatile *tcat   = z8p->findev ("TC", NULL, NULL, false);
+    uint32_t volatile *extmem = z8p->extmem ();
+
+    bool skip;
+    uint16_t statusa = write ? 00240 : 00220;                   // unit 0, forward, go, normal, read/write data
+    uint64_t startns = getnowns ();
+    int nblocks;
+    for (nblocks = 0; (nblocks < count) && ! exitflag; nblocks ++) {
+        extmem[IDWC] = 010000 - 129;
+        extmem[IDCA] = 01777;
+        simtciot (tcat, 06766, statusa, &skip);                 // DTCA DTXA
+        while (true) {
+            simtciot (tcat, 06771, 0, &skip);                   // DTSF
+            if (skip || exitflag) break;
+            z8p->waitdev (&tcat[1], 04001 * TC_STATB0, 0, 100000);
+        }
+        uint16_t statusb = simtciot (tcat, 06772, 0, &skip);    // DTRB
+        if (statusb & 04000) {
+            fprintf (stderr, "drivetc: block %d status_b %04o\n", nblocks, statusb);
+            break;
+        }
+    }
+    simtciot (tcat, 06766, 0, &skip);                           // stop tape
+    uint64_t elapns = getnowns () - startns;
+
+    printf ("%d blocks of 129 words in %.3f sec: %.1f blocks/sec, %.0f words/sec\n", nblocks,
+        elapns / 1.0e9, nblocks * 1.0e9 / elapns, nblocks * 129 * 1.0e9 / elapns);
+    return 0;
+}
+
+// measure how long waitdev() takes to see a register change
+// a thread sets the register then calls notify() while the main thread is waiting for it
+// does not need the zynq page, the register is just a local variable
+
+static uint32_t volatile wakereg;
+static Z8LWaiter *volatile wakewaiter;
+static bool volatile wakearmed;
+static uint64_t volatile wakesetns;
+
+static int drivewake (int count)
+{
+    Z8LPollWaiter pollwaiter;
+    Z8LCondWaiter condwaiter;
+
+    pthread_t tid;
+    int rc = pthread_create (&tid, NULL, wakethread, NULL);
+    if (rc != 0) ABORT ();
+
+    int fails = wakeone ("poll", &pollwaiter, count) + wakeone ("cond", &condwaiter, count);
+
+    exitflag = true;
+    pthread_join (tid, NULL);
+
+    if (condwaiter.latncount == 0) {
+        fprintf (stderr, "drivewake: cond backend never measured a notify() latency\n");
+        fails ++;
+    }
+    return (fails == 0) ? 0 : 1;
+}
+
+// time count wakeups using the given backend
+//  output:
+//   returns number of waits that timed out
+static int wakeone (char const *name, Z8LWaiter *waiter, int count)
+{
+    uint64_t totalns = 0;
+    uint64_t maxns   = 0;
+    int fails = 0;
+    int nwakes;
+    for (nwakes = 0; (nwakes < count) && ! exitflag; nwakes ++) {
+        wakereg = 0;
+        wakewaiter = waiter;
+        __atomic_store_n (&wakearmed, true, __ATOMIC_RELEASE);
+        if (! waiter->waitdev (&wakereg, 1, 0, 1000000)) {
+            fprintf (stderr, "wakeone: %s wakeup %d timed out\n", name, nwakes);
+            fails ++;
+            while (__atomic_load_n (&wakearmed, __ATOMIC_ACQUIRE)) usleep (1000);
+            continue;
+        }
+        uint64_t latns = getnowns () - __atomic_load_n (&wakesetns, __ATOMIC_ACQUIRE);
+        totalns += latns;
+        if (maxns < latns) maxns = latns;
+        while (__atomic_load_n (&wakearmed, __ATOMIC_ACQUIRE)) sched_yield ();
+    }
+
+    printf ("%s: %d wakeups, average %.1f us, max %.1f us, spinhits %llu, timeouts %llu",
+        name, nwakes, (nwakes == 0) ? 0.0 : totalns / 1000.0 / nwakes, maxns / 1000.0,
+        (unsigned long long) waiter->spinhits, (unsigned long long) waiter->timeouts);
+    if (waiter->latncount > 0) {
+        printf (", notify latency %.1f us", waiter->latnanos / 1000.0 / waiter->latncount);
+    }
+    putchar ('\n');
+    return fails;
+}
+
+// wait for main thread to be waiting, then set the register and notify
+// delays a varying amount so the main thread ends up both spinning and sleeping
+static void *wakethread (void *dummy)
+{
+    uint32_t delay = 0;
+    while (! exitflag) {
+        if (! __atomic_load_n (&wakearmed, __ATOMIC_ACQUIRE)) {
+            usleep (10);
+            continue;
+        }
+        delay = (delay + 37) % 500;
+        usleep (delay);
+        Z8LWaiter *waiter = wakewaiter;
+        __atomic_store_n (&wakesetns, getnowns (), __ATOMIC_RELEASE);
+        wakereg = 1;
+        waiter->notify ();
+        __atomic_store_n (&wakearmed, false, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
@@ -0,0 +1,468 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// Software model of the /proc/zynqpdp8l page so the z8l programs can run without the ZTurn board
+// Selected by setting envar z8lpage_sim to the name of a file, eg, /dev/shm/z8lpage
+//  the file holds the 4K register page at offset 0 and the 32K-word extmem at offset 0x20000
+//  all processes using the same file see the same registers and memory
+// One process at a time runs the model thread that does what the FPGA would:
+//  processes dma requests written to the pdp8lcmem.v registers
+//  increments the memory cycle counter as if the processor were running
+// simrkiot() and simtciot() do what the PDP would do when executing RK8JE and TC08 i/o instructions
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "z8ldefs.h"
+#include "z8lutil.h"
+
+#define SIMPAGE_EXTMEM 0x20000  // extmem offset within file
+#define SIMPAGE_SIZE   0x40000  // total file size
+
+#define SIMNSPERCYCLE 1500      // memory cycle counter rate
+
+#define SIMIDLENS 1000000       // spin this long after last dma request before sleeping
+#define SIMSLEEPUS 20           // then check this often
+
+// device directory, same order and sizes as zynq.v would give
+//  [31:16] = ident; [15:12] = (log2 nreg) - 1; [11:00] = version
+struct SimDev {
+    uint32_t index;
+    uint32_t ident;
+};
+
+#define SIM_8L 0
+#define SIM_RK 32
+#define SIM_XM 40
+#define SIM_CM 48
+#define SIM_TT 52
+#define SIM_DC 56
+#define SIM_PR 64
+#define SIM_PP 66
+#define SIM_TC 68
+#define SIM_END 70
+
+static SimDev const simdevs[] = {
+    { SIM_8L,  0x384C409C },
+    { SIM_RK,  0x524B2005 },
+    { SIM_XM,  0x584D202E },
+    { SIM_CM,  0x434D1018 },
+    { SIM_TT,  0x54541009 },
+    { SIM_DC,  0x44432002 },
+    { SIM_PR,  0x50520002 },
+    { SIM_PP,  0x50500001 },
+    { SIM_TC,  0x54430002 },
+    { SIM_END, 0xDEADBEEF }     // size code too big so findev() stops here
+};
+
+// pdp8lrk8je.v registers
+#define RK_CMD 1
+#define RK_DAD 2
+#define RK_MEM 3
+#define RK_STS 4
+#define RK_FLG 5
+
+#define F_STBUSY 4
+#define F_STRTIO 2
+#define F_ENABLE 1
+
+#define ST_CBSY  00100
+#define ST_SKIP  05677  // status bits that make DSKP skip
+
+// pdp8ltc08.v register
+#define TC_ENABLE 0x80000000
+#define TC_STATB  0x0FFF0000
+#define TC_STATB0 0x00010000
+#define TC_IOPEND 0x00008000
+#define TC_STATA  0x00000FFF
+#define TC_STATA0 0x00000001
+
+static bool simstarted;
+static pthread_mutex_t simlock = PTHREAD_MUTEX_INITIALIZER;
+
+static void siminit (int fd, char const *name);
+static void *simthread (void *nameptr);
+static void simcycle (uint32_t volatile *cmat, uint32_t volatile *extmem);
+
+// open the simulated page file, creating and initializing it if needed
+//  input:
+//   name = name of file
+//  output:
+//   returns fd that can be mmapped and locked like /proc/zynqpdp8l
+int simpageopen (char const *name)
+{
+    int fd = open (name, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        fprintf (stderr, "simpageopen: error opening %s: %m\n", name);
+        ABORT ();
+    }
+    siminit (fd, name);
+
+    // start the model thread if not already for this process
+    // it sits waiting for its turn if another process is running the model
+    pthread_mutex_lock (&simlock);
+    if (! simstarted) {
+        pthread_t tid;
+        int rc = pthread_create (&tid, NULL, simthread, strdup (name));
+        if (rc != 0) ABORT ();
+        pthread_detach (tid);
+        simstarted = true;
+    }
+    pthread_mutex_unlock (&simlock);
+
+    return fd;
+}
+
+// lock the file while initializing in case another process is also starting up
+// leave it alone if some other process already set it up
+static void siminit (int fd, char const *name)
+{
+    struct flock flockit;
+    memset (&flockit, 0, sizeof flockit);
+    flockit.l_type   = F_WRLCK;
+    flockit.l_whence = SEEK_SET;
+    flockit.l_start  = SIMPAGE_SIZE;
+    flockit.l_len    = 1;
+    if (fcntl (fd, F_SETLKW, &flockit) < 0) {
+        fprintf (stderr, "simpageopen: error locking %s: %m\n", name);
+        ABORT ();
+    }
+
+    uint32_t ident = 0;
+    int rc = pread (fd, &ident, sizeof ident, 0);
+    if ((rc != sizeof ident) || (ident != simdevs[0].ident)) {
+        if (ftruncate (fd, 0) < 0) ABORT ();
+        if (ftruncate (fd, SIMPAGE_SIZE) < 0) {
+            fprintf (stderr, "simpageopen: error extending %s: %m\n", name);
+            ABORT ();
+        }
+
+        uint32_t page[1024];
+        memset (page, 0, sizeof page);
+        for (SimDev const *sd = simdevs; sd->ident != 0xDEADBEEF; sd ++) page[sd->index] = sd->ident;
+        for (int i = SIM_END; i < 1024; i ++) page[i] = 0xDEADBEEF;
+        page[SIM_XM+1]     = XM_ENABLE | XM_ENLO4K;                 // all 32K in extmem
+        page[SIM_RK+RK_FLG] = F_ENABLE;
+        page[SIM_TT+Z_TTYKB] = KB_ENAB;
+        page[SIM_TT+Z_TTYPN] = 003;
+        page[SIM_TC+1]     = TC_ENABLE;
+        if (pwrite (fd, page, sizeof page, 0) != sizeof page) {
+            fprintf (stderr, "simpageopen: error writing %s: %m\n", name);
+            ABORT ();
+        }
+    }
+
+    flockit.l_type = F_UNLCK;
+    if (fcntl (fd, F_SETLK, &flockit) < 0) ABORT ();
+}
+
+// do what the FPGA would do
+// only one process at a time gets to do it
+static void *simthread (void *nameptr)
+{
+    char const *name = (char const *) nameptr;
+    int fd = open (name, O_RDWR);
+    if (fd < 0) {
+        fprintf (stderr, "simthread: error opening %s: %m\n", name);
+        ABORT ();
+    }
+
+    // flock() so closing other fds to the file doesn't release it like it would a fcntl() lock
+    if (flock (fd, LOCK_EX) < 0) {
+        fprintf (stderr, "simthread: error locking %s: %m\n", name);
+        ABORT ();
+    }
+
+    void *pageptr = mmap (NULL, SIMPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pageptr == MAP_FAILED) {
+        fprintf (stderr, "simthread: error mmapping %s: %m\n", name);
+        ABORT ();
+    }
+    uint32_t volatile *page   = (uint32_t volatile *) pageptr;
+    uint32_t volatile *extmem = page + SIMPAGE_EXTMEM / 4;
+    uint32_t volatile *cmat   = page + SIM_CM;
+    uint32_t volatile *pdpat  = page + SIM_8L;
+
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+    uint64_t lastns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    uint64_t busyns = lastns;
+    uint64_t cycns  = 0;
+    bool didcycle   = false;
+
+    while (true) {
+        if (cmat[1] & CM_BUSY) {
+            simcycle (cmat, extmem);
+            didcycle = true;
+            continue;
+        }
+
+        if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+        uint64_t nowns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+        // processor runs all the time
+        cycns += nowns - lastns;
+        if (cycns >= SIMNSPERCYCLE) {
+            pdpat[Z_RN] += cycns / SIMNSPERCYCLE;
+            cycns %= SIMNSPERCYCLE;
+        }
+        lastns = nowns;
+
+        // spin a while after a dma cycle in case more are coming, otherwise go easy on the cpu
+        if (didcycle) busyns = nowns;
+        didcycle = false;
+        if (nowns - busyns > SIMIDLENS) usleep (SIMSLEEPUS);
+    }
+}
+
+// process dma request as pdp8lcmem.v would
+// simpagecmwrite() has already set CM_BUSY as the controller does in the write cycle
+// ...so clear it along with setting CM_DONE when finished
+// all 32K is in extmem as if xmem enlo4k were set
+static void simcycle (uint32_t volatile *cmat, uint32_t volatile *extmem)
+{
+    uint32_t cm1 = cmat[1];
+    uint32_t cm2 = cmat[2];
+
+    uint16_t xaddr = (cm1 & CM_ADDR) / CM_ADDR0;
+    uint16_t data  = (cm1 & CM_DATA) / CM_DATA0;
+    bool wcovf = false;
+
+    // 3-cycle: increment word count and maybe current address in field 0
+    //  then access memory at the current address in the given field
+    if (cm2 & CM2_3CYCL) {
+        uint16_t wcaddr = xaddr & 07777;
+        uint16_t caaddr = (wcaddr + 1) & 07777;
+        uint16_t wc = (extmem[wcaddr] + 1) & 07777;
+        extmem[wcaddr] = wc;
+        wcovf = (wc == 0);
+        uint16_t ca = extmem[caaddr] & 07777;
+        if (cm2 & CM2_CAINC) {
+            ca = (ca + 1) & 07777;
+            extmem[caaddr] = ca;
+        }
+        xaddr = (xaddr & 070000) | ca;
+    }
+
+    if (cm1 & CM_WRITE) extmem[xaddr] = data;
+                   else data = extmem[xaddr] & 07777;
+
+    cmat[1] = (wcovf ? CM_WCOVF : 0) | CM_DONE | data * CM_DATA0 | (cm1 & (CM_WRITE | CM_ADDR));
+}
+
+// start a dma cycle
+// the real pdp8lcmem.v sets CM_BUSY in the write cycle when CM_ENAB is written
+// ...and CM_ENAB always reads back as zero
+//  input:
+//   cell = cmem register 1
+//   cm   = value being written
+void simpagecmwrite (uint32_t volatile *cell, uint32_t cm)
+{
+    if (cm & CM_ENAB) cm = (cm & ~ CM_ENAB) | CM_BUSY;
+    *cell = cm;
+}
+
+// test-and-set the cmem lock register
+// the real pdp8lcmem.v does this in the write cycle
+//  input:
+//   cell = lock register
+//   pid  = value to write
+//  output:
+//   returns value that would be read back afterward
+uint32_t simpagelock (uint32_t volatile *cell, uint32_t pid)
+{
+    uint32_t old = __sync_val_compare_and_swap (cell, 0, pid);
+    if (old == 0) return pid;
+    if (old == pid) __sync_val_compare_and_swap (cell, pid, 0);
+    return *cell;
+}
+
+// PDP executes an RK8JE i/o instruction, see pdp8lrk8je.v
+//  input:
+//   rkat = RK registers
+//   opcode = 674x i/o instruction
+//   ac = accumulator contents
+//  output:
+//   returns new accumulator contents
+//   *skip = skip next instruction
+uint16_t simrkiot (uint32_t volatile *rkat, uint16_t opcode, uint16_t ac, bool *skip)
+{
+    *skip = false;
+
+    uint32_t flg = rkat[RK_FLG];
+    if (! (flg & F_ENABLE)) return ac;
+
+    uint16_t command  = rkat[RK_CMD];
+    uint16_t diskaddr = rkat[RK_DAD];
+    uint16_t memaddr  = rkat[RK_MEM];
+    uint16_t status   = rkat[RK_STS];
+    bool stbusy = (flg & F_STBUSY) != 0;
+    uint16_t newac = ac;
+
+    switch (opcode) {
+
+        // DSKP - skip if transfer done or error
+        case 06741: {
+            *skip = (status & ST_SKIP) != 0;
+            break;
+        }
+
+        // DCLR - function in AC<01:00>
+        case 06742: {
+            switch (ac & 3) {
+                case 0: {
+                    if (stbusy) status |= ST_CBSY;
+                           else status  = 0;
+                    break;
+                }
+                case 1: {
+                    command = 0;
+                    memaddr = 0;
+                    status  = 0;
+                    flg    |= F_STRTIO | F_STBUSY;
+                    break;
+                }
+                case 2: {
+                    if (stbusy) status |= ST_CBSY;
+                    else {
+                        command  = (command & 00400) | 03000;
+                        diskaddr = 0;
+                        flg     |= F_STRTIO | F_STBUSY;
+                    }
+                    break;
+                }
+                case 3: {
+                    status = 0;
+                    flg   |= F_STRTIO;
+                    break;
+                }
+            }
+            break;
+        }
+
+        // DLAG - load disk address, clear accumulator and start function in command register
+        case 06743: {
+            if (stbusy) status |= ST_CBSY;
+            else {
+                newac    = 0;
+                diskaddr = ac;
+                status   = 0;
+                flg     |= F_STRTIO | F_STBUSY;
+            }
+            break;
+        }
+
+        // DLCA - load current memory address register from the AC
+        case 06744: {
+            if (stbusy) status |= ST_CBSY;
+            else {
+                newac   = 0;
+                memaddr = ac;
+            }
+            break;
+        }
+
+        // DRST - clear the AC and read contents of status register into the AC
+        case 06745: {
+            newac = status;
+            break;
+        }
+
+        // DLDC - load command register from the AC, clear AC and clear status register
+        case 06746: {
+            if (stbusy) status |= ST_CBSY;
+            else {
+                newac   = 0;
+                command = ac;
+                status  = 0;
+            }
+            break;
+        }
+    }
+
+    // only write what changed so as not to clobber daemon's updates
+    // write start flag last so daemon sees the other registers
+    if (command  != rkat[RK_CMD]) rkat[RK_CMD] = command;
+    if (diskaddr != rkat[RK_DAD]) rkat[RK_DAD] = diskaddr;
+    if (memaddr  != rkat[RK_MEM]) rkat[RK_MEM] = memaddr;
+    if (status   != rkat[RK_STS]) rkat[RK_STS] = status;
+    if (flg      != rkat[RK_FLG]) rkat[RK_FLG] = flg;
+    return newac;
+}
+
+// PDP executes a TC08 i/o instruction, see pdp8ltc08.v
+//  input:
+//   tcat = TC registers
+//   opcode = 676x or 677x i/o instruction
+//   ac = accumulator contents
+//  output:
+//   returns new accumulator contents
+//   *skip = skip next instruction
+uint16_t simtciot (uint32_t volatile *tcat, uint16_t opcode, uint16_t ac, bool *skip)
+{
+    *skip = false;
+
+    uint32_t tc1 = tcat[1];
+    if (! (tc1 & TC_ENABLE)) return ac;
+
+    uint16_t status_a = (tc1 & TC_STATA) / TC_STATA0;
+    uint16_t status_b = (tc1 & TC_STATB) / TC_STATB0;
+    bool     iopend   = (tc1 & TC_IOPEND) != 0;
+    uint16_t newa     = status_a;
+    uint16_t newb     = status_b;
+    uint16_t newac    = ac;
+
+    // 676x opcodes
+    if ((opcode & 07770) == 06760) {
+        if (opcode & 4) {
+            newa = ((opcode & 2) ? 0 : status_a) ^ (ac & 07774);    // maybe clear status_a, maybe start IO
+            if (! (ac & 1)) newb &= ~ 00001;                        // clear dectape flag
+            if (! (ac & 2)) newb &= ~ 07400;                        // clear error bits
+            if (newa & 00200) iopend = true;                        // wake arm up to process request if GO bit set
+            newac = 0;
+        } else if (opcode & 2) {
+            newa = 0;
+        }
+        if (opcode & 1) newac |= status_a;
+    }
+
+    // 677x opcodes
+    if ((opcode & 07770) == 06770) {
+        if (opcode & 4) {
+            newb  = (newb & ~ 00070) | (ac & 00070);                // load DMA extended address bits
+            newac = 0;
+        }
+        if (opcode & 2) newac |= status_b;
+        if (opcode & 1) *skip = (status_b & 04001) != 0;            // skip if error or success
+    }
+
+    uint32_t newtc1 = TC_ENABLE | newb * TC_STATB0 | (iopend ? TC_IOPEND : 0) | newa * TC_STATA0;
+    if (newtc1 != tc1) tcat[1] = newtc1;
+    return newac;
+}
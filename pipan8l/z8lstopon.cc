@@ -0,0 +1,342 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// match printed output against a set of stop-on patterns, see z8lstopon.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "z8lstopon.h"
+#include "z8lutil.h"
+
+#define MAXSTATES 16384
+#define HASHSIZE 32768          // power of 2 bigger than MAXSTATES
+
+struct Z8LStopOnPat {
+    int firstatom;              // index of first atom in atoms[]
+    int natoms;                 // number of atoms = number of chars matched
+    bool anchored;              // only match at beginning of line
+};
+
+static bool parseescape (uint8_t const **pp, uint32_t *set);
+static void setchar (uint32_t *set, uint8_t ch);
+
+Z8LStopOn::Z8LStopOn ()
+{
+    npatterns = 0;
+    nstates   = 0;
+    patterns  = NULL;
+    natoms    = 0;
+    atoms     = NULL;
+    trans     = NULL;
+    accepts   = NULL;
+    state     = 0;
+    nwords    = 0;
+    maxstates = 0;
+    sets      = NULL;
+    hashtbl   = NULL;
+}
+
+Z8LStopOn::~Z8LStopOn ()
+{
+    free (patterns);
+    free (atoms);
+    free (trans);
+    free (accepts);
+}
+
+// add pattern to be matched, must be followed by compile() before step()
+//  input:
+//   pattern = pattern string
+//   extended = false: plain string, all characters match themselves
+//               true: extended syntax, see z8lstopon.h
+//  output:
+//   returns NULL: added, its index is npatterns-1
+//           else: error message, must be freed
+char *Z8LStopOn::addpattern (char const *pattern, bool extended)
+{
+    char *errmsg = NULL;
+    int firstatom = natoms;
+    uint8_t const *p = (uint8_t const *) pattern;
+
+    bool anchored = extended && (*p == '^');
+    if (anchored) p ++;
+
+    for (uint8_t ch; (ch = *(p ++)) != 0;) {
+        uint32_t set[4] = { 0, 0, 0, 0 };
+        if (ch > 127) {
+            if (asprintf (&errmsg, "non-ascii character in %s", pattern) < 0) ABORT ();
+            goto reterr;
+        }
+        if (! extended) {
+            setchar (set, ch);
+        } else switch (ch) {
+            case '.': {
+                set[0] = 0xFFFFFFFEU;
+                set[1] = set[2] = set[3] = 0xFFFFFFFFU;
+                break;
+            }
+            case '$': {
+                if (*p != 0) {
+                    if (asprintf (&errmsg, "$ not at end of %s", pattern) < 0) ABORT ();
+                    goto reterr;
+                }
+                setchar (set, '\r');
+                setchar (set, '\n');
+                break;
+            }
+            case '^': {
+                if (asprintf (&errmsg, "^ not at beginning of %s", pattern) < 0) ABORT ();
+                goto reterr;
+            }
+            case '[': {
+                bool negate = (*p == '^');
+                if (negate) p ++;
+                bool first = true;
+                while (true) {
+                    ch = *(p ++);
+                    if ((ch == 0) || (ch > 127)) {
+                        if (asprintf (&errmsg, "bad character class in %s", pattern) < 0) ABORT ();
+                        goto reterr;
+                    }
+                    if ((ch == ']') && ! first) break;
+                    first = false;
+                    if (ch == '\\') {
+                        if (! parseescape (&p, set)) {
+                            if (asprintf (&errmsg, "bad escape in %s", pattern) < 0) ABORT ();
+                            goto reterr;
+                        }
+                        continue;
+                    }
+                    // a-z range unless - is last in class
+                    if ((p[0] == '-') && (p[1] != ']') && (p[1] != 0)) {
+                        uint8_t hi = p[1];
+                        if ((hi > 127) || (hi < ch)) {
+                            if (asprintf (&errmsg, "bad range in %s", pattern) < 0) ABORT ();
+                            goto reterr;
+                        }
+                        p += 2;
+                        do setchar (set, ch); while (++ ch <= hi);
+                        continue;
+                    }
+                    setchar (set, ch);
+                }
+                if (negate) {
+                    for (int i = 0; i < 4; i ++) set[i] = ~ set[i];
+                    set[0] &= 0xFFFFFFFEU;
+                }
+                break;
+            }
+            case '\\': {
+                if (! parseescape (&p, set)) {
+                    if (asprintf (&errmsg, "bad escape in %s", pattern) < 0) ABORT ();
+                    goto reterr;
+                }
+                break;
+            }
+            default: {
+                setchar (set, ch);
+                break;
+            }
+        }
+
+        atoms = (uint32_t *) realloc (atoms, (natoms + 1) * sizeof set);
+        if (atoms == NULL) ABORT ();
+        memcpy (&atoms[natoms*4], set, sizeof set);
+        natoms ++;
+    }
+
+    if (natoms == firstatom) {
+        if (asprintf (&errmsg, "empty pattern") < 0) ABORT ();
+        goto reterr;
+    }
+
+    patterns = (Z8LStopOnPat *) realloc (patterns, (npatterns + 1) * sizeof *patterns);
+    if (patterns == NULL) ABORT ();
+    patterns[npatterns].firstatom = firstatom;
+    patterns[npatterns].natoms    = natoms - firstatom;
+    patterns[npatterns].anchored  = anchored;
+    npatterns ++;
+    return NULL;
+
+reterr:;
+    natoms = firstatom;
+    return errmsg;
+}
+
+// build automaton from all patterns added so far and reset to beginning of line
+//  output:
+//   returns NULL: successful
+//           else: error message, must be freed
+//
+// automaton states are sets of atoms waiting to be matched, plus which pattern (if any) just completed
+// a character advances each waiting atom it matches to the next atom of its pattern
+// every pattern's first atom is always waiting, anchored ones only at beginning of line
+char *Z8LStopOn::compile ()
+{
+    char *errmsg = NULL;
+
+    free (trans);
+    free (accepts);
+    trans     = NULL;
+    accepts   = NULL;
+    nstates   = 0;
+    maxstates = 0;
+    sets      = NULL;
+    nwords    = natoms / 64 + 1;
+
+    int *atompats = (int *) malloc (natoms * sizeof *atompats + 1);
+    uint64_t *bols = (uint64_t *) calloc (nwords * 4, sizeof *bols);
+    hashtbl = (int *) malloc (HASHSIZE * sizeof *hashtbl);
+    if ((atompats == NULL) || (bols == NULL) || (hashtbl == NULL)) ABORT ();
+    uint64_t *mids = bols + nwords;     // atoms waiting in middle of line
+    uint64_t *cur  = mids + nwords;     // state being expanded
+    uint64_t *nxt  = cur  + nwords;     // state it goes to
+    for (int i = 0; i < HASHSIZE; i ++) hashtbl[i] = -1;
+
+    for (int p = 0; p < npatterns; p ++) {
+        int first = patterns[p].firstatom;
+        for (int i = 0; i < patterns[p].natoms; i ++) atompats[first+i] = p;
+        bols[first/64] |= 1ULL << (first % 64);
+        if (! patterns[p].anchored) mids[first/64] |= 1ULL << (first % 64);
+    }
+
+    // state 0 = beginning of line, nothing matched yet
+    findstate (bols, -1);
+
+    // expand states in the order they were created until no new ones show up
+    for (int s = 0; s < nstates; s ++) {
+        memcpy (cur, &sets[s*nwords], nwords * sizeof *cur);
+        for (int ch = 0; ch < 128; ch ++) {
+            memcpy (nxt, ((ch == '\r') || (ch == '\n')) ? bols : mids, nwords * sizeof *nxt);
+            int acc = -1;
+            for (int w = 0; w < nwords; w ++) {
+                for (uint64_t bits = cur[w]; bits != 0; bits &= bits - 1) {
+                    int a = w * 64 + __builtin_ctzll (bits);
+                    if (! (atoms[a*4+ch/32] & (1U << (ch % 32)))) continue;
+                    int p = atompats[a];
+                    if (a + 1 < patterns[p].firstatom + patterns[p].natoms) {
+                        nxt[(a+1)/64] |= 1ULL << ((a + 1) % 64);
+                    } else if ((acc < 0) || (acc > p)) {
+                        acc = p;
+                    }
+                }
+            }
+            int t = findstate (nxt, acc);
+            if (t < 0) {
+                if (asprintf (&errmsg, "patterns need more than %d states", MAXSTATES) < 0) ABORT ();
+                goto done;
+            }
+            trans[s*128+ch] = t;
+        }
+    }
+
+done:;
+    free (sets);
+    free (hashtbl);
+    free (bols);
+    free (atompats);
+    sets    = NULL;
+    hashtbl = NULL;
+    if (errmsg != NULL) {
+        free (trans);
+        free (accepts);
+        trans   = NULL;
+        accepts = NULL;
+        nstates = 0;
+    }
+    state = 0;
+    return errmsg;
+}
+
+// reset to beginning of line, nothing matched
+void Z8LStopOn::reset ()
+{
+    state = 0;
+}
+
+// number of characters matched by a pattern
+int Z8LStopOn::patlen (int index)
+{
+    return patterns[index].natoms;
+}
+
+// find state with given atom set and accepted pattern, creating it if not found
+//  returns -1 if too many states
+int Z8LStopOn::findstate (uint64_t const *set, int acc)
+{
+    uint32_t hash = 2166136261U ^ (uint32_t) acc;
+    for (int w = 0; w < nwords; w ++) {
+        hash = (hash ^ (uint32_t) set[w]) * 16777619U;
+        hash = (hash ^ (uint32_t) (set[w] >> 32)) * 16777619U;
+    }
+    uint32_t h;
+    for (h = hash; hashtbl[h%HASHSIZE] >= 0; h ++) {
+        int t = hashtbl[h%HASHSIZE];
+        if ((accepts[t] == acc) && (memcmp (&sets[t*nwords], set, nwords * sizeof *set) == 0)) return t;
+    }
+
+    if (nstates >= MAXSTATES) return -1;
+    if (nstates >= maxstates) {
+        maxstates = maxstates * 2 + 64;
+        sets    = (uint64_t *) realloc (sets, maxstates * nwords * sizeof *sets);
+        trans   = (int *) realloc (trans, maxstates * 128 * sizeof *trans);
+        accepts = (int *) realloc (accepts, maxstates * sizeof *accepts);
+        if ((sets == NULL) || (trans == NULL) || (accepts == NULL)) ABORT ();
+    }
+    int t = nstates ++;
+    memcpy (&sets[t*nwords], set, nwords * sizeof *set);
+    accepts[t] = acc;
+    hashtbl[h%HASHSIZE] = t;
+    return t;
+}
+
+// parse escape sequence after backslash, adding its character(s) to set
+static bool parseescape (uint8_t const **pp, uint32_t *set)
+{
+    uint8_t ch = *((*pp) ++);
+    switch (ch) {
+        case 0: return false;
+        case 'd': {
+            for (ch = '0'; ch <= '9'; ch ++) setchar (set, ch);
+            break;
+        }
+        case 'n': setchar (set, '\n'); break;
+        case 'r': setchar (set, '\r'); break;
+        case 's': {
+            setchar (set, ' ');
+            setchar (set, '\t');
+            break;
+        }
+        case 't': setchar (set, '\t'); break;
+        default: {
+            if (ch > 127) return false;
+            setchar (set, ch);
+            break;
+        }
+    }
+    return true;
+}
+
+static void setchar (uint32_t *set, uint8_t ch)
+{
+    set[ch/32] |= 1U << (ch % 32);
+}
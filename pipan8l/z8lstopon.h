@@ -0,0 +1,77 @@
+//    Copyright (C) Mike Rieker, Beverly, MA USA
+//    www.outerworldapps.com
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; version 2 of the License.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    EXPECT it to FAIL when someone's HeALTh or PROpeRTy is at RISk.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    http://www.gnu.org/licenses/gpl-2.0.html
+
+// match printed output against a set of stop-on patterns
+//  patterns are compiled into one automaton (aho-corasick generalized to character classes)
+//  so each printed character costs one table lookup however many patterns there are
+// pattern syntax:
+//  plain  - characters match themselves
+//  extended - ^ at beginning = match only at beginning of line (start of output or after CR or LF)
+//             $ at end = match a CR or LF
+//             .  = any character except null
+//             [abc] [a-z] [^abc] = character class
+//             \d = digit, \s = space or tab, \r \n \t, \ before anything else = that character
+//             no repetition, so every pattern matches a fixed number of characters
+// characters are 7-bit, null matches nothing so it resets matching
+
+#ifndef _Z8LSTOPON_H
+#define _Z8LSTOPON_H
+
+#include <stdint.h>
+
+struct Z8LStopOnPat;
+
+struct Z8LStopOn {
+    Z8LStopOn ();
+    ~Z8LStopOn ();
+    char *addpattern (char const *pattern, bool extended);
+    char *compile ();
+    void reset ();
+    int patlen (int index);
+
+    int npatterns;              // number of patterns added
+    int nstates;                // number of automaton states after compile()
+
+    // step automaton with next printed character
+    //  returns -1: no pattern completed
+    //        else: index of pattern completed by this character (lowest index if more than one)
+    int step (uint8_t ch)
+    {
+        state = trans[state*128+(ch&127)];
+        return accepts[state];
+    }
+
+private:
+    Z8LStopOnPat *patterns;
+    int natoms;                 // number of atoms in all patterns
+    uint32_t *atoms;            // 4 words (128-bit char set) per atom
+    int *trans;                 // [nstates*128] next state for each state and character
+    int *accepts;               // [nstates] pattern completed on entering state, -1 if none
+    int state;                  // current state
+
+    // used only while compiling
+    int findstate (uint64_t const *set, int acc);
+    int nwords;                 // words per atom set
+    int maxstates;              // states allocated
+    uint64_t *sets;             // [maxstates*nwords] atom set for each state
+    int *hashtbl;               // [HASHSIZE] state indices by hash of atom set and accept
+};
+
+#endif
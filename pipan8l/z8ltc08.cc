@@ -20,6 +20,19 @@
 
 // Performs TC08 tape I/O for the PDP-8/L Zynq I/O board
 
+// tcloadrw/-loadcow with a delta file leave the base file untouched and write changed blocks
+// to the delta file instead (see z8lcowfile.h), use z8lcowmerge to merge them back
+// files made by z8limage (see z8limgfile.h) are recognized when loaded and decompressed into memory
+// raw files are read into memory when loaded, so reads are just copies from memory
+// written blocks are stored back to the file (or image) by a write-back thread so the io thread doesn't wait for it,
+// the remaining ones are stored when the tape is unloaded
+// tape motion delays are scaled by -timescale/tctimescale, 0=instant .. 1=real TU56
+// adaptive mode uses real timing for a while after a READ ALL (as done by MAINDEC D3RA which checks timing)
+// and instant otherwise, tcstats shows emulated and actual delay per drive
+// a MOVE keeps going on its own (coasts) if the processor selects another drive, so a rewind on one drive
+// overlaps transfers on another, the coasting drive's position is computed from the time when next needed
+// udpthread reads a snapshot of drives[] without locking so status requests never wait on the io thread
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -27,6 +40,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -39,6 +53,8 @@
 #include <unistd.h>
 
 #include "tclmain.h"
+#include "z8lcowfile.h"
+#include "z8limgfile.h"
 #include "z8ldefs.h"
 #include "z8lutil.h"
 
@@ -93,6 +109,11 @@
 #define IDWC 07754      // memory word containing 2s comp dma word count
 #define IDCA 07755      // memory word containing dma address minus one
 
+#define SPINCHECKS 1000     // cycle counter checks before yielding cpu between checks
+#define YIELDCHECKS 2000    // ... then checks before sleeping a millisecond between checks, eg processor halted
+
+#define ADAPTREALNS 30000000000ULL  // adaptive timescale stays real this long after READ ALL
+
 struct Drive {
     uint32_t filesize;  // size of file in bytes
     int dtfd;           // fd of file with tape contents
@@ -102,6 +123,19 @@ struct Drive {
     char fname[160];    // name of file
 };
 
+// per-drive io thread state, not sent in status packets
+// counters and coasting state protected by lock
+struct DriveWork {
+    uint64_t emulns;            // nanoseconds of tape motion emulated at full scale
+    uint64_t waitns;            // nanoseconds actually waited
+    uint64_t requests;          // number of commands started
+    bool coasting;              // MOVE in progress while processor is using another drive
+    uint16_t coastbegpos;       // tapepos when it started coasting
+    uint16_t coastendpos;       // tapepos at end of tape it is coasting to
+    uint64_t coastbegns;        // time it started coasting
+    uint64_t coastendns;        // time it reaches end of tape
+};
+
 struct UDPPkt {
     uint64_t seq;
     uint16_t status_a;
@@ -112,21 +146,41 @@ struct UDPPkt {
 // internal TCL commands
 static Tcl_ObjCmdProc cmd_tcloadro;
 static Tcl_ObjCmdProc cmd_tcloadrw;
+static Tcl_ObjCmdProc cmd_tcstats;
+static Tcl_ObjCmdProc cmd_tctimescale;
 static Tcl_ObjCmdProc cmd_tcunload;
 
 static TclFunDef const fundefs[] = {
     { cmd_tcloadro,   "tcloadro",   "<drivenumber> <filename> - load file read-only" },
-    { cmd_tcloadrw,   "tcloadrw",   "<drivenumber> <filename> - load file read/write" },
+    { cmd_tcloadrw,   "tcloadrw",   "<drivenumber> <filename> [<deltafile>] - load file read/write" },
+    { cmd_tcstats,    "tcstats",    "<drivenumber> - get drive statistics" },
+    { cmd_tctimescale, "tctimescale", "[<scale> | adaptive] - get/set tape motion time scale" },
     { cmd_tcunload,   "tcunload",   "<drivenumber> - unload disk" },
     { NULL, NULL, NULL }
 };
 
 #define LOCKIT if (pthread_mutex_lock (&lock) != 0) ABORT ()
 #define UNLKIT if (pthread_mutex_unlock (&lock) != 0) ABORT ()
+#define WBLOCK if (pthread_mutex_lock (&wblock) != 0) ABORT ()
+#define WBUNLK if (pthread_mutex_unlock (&wblock) != 0) ABORT ()
 
 static bool startdelay;
+static bool volatile adaptive;          // real timing within ADAPTREALNS of READ ALL, else instant
+static uint32_t volatile nsperus;       // real nanoseconds per emulated tape microsecond, 1000 for real TU56 timing
+static uint64_t adaptrealns;            // adaptive mode uses real timing until this time
+static DriveWork works[MAXDRIVES];
+static uint32_t snapseq;                // odd while snapdrives being updated
+static Drive snapdrives[MAXDRIVES];     // copy of drives[] for udpthread
 static bool volatile exiting;
 static Drive drives[MAXDRIVES];
+static Z8LCowFile *cows[MAXDRIVES];     // base and delta files if loaded copy-on-write, dtfd is the delta file
+static Z8LImgFile *imgs[MAXDRIVES];     // decompressed contents of dtfd if loaded from a z8limage file
+static uint8_t *tapebufs[MAXDRIVES];    // whole tape contents, written blocks stored to file by wbthread
+static uint8_t wbdirty[MAXDRIVES][(BLOCKSPERTAPE+7)/8];  // blocks written to tapebufs but not stored to file yet
+static bool wbpend[MAXDRIVES];          // some bit is set in wbdirty[driveno]
+static bool wbbusy[MAXDRIVES];          // wbthread is storing blocks for the drive
+static pthread_cond_t wbcond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t wblock = PTHREAD_MUTEX_INITIALIZER;
 static int debug;
 static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
@@ -140,14 +194,26 @@ static Z8LPage *z8p;
 
 static int loadtape (bool readwrite, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
 static bool loadfile (Tcl_Interp *interp, bool readwrite, int driveno, char const *filenm);
-static char *lockfile (int fd, int how);
+static bool loadcow (Tcl_Interp *interp, int driveno, char const *basenm, char const *deltanm);
+static void closetape (int driveno);
+static void wbmark (int driveno, uint16_t blknum);
+static void *wbthread (void *dummy);
+static void siginthand (int signum);
+static void wbstore (int driveno, uint8_t const *tapebuf, uint8_t const *blks);
 static void *thread (void *dummy);
 static bool stepskip (Drive *drive);
 static bool stepxfer (Drive *drive);
 static void dumpbuf (Drive *drive, char const *label, uint16_t const *buff, int nwords);
 static bool dmareadoverwritesinstructions (uint16_t field, uint16_t idca, uint16_t idwc);
-static bool delayblk ();
-static bool delayloop (int usec);
+static bool delayblk (int driveno);
+static bool delayloop (int driveno, int usec);
+static bool settimescale (char const *str);
+static uint32_t getscale ();
+static void startcoast (int driveno, uint32_t usperblk);
+static void catchup (int driveno, uint64_t nowns);
+static void publish ();
+static uint64_t getnowns ();
+static bool waitcycles (uint32_t ncycles);
 static void dbgpr (int level, char const *fmt, ...);
 static bool writeformat (Tcl_Interp *interp, int fd);
 static int showstatus (int argc, char **argv);
@@ -165,6 +231,7 @@ int main (int argc, char **argv)
     for (int i = 0; i < MAXDRIVES; i ++) {
         drives[i].dtfd = -1;
     }
+    nsperus = 1000;
 
     setlinebuf (stdout);
 
@@ -176,16 +243,19 @@ int main (int argc, char **argv)
             puts ("");
             puts ("     Access TC08 controller and drives");
             puts ("");
-            puts ("  ./z8ltc08 [-killit] [-loadro/-loadrw <driveno> <file>]... | [<tclscriptfile> [<scriptargs>...]]");
+            puts ("  ./z8ltc08 [-killit] [-loadro/-loadrw <driveno> <file>]... [-loadcow <driveno> <basefile> <deltafile>]... [-timescale <scale>] | [<tclscriptfile> [<scriptargs>...]]");
             puts ("     -killit : kill other process accessing TC08 controller");
-            puts ("     -loadro/rw : load the given file in the given drive");
+            puts ("     -loadro/rw : load the given raw or z8limage file in the given drive");
+            puts ("     -loadcow : load read-only base file in the given drive, writes go to delta file");
+            puts ("     -timescale : scale tape motion times, 0=instant .. 1=real TU56, default 1");
+            puts ("                  adaptive=real after READ ALL (diagnostics), else instant");
             puts ("     <tclscriptfile> : execute script then exit");
             puts ("                else : read and process commands from stdin");
             puts ("");
-            puts ("     Use -loadro/-loadrw to statically load files in drives.");
+            puts ("     Use -loadro/-loadrw/-loadcow to statically load files in drives.");
             puts ("     Any <tclscriptfile> given is ignored.");
             puts ("");
-            puts ("     If no -loadro/rw options given, will use TCL commands to dynamically load");
+            puts ("     If no -loadro/rw/cow options given, will use TCL commands to dynamically load");
             puts ("     and unload drives.  If no <tclscriptfile> given, will read from stdin.");
             puts ("");
             puts ("  ./z8ltc08 -status [<hostname-or-ip-address-of-zturn>]");
@@ -216,6 +286,30 @@ int main (int argc, char **argv)
             i += 2;
             continue;
         }
+        if (strcasecmp (argv[i], "-loadcow") == 0) {
+            if ((i + 3 >= argc) || (argv[i+1][0] == '-') || (argv[i+2][0] == '-') || (argv[i+3][0] == '-')) {
+                fprintf (stderr, "missing drivenumber, basefile and/or deltafile for -loadcow\n");
+                return 1;
+            }
+            char *p;
+            int driveno = strtol (argv[i+1], &p, 0);
+            if ((*p != 0) || (driveno < 0) || (driveno >= MAXDRIVES)) {
+                fprintf (stderr, "drivenumber %s must be integer in range 0..%d\n", argv[i+1], MAXDRIVES - 1);
+                return 1;
+            }
+            drives[driveno].dtfd = i;
+            drives[driveno].rdonly = false;
+            loadit = true;
+            i += 3;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-timescale") == 0) {
+            if ((++ i >= argc) || ! settimescale (argv[i])) {
+                fprintf (stderr, "missing or bad -timescale, must be number 0..1 or adaptive\n");
+                return 1;
+            }
+            continue;
+        }
         if (argv[i][0] == '-') {
             fprintf (stderr, "unknown option %s\n", argv[i]);
             return 1;
@@ -250,16 +344,29 @@ int main (int argc, char **argv)
     int rc = pthread_create (&udptid, NULL, udpthread, NULL);
     if (rc != 0) ABORT ();
 
+    // spawn thread to store written blocks
+    pthread_t wbtid;
+    rc = pthread_create (&wbtid, NULL, wbthread, NULL);
+    if (rc != 0) ABORT ();
+    pthread_detach (wbtid);
+
     // if -load option, just run io calls
     if (loadit) {
         for (int driveno = 0; driveno < MAXDRIVES; driveno ++) {
             int i = drives[driveno].dtfd;
             if (i >= 0) {
                 drives[driveno].dtfd = -1;
-                if (! loadfile (NULL, ! drives[driveno].rdonly, driveno, argv[i+2])) return 1;
+                if (strcasecmp (argv[i], "-loadcow") == 0) {
+                    if (! loadcow (NULL, driveno, argv[i+2], argv[i+3])) return 1;
+                } else {
+                    if (! loadfile (NULL, ! drives[driveno].rdonly, driveno, argv[i+2])) return 1;
+                }
             }
         }
+        signal (SIGINT,  siginthand);
+        signal (SIGTERM, siginthand);
         thread (NULL);
+        for (int driveno = 0; driveno < MAXDRIVES; driveno ++) closetape (driveno);
         return 0;
     }
 
@@ -273,17 +380,23 @@ int main (int argc, char **argv)
 
     exiting = true;
     pthread_join (threadid, NULL);
+    for (int driveno = 0; driveno < MAXDRIVES; driveno ++) closetape (driveno);
 
     return rc;
 }
 
+static void siginthand (int signum)
+{
+    exiting = true;
+}
+
 // tcloadro <drivenumber> <filename>
 static int cmd_tcloadro (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
     return loadtape (false, interp, objc, objv);
 }
 
-// tcloadrw <drivenumber> <filename>
+// tcloadrw <drivenumber> <filename> [<deltafile>]
 static int cmd_tcloadrw (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
     return loadtape (true, interp, objc, objv);
@@ -295,10 +408,13 @@ static int loadtape (bool readwrite, Tcl_Interp *interp, int objc, Tcl_Obj *cons
         puts ("");
         puts ("  tcloadro <drivenumber> <filenane>");
         puts ("  tcloadrw <drivenumber> <filenane>");
+        puts ("  tcloadrw <drivenumber> <basefilenane> <deltafilename>");
+        puts ("    base file opened read-only and can be shared");
+        puts ("    written blocks go to delta file, created if it doesn't exist");
         return TCL_OK;
     }
 
-    if (objc == 3) {
+    if ((objc == 3) || (readwrite && (objc == 4))) {
         int driveno;
         int rc = Tcl_GetIntFromObj (interp, objv[1], &driveno);
         if (rc != TCL_OK) return rc;
@@ -308,10 +424,13 @@ static int loadtape (bool readwrite, Tcl_Interp *interp, int objc, Tcl_Obj *cons
         }
         char const *filenm = Tcl_GetString (objv[2]);
 
+        if (objc == 4) {
+            return loadcow (interp, driveno, filenm, Tcl_GetString (objv[3])) ? TCL_OK : TCL_ERROR;
+        }
         return loadfile (interp, readwrite, driveno, filenm) ? TCL_OK : TCL_ERROR;
     }
 
-    Tcl_SetResultF (interp, "tcloadro/tcloadrw <drivenumber> <filename>");
+    Tcl_SetResultF (interp, "tcloadro <drivenumber> <filename> / tcloadrw <drivenumber> <filename> [<deltafile>]");
     return TCL_ERROR;
 }
 
@@ -331,37 +450,242 @@ static bool loadfile (Tcl_Interp *interp, bool readwrite, int driveno, char cons
         free (lockerr);
         return false;
     }
-    long oldsize = lseek (fd, 0, SEEK_END);
-    if (readwrite && (ftruncate (fd, BLOCKSPERTAPE * BYTESPERBLOCK) < 0)) {
-        if (interp == NULL) fprintf (stderr, "error extending %s: %m\n", filenm);
-        else Tcl_SetResultF (interp, "%m");
-        close (fd);
-        return false;
+    Z8LImgFile *img = NULL;
+    if (Z8LImgFile::isimage (fd)) {
+        img = new Z8LImgFile ();
+        char *errmsg = img->open (fd, readwrite, BYTESPERBLOCK, BLOCKSPERTAPE);
+        if (errmsg != NULL) {
+            if (interp == NULL) fprintf (stderr, "error loading %s: %s\n", filenm, errmsg);
+            else Tcl_SetResultF (interp, "%s", errmsg);
+            free (errmsg);
+            delete img;
+            close (fd);
+            return false;
+        }
+    } else {
+        long oldsize = lseek (fd, 0, SEEK_END);
+        if (readwrite && (ftruncate (fd, BLOCKSPERTAPE * BYTESPERBLOCK) < 0)) {
+            if (interp == NULL) fprintf (stderr, "error extending %s: %m\n", filenm);
+            else Tcl_SetResultF (interp, "%m");
+            close (fd);
+            return false;
+        }
+        if (readwrite && (oldsize == 0) && ! writeformat (interp, fd)) {
+            close (fd);
+            return false;
+        }
     }
-    if (readwrite && (oldsize == 0) && ! writeformat (interp, fd)) {
-        close (fd);
-        return false;
+
+    // get whole tape in memory, short read-only file reads as zeroes past its end
+    uint8_t *tapebuf;
+    if (img != NULL) {
+        tapebuf = img->image;
+    } else {
+        tapebuf = (uint8_t *) calloc (BLOCKSPERTAPE, BYTESPERBLOCK);
+        if (tapebuf == NULL) ABORT ();
+        int rc = pread (fd, tapebuf, BLOCKSPERTAPE * BYTESPERBLOCK, 0);
+        if (rc < 0) {
+            if (interp == NULL) fprintf (stderr, "error reading %s: %m\n", filenm);
+            else Tcl_SetResultF (interp, "%m");
+            free (tapebuf);
+            close (fd);
+            return false;
+        }
     }
-    fprintf (stderr, "loadtape: drive %d loaded with read%s file %s\n", driveno, (readwrite ? "/write" : "-only"), filenm);
+    fprintf (stderr, "loadtape: drive %d loaded with read%s %s %s\n", driveno, (readwrite ? "/write" : "-only"), ((img == NULL) ? "file" : "image"), filenm);
     Drive *drive = &drives[driveno];
     LOCKIT;
     while (drive->locked) {
         if (pthread_cond_wait (&cond, &lock) != 0) ABORT ();
     }
-    close (drive->dtfd);
-    drive->filesize = lseek (fd, 0, SEEK_END);
+    closetape (driveno);
+    imgs[driveno]   = img;
+    WBLOCK;
+    tapebufs[driveno] = tapebuf;
+    WBUNLK;
+    drive->filesize = (img == NULL) ? lseek (fd, 0, SEEK_END) : BLOCKSPERTAPE * BYTESPERBLOCK;
     drive->dtfd     = fd;
     drive->rdonly   = ! readwrite;
     drive->tapepos  = 0;
     strncpy (drive->fname, filenm, sizeof drive->fname);
     drive->fname[sizeof drive->fname-1] = 0;
+    publish ();
     UNLKIT;
     return true;
 }
 
-// tcunload <drivenumber>
-static int cmd_tcunload (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+// load read-only base file with writes going to delta file
+static bool loadcow (Tcl_Interp *interp, int driveno, char const *basenm, char const *deltanm)
 {
+    Z8LCowFile *cow = new Z8LCowFile ();
+    char *errmsg = cow->open (basenm, deltanm, BYTESPERBLOCK, BLOCKSPERTAPE);
+    if (errmsg != NULL) {
+        if (interp == NULL) fprintf (stderr, "%s\n", errmsg);
+        else Tcl_SetResultF (interp, "%s", errmsg);
+        free (errmsg);
+        delete cow;
+        return false;
+    }
+
+    // get whole tape in memory like a raw file, wbthread copies written blocks to the delta file and flushes it
+    uint8_t *tapebuf = (uint8_t *) malloc (BLOCKSPERTAPE * BYTESPERBLOCK);
+    if (tapebuf == NULL) ABORT ();
+    for (uint32_t blknum = 0; blknum < BLOCKSPERTAPE; blknum ++) {
+        memcpy (tapebuf + blknum * BYTESPERBLOCK, cow->rdblock (blknum), BYTESPERBLOCK);
+    }
+    fprintf (stderr, "loadtape: drive %d loaded with base %s delta %s (%u blocks)\n", driveno, basenm, deltanm, cow->deltablocks ());
+    Drive *drive = &drives[driveno];
+    LOCKIT;
+    while (drive->locked) {
+        if (pthread_cond_wait (&cond, &lock) != 0) ABORT ();
+    }
+    closetape (driveno);
+    cows[driveno]   = cow;
+    WBLOCK;
+    tapebufs[driveno] = tapebuf;
+    WBUNLK;
+    drive->filesize = BLOCKSPERTAPE * BYTESPERBLOCK;
+    drive->dtfd     = cow->deltafd;
+    drive->rdonly   = false;
+    drive->tapepos  = 0;
+    strncpy (drive->fname, deltanm, sizeof drive->fname);
+    drive->fname[sizeof drive->fname-1] = 0;
+    publish ();
+    UNLKIT;
+    return true;
+}
+
+// close whatever file(s) are loaded in drive
+// caller must have lock (or be only thread)
+static void closetape (int driveno)
+{
+    // store any written blocks the write-back thread hasn't got to yet
+    uint8_t blks[(BLOCKSPERTAPE+7)/8];
+    WBLOCK;
+    while (wbbusy[driveno]) {
+        if (pthread_cond_wait (&wbcond, &wblock) != 0) ABORT ();
+    }
+    memcpy (blks, wbdirty[driveno], sizeof blks);
+    memset (wbdirty[driveno], 0, sizeof wbdirty[driveno]);
+    wbpend[driveno] = false;
+    uint8_t *tapebuf = tapebufs[driveno];
+    tapebufs[driveno] = NULL;
+    WBUNLK;
+    if (tapebuf != NULL) {
+        wbstore (driveno, tapebuf, blks);
+        if (imgs[driveno] == NULL) free (tapebuf);
+    }
+
+    if (cows[driveno] != NULL) {
+        delete cows[driveno];       // flushes and closes dtfd
+        cows[driveno] = NULL;
+    } else if (imgs[driveno] != NULL) {
+        delete imgs[driveno];       // flushes and closes dtfd
+        imgs[driveno] = NULL;
+    } else if (drives[driveno].dtfd >= 0) {
+        close (drives[driveno].dtfd);
+    }
+    drives[driveno].dtfd = -1;
+    works[driveno].coasting = false;
+}
+
+// block written to tapebufs[driveno], wake write-back thread to store it
+static void wbmark (int driveno, uint16_t blknum)
+{
+    WBLOCK;
+    wbdirty[driveno][blknum/8] |= 1U << (blknum % 8);
+    wbpend[driveno] = true;
+    if (pthread_cond_broadcast (&wbcond) != 0) ABORT ();
+    WBUNLK;
+}
+
+// store written blocks to tape files
+// blocks written again while being stored get marked again and stored on the next pass
+static void *wbthread (void *dummy)
+{
+    uint8_t blks[(BLOCKSPERTAPE+7)/8];
+
+    WBLOCK;
+    while (true) {
+        bool didsome = false;
+        for (int driveno = 0; driveno < MAXDRIVES; driveno ++) {
+            if (! wbpend[driveno] || (tapebufs[driveno] == NULL)) continue;
+            memcpy (blks, wbdirty[driveno], sizeof blks);
+            memset (wbdirty[driveno], 0, sizeof wbdirty[driveno]);
+            wbpend[driveno] = false;
+            wbbusy[driveno] = true;
+            uint8_t const *tapebuf = tapebufs[driveno];
+            WBUNLK;
+            wbstore (driveno, tapebuf, blks);
+            WBLOCK;
+            wbbusy[driveno] = false;
+            if (pthread_cond_broadcast (&wbcond) != 0) ABORT ();
+            didsome = true;
+        }
+        if (! didsome && (pthread_cond_wait (&wbcond, &wblock) != 0)) ABORT ();
+    }
+    return NULL;
+}
+
+// store the given blocks from the tape contents to the file
+// called by wbthread with wbbusy[driveno] set or by closetape() after wbthread is done with the drive
+//  input:
+//   tapebuf = tapebufs[driveno]
+//   blks    = bitmap of blocks to store
+static void wbstore (int driveno, uint8_t const *tapebuf, uint8_t const *blks)
+{
+    for (uint32_t blknum = 0; blknum < BLOCKSPERTAPE;) {
+        if (! (blks[blknum/8] & (1U << (blknum % 8)))) {
+            blknum ++;
+            continue;
+        }
+
+        // image file compresses and stores blocks itself
+        if (imgs[driveno] != NULL) {
+            imgs[driveno]->markdirty (blknum ++);
+            continue;
+        }
+
+        // copy-on-write goes to delta file slot
+        if (cows[driveno] != NULL) {
+            memcpy (cows[driveno]->wrblock (blknum), tapebuf + blknum * BYTESPERBLOCK, BYTESPERBLOCK);
+            blknum ++;
+            continue;
+        }
+
+        // raw file, write contiguous run of blocks
+        uint32_t endnum = blknum;
+        while ((endnum < BLOCKSPERTAPE) && (blks[endnum/8] & (1U << (endnum % 8)))) endnum ++;
+        uint32_t nbytes = (endnum - blknum) * BYTESPERBLOCK;
+        int rc = pwrite (drives[driveno].dtfd, tapebuf + blknum * BYTESPERBLOCK, nbytes, blknum * BYTESPERBLOCK);
+        if (rc < 0) {
+            fprintf (stderr, "wbstore: error writing tape %d file: %m\n", driveno);
+            ABORT ();
+        }
+        if (rc != (int) nbytes) {
+            fprintf (stderr, "wbstore: only wrote %d of %u bytes to tape %d file\n", rc, nbytes, driveno);
+            ABORT ();
+        }
+        DBGPR (2, "wbstore: drive %d stored blocks %04o..%04o\n", driveno, blknum, endnum - 1);
+        blknum = endnum;
+    }
+    if (imgs[driveno] != NULL) imgs[driveno]->flush ();
+    if (cows[driveno] != NULL) cows[driveno]->flush ();
+}
+
+// tcstats <drivenumber>
+static int cmd_tcstats (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if ((objc == 2) && (strcasecmp (Tcl_GetString (objv[1]), "help") == 0)) {
+        puts ("");
+        puts ("  tcstats <drivenumber> - get drive statistics as name value pairs");
+        puts ("    requests : number of commands started");
+        puts ("    emulus   : microseconds of tape motion a real TU56 would take");
+        puts ("    waitus   : microseconds actually waited, per tctimescale");
+        puts ("    coasting : 1 if rewinding while processor uses another drive");
+        return TCL_OK;
+    }
+
     if (objc == 2) {
         int driveno;
         int rc = Tcl_GetIntFromObj (interp, objv[1], &driveno);
@@ -370,45 +694,146 @@ static int cmd_tcunload (ClientData clientdata, Tcl_Interp *interp, int objc, Tc
             Tcl_SetResultF (interp, "drivenumber %d not in range 0..7", driveno);
             return TCL_ERROR;
         }
-        fprintf (stderr, "IODevRK8JE::scriptcmd: drive %d unloaded\n", driveno);
         LOCKIT;
-        close (drives[driveno].dtfd);
-        drives[driveno].dtfd = -1;
+        catchup (driveno, getnowns ());                         // rewind may have finished since last looked
+        DriveWork *work = &works[driveno];
+        Tcl_SetResultF (interp, "requests %llu emulus %llu waitus %llu coasting %d", (long long unsigned) work->requests,
+            (long long unsigned) (work->emulns / 1000), (long long unsigned) (work->waitns / 1000), work->coasting);
         UNLKIT;
         return TCL_OK;
     }
 
-    Tcl_SetResultF (interp, "tcunload <drivenumber>");
+    Tcl_SetResultF (interp, "tcstats <drivenumber>");
     return TCL_ERROR;
 }
 
-// try to lock the given file
+// tctimescale [<scale> | adaptive]
+static int cmd_tctimescale (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if ((objc == 2) && (strcasecmp (Tcl_GetString (objv[1]), "help") == 0)) {
+        puts ("");
+        puts ("  tctimescale [<scale> | adaptive] - get/set tape motion time scale");
+        puts ("    0 = instant, 1 = real TU56 timing, fractions in between");
+        puts ("    adaptive = real timing for 30 seconds after a READ ALL (eg, D3RA), else instant");
+        puts ("    returns previous scale");
+        return TCL_OK;
+    }
+
+    if (objc <= 2) {
+        if (adaptive) Tcl_SetResultF (interp, "adaptive");
+        else Tcl_SetResultF (interp, "%.3f", nsperus / 1000.0);
+        if ((objc == 2) && ! settimescale (Tcl_GetString (objv[1]))) {
+            Tcl_SetResultF (interp, "bad scale %s, must be number 0..1 or adaptive", Tcl_GetString (objv[1]));
+            return TCL_ERROR;
+        }
+        return TCL_OK;
+    }
+
+    Tcl_SetResultF (interp, "tctimescale [<scale> | adaptive]");
+    return TCL_ERROR;
+}
+
+// set time scale from string 0..1 or adaptive
+static bool settimescale (char const *str)
+{
+    if (strcasecmp (str, "adaptive") == 0) {
+        adaptive = true;
+        return true;
+    }
+    char *p;
+    double scale = strtod (str, &p);
+    if ((p == str) || (*p != 0) || ! (scale >= 0.0) || (scale > 1.0)) return false;
+    nsperus  = (uint32_t) (scale * 1000.0 + 0.5);
+    adaptive = false;
+    return true;
+}
+
+// get current real nanoseconds per emulated microsecond
+static uint32_t getscale ()
+{
+    if (adaptive) return (getnowns () < adaptrealns) ? 1000 : 0;
+    return nsperus;
+}
+
+// drive doing a MOVE is being deselected, let it keep moving to end of tape on its own
 //  input:
-//   fd = file to lock
-//   how = F_WRLCK: exclusive access
-//         F_RDLCK: shared access
-//  output:
-//   returns NULL: successful
-//           else: error message
-static char *lockfile (int fd, int how)
+//   usperblk = emulated microseconds per block it was moving at
+static void startcoast (int driveno, uint32_t usperblk)
 {
-    struct flock flockit;
-
-trylk:;
-    memset (&flockit, 0, sizeof flockit);
-    flockit.l_type   = how;
-    flockit.l_whence = SEEK_SET;
-    flockit.l_len    = 4096;
-    if (fcntl (fd, F_SETLK, &flockit) >= 0) return NULL;
-
-    char *errmsg = NULL;
-    if (((errno == EACCES) || (errno == EAGAIN)) && (fcntl (fd, F_GETLK, &flockit) >= 0)) {
-        if (flockit.l_type == F_UNLCK) goto trylk;
-        if (asprintf (&errmsg, "locked by pid %d", (int) flockit.l_pid) < 0) ABORT ();
+    Drive *drive = &drives[driveno];
+    DriveWork *work = &works[driveno];
+    LOCKIT;
+    work->coasting    = true;
+    work->coastbegpos = drive->tapepos;
+    work->coastendpos = REVERS ? 0 : BLOCKSPERTAPE*4 - 1;
+    uint32_t blkstogo = REVERS ? drive->tapepos / 4 : BLOCKSPERTAPE - drive->tapepos / 4;
+    work->coastbegns  = getnowns ();
+    work->coastendns  = work->coastbegns + (uint64_t) blkstogo * usperblk * getscale ();
+    work->emulns     += (uint64_t) blkstogo * usperblk * 1000;
+    UNLKIT;
+    DBGPR (2, "startcoast: drive %d coasting from %05o to %05o\n", driveno, work->coastbegpos, work->coastendpos);
+}
+
+// update coasting drive's position to where it would be by now
+// caller must have lock
+static void catchup (int driveno, uint64_t nowns)
+{
+    DriveWork *work = &works[driveno];
+    if (! work->coasting) return;
+    Drive *drive = &drives[driveno];
+    if (nowns >= work->coastendns) {
+        drive->tapepos = work->coastendpos;
+        work->coasting = false;
     } else {
-        if (asprintf (&errmsg, "%m") < 0) ABORT ();
+        int64_t dist = (int64_t) work->coastendpos - (int64_t) work->coastbegpos;
+        drive->tapepos = work->coastbegpos + dist * (int64_t) (nowns - work->coastbegns) / (int64_t) (work->coastendns - work->coastbegns);
     }
-    return errmsg;
+}
+
+// update snapshot of drives[] for udpthread
+// caller must have lock so there is only one writer
+// reader retries if snapseq is odd or changes while it is copying
+static void publish ()
+{
+    uint64_t nowns = getnowns ();
+    for (int driveno = 0; driveno < MAXDRIVES; driveno ++) catchup (driveno, nowns);
+    __atomic_store_n (&snapseq, snapseq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy (snapdrives, drives, sizeof snapdrives);
+    __atomic_store_n (&snapseq, snapseq + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t getnowns ()
+{
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_MONOTONIC, &nowts) < 0) ABORT ();
+    return (uint64_t) nowts.tv_sec * 1000000000 + nowts.tv_nsec;
+}
+
+// tcunload <drivenumber>
+static int cmd_tcunload (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
+{
+    if (objc == 2) {
+        int driveno;
+        int rc = Tcl_GetIntFromObj (interp, objv[1], &driveno);
+        if (rc != TCL_OK) return rc;
+        if ((driveno < 0) || (driveno > 7)) {
+            Tcl_SetResultF (interp, "drivenumber %d not in range 0..7", driveno);
+            return TCL_ERROR;
+        }
+        fprintf (stderr, "IODevRK8JE::scriptcmd: drive %d unloaded\n", driveno);
+        LOCKIT;
+        while (drives[driveno].locked) {
+            if (pthread_cond_wait (&cond, &lock) != 0) ABORT ();
+        }
+        closetape (driveno);
+        publish ();
+        UNLKIT;
+        return TCL_OK;
+    }
+
+    Tcl_SetResultF (interp, "tcunload <drivenumber>");
+    return TCL_ERROR;
 }
 
 static void *thread (void *dummy)
@@ -416,7 +841,7 @@ static void *thread (void *dummy)
     bool oldgobit = false;
 
     while (! exiting) {
-        usleep (1000);
+        z8p->waitdev (&tcat[1], TC_IOPEND, 0, 100000);
 
         // check for an I/O request pending
         uint32_t status = tcat[1];
@@ -440,10 +865,17 @@ static void *thread (void *dummy)
             Drive *drive = &drives[driveno];
 
             // prevent file from being unloaded while in here so fd doesn't get munged
+            // bring position up to date if it was coasting
             LOCKIT;
             drive->locked = true;
+            works[driveno].requests ++;
+            catchup (driveno, getnowns ());
+            works[driveno].coasting = false;
             UNLKIT;
 
+            // READ ALL means something like D3RA is checking timing, so adaptive mode goes real for a while
+            if (((status_a & 070) >> 3) == 3) adaptrealns = getnowns () + ADAPTREALNS;
+
             // select error if no tape loaded
             if (drive->dtfd < 0) {
                 status_b |= SELERR;
@@ -475,7 +907,7 @@ static void *thread (void *dummy)
                 case 0: {
 
                     // step the first one with startup delay if needed
-                    if (delayblk ()) goto finished;
+                    if (delayblk (driveno)) goto finished;
                     if (stepskip (drive)) goto endtape;
 
                     // spend at most 5 seconds to rewind tape
@@ -484,9 +916,18 @@ static void *thread (void *dummy)
                     uint32_t usperblk = (blkstogo < 200) ? 25000 : 5000000 / blkstogo;
 
                     // skip the rest of the way
+                    // if processor gives another command, let the new command take over
+                    // ...and if it is for another drive, keep this one going on its own
                     while (true) {
-                        if (delayloop (usperblk)) goto finished;
+                        if (delayloop (driveno, usperblk)) goto finished;
                         if (stepskip (drive)) goto endtape;
+                        uint32_t newstatus = tcat[1];
+                        if (newstatus & TC_IOPEND) {
+                            if (((((newstatus & TC_STATA) / TC_STATA0) >> 9) & 7) != (uint32_t) driveno) {
+                                startcoast (driveno, usperblk);
+                            }
+                            goto unlock;
+                        }
                     }
                 }
 
@@ -495,7 +936,7 @@ static void *thread (void *dummy)
                     uint32_t cm = 0;
                     do {
                         // update tape position for the search
-                        if (delayblk ()) goto finished;
+                        if (delayblk (driveno)) goto finished;
                         if (stepskip (drive)) goto endtape;
 
                         // increment word count and write new tape position to memory
@@ -513,60 +954,58 @@ static void *thread (void *dummy)
 
                 // READ DATA (2.5.1.5 p 27)
                 case 2: {
-                    uint32_t cm = 0;
+                    bool wcovf = false;
                     do {
                         // update tape position for the read
-                        if (delayblk ()) goto finished;
+                        if (delayblk (driveno)) goto finished;
                         if (stepxfer (drive)) goto endtape;
 
                         // read data from tape file
                         uint16_t buff[WORDSPERBLOCK];
-                        int rc = pread (drive->dtfd, buff, BYTESPERBLOCK, drive->tapepos / 4 * BYTESPERBLOCK);
-                        if (rc < 0) {
-                            fprintf (stderr, "thread: error reading tape %d file: %m\n", driveno);
-                            ABORT ();
-                        }
-                        if (rc != BYTESPERBLOCK) {
-                            fprintf (stderr, "thread: only read %d of %d bytes from tape %d file\n", rc, BYTESPERBLOCK, driveno);
-                            ABORT ();
-                        }
+                        memcpy (buff, tapebufs[driveno] + drive->tapepos / 4 * BYTESPERBLOCK, BYTESPERBLOCK);
                         if (debug >= 3) dumpbuf (drive, "read", buff, WORDSPERBLOCK);
 
                         DBGPR (2, "thread: read block=%04o\n", drive->tapepos / 4);
                         if (REVERS) {
+                            uint16_t revbuf[WORDSPERBLOCK];
                             for (int i = WORDSPERBLOCK; -- i >= 0;) {
                                 uint16_t ocdat = buff[i] & 07777;
                                 uint16_t data  = ocarray[ocdat];
                                 DBGPR (4, "thread:  rev memory[] = %04o = ocarray[%04o]\n", data, ocdat);
-                                cm = z8p->dmacycle (CM_ENAB | data * CM_DATA0 | CM_WRITE | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
-                                if (cm & CM_WCOVF) break;
+                                revbuf[WORDSPERBLOCK-1-i] = data;
                             }
+                            z8p->xfer3write (field | IDWC, revbuf, WORDSPERBLOCK, &wcovf);
                         } else {
                             // madness: TC08 OS/8 boot block changes from data field 0 to data field 1 mid-read
                             // so pass data s-l-o-w-l-y when booting
                             uint16_t idwc = (z8p->dmacycle (CM_ENAB | IDWC * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
                             uint16_t idca = (z8p->dmacycle (CM_ENAB | IDCA * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
                             bool slow = dmareadoverwritesinstructions (field, idca, idwc);
-                            for (int i = 0; i < WORDSPERBLOCK; i ++) {
-                                if (slow) {
-                                    cycles = pdpat[Z_RN];                   // wait for processor to run 100 cycles
-                                    delayloop (1000);                       // ... at least 33 instructions
-                                    status   = tcat[1];
-                                    status_b = (status & TC_STATB) / TC_STATB0;
-                                    field    = (status_b & 070) << 9;
-                                }
-                                if (debug >= 4) {
-                                    idwc = (z8p->dmacycle (CM_ENAB | IDWC * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
-                                    idca = (z8p->dmacycle (CM_ENAB | IDCA * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+                            if (! slow && (debug < 4)) {
+                                z8p->xfer3write (field | IDWC, buff, WORDSPERBLOCK, &wcovf);
+                            } else {
+                                for (int i = 0; i < WORDSPERBLOCK; i ++) {
+                                    if (slow) {
+                                        cycles = pdpat[Z_RN];                   // wait for processor to run 100 cycles
+                                        waitcycles (100);                       // ... at least 33 instructions
+                                        status   = tcat[1];
+                                        status_b = (status & TC_STATB) / TC_STATB0;
+                                        field    = (status_b & 070) << 9;
+                                    }
+                                    if (debug >= 4) {
+                                        idwc = (z8p->dmacycle (CM_ENAB | IDWC * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+                                        idca = (z8p->dmacycle (CM_ENAB | IDCA * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+                                    }
+                                    uint16_t data = buff[i] & 07777;
+                                    uint32_t cm = z8p->dmacycle (CM_ENAB | data * CM_DATA0 | CM_WRITE | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
+                                    DBGPR (4, "thread:  %s idwc=%04o idca=%04o memory[%o.%04o] = %04o => wcovf=%o\n",
+                                        (slow ? "slo" : "fwd"), idwc, idca, field >> 12, (idca + 1) & 07777, data, (cm / CM_WCOVF) & 1);
+                                    wcovf = (cm & CM_WCOVF) != 0;
+                                    if (wcovf) break;
                                 }
-                                uint16_t data = buff[i] & 07777;
-                                cm = z8p->dmacycle (CM_ENAB | data * CM_DATA0 | CM_WRITE | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
-                                DBGPR (4, "thread:  %s idwc=%04o idca=%04o memory[%o.%04o] = %04o => wcovf=%o\n",
-                                    (slow ? "slo" : "fwd"), idwc, idca, field >> 12, (idca + 1) & 07777, data, (cm / CM_WCOVF) & 1);
-                                if (cm & CM_WCOVF) break;
                             }
                         }
-                    } while (CONTIN && ! (cm & CM_WCOVF));
+                    } while (CONTIN && ! wcovf);
                     goto success;
                 }
 
@@ -574,9 +1013,9 @@ static void *thread (void *dummy)
                 // - runs MAINDEC D3RA test (forward and reverse)
                 //   let it run at least 2 passes over tape to get some read-all-reverses
                 case 3: {
-                    uint32_t cm = 0;
+                    bool wcovf = false;
                     do {
-                        if (delayblk ()) goto finished;
+                        if (delayblk (driveno)) goto finished;
                         if (stepxfer (drive)) goto endtape;
 
                         // read 129 data words from file
@@ -584,15 +1023,7 @@ static void *thread (void *dummy)
                         uint16_t buff[5+WORDSPERBLOCK+5];
                         uint16_t blknum = drive->tapepos / 4;
                         uint16_t *databuff = &buff[5];
-                        int rc = pread (drive->dtfd, databuff, BYTESPERBLOCK, blknum * BYTESPERBLOCK);
-                        if (rc < 0) {
-                            fprintf (stderr, "thread: error reading tape %d file: %m\n", driveno);
-                            ABORT ();
-                        }
-                        if (rc != BYTESPERBLOCK) {
-                            fprintf (stderr, "thread: only read %d of %d bytes from tape %d file\n", rc, BYTESPERBLOCK, driveno);
-                            ABORT ();
-                        }
+                        memcpy (databuff, tapebufs[driveno] + blknum * BYTESPERBLOCK, BYTESPERBLOCK);
 
                         // make up header words tacked on beginning and end of data words
                         ASSERT (blknum <= 07777);
@@ -629,34 +1060,35 @@ static void *thread (void *dummy)
                         // copy out to dma buffer
                         DBGPR (2, "thread: rall block=%04o\n", blknum);
                         if (REVERS) {
+                            uint16_t revbuf[5+WORDSPERBLOCK+5];
                             for (int i = 5 + WORDSPERBLOCK + 5; -- i >= 0;) {
                                 uint16_t ocdat = buff[i] & 07777;
                                 uint16_t data  = ocarray[ocdat];
                                 DBGPR (4, "thread:  rev memory[] = %04o = ocarray[%04o]\n", data, ocdat);
-                                cm = z8p->dmacycle (CM_ENAB | data * CM_DATA0 | CM_WRITE | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
-                                if (cm & CM_WCOVF) break;
+                                revbuf[5+WORDSPERBLOCK+5-1-i] = data;
                             }
+                            z8p->xfer3write (field | IDWC, revbuf, 5 + WORDSPERBLOCK + 5, &wcovf);
+                        } else if (debug < 4) {
+                            z8p->xfer3write (field | IDWC, buff, 5 + WORDSPERBLOCK + 5, &wcovf);
                         } else {
-                            uint16_t idwc = 0, idca = 0;
                             for (int i = 0; i < 5 + WORDSPERBLOCK + 5; i ++) {
-                                if (debug >= 4) {
-                                    idwc = (z8p->dmacycle (CM_ENAB | IDWC * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
-                                    idca = (z8p->dmacycle (CM_ENAB | IDCA * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
-                                }
+                                uint16_t idwc = (z8p->dmacycle (CM_ENAB | IDWC * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+                                uint16_t idca = (z8p->dmacycle (CM_ENAB | IDCA * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
                                 uint16_t data = buff[i] & 07777;
-                                cm = z8p->dmacycle (CM_ENAB | data * CM_DATA0 | CM_WRITE | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
+                                uint32_t cm = z8p->dmacycle (CM_ENAB | data * CM_DATA0 | CM_WRITE | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
                                 DBGPR (4, "thread:  fwd idwc=%04o idca=%04o memory[%o.%04o] = %04o => wcovf=%o\n",
                                     idwc, idca, field >> 12, (idca + 1) & 07777, data, (cm / CM_WCOVF) & 1);
-                                if (cm & CM_WCOVF) break;
+                                wcovf = (cm & CM_WCOVF) != 0;
+                                if (wcovf) break;
                             }
                         }
-                    } while (CONTIN && ! (cm & CM_WCOVF));
+                    } while (CONTIN && ! wcovf);
                     goto success;
                 }
 
                 // WRITE DATA (2.5.1.7 p 28)
                 case 4: {
-                    uint32_t cm = 0;
+                    bool wcovf = false;
                     if (drive->rdonly) {
                         DBGPR (2, "thread: write attempt on read-only drive %d\n", driveno);
                         status_b |= SELERR;
@@ -664,44 +1096,25 @@ static void *thread (void *dummy)
                     }
 
                     do {
-                        if (delayblk ()) goto finished;
+                        if (delayblk (driveno)) goto finished;
                         if (stepxfer (drive)) goto endtape;
 
                         uint16_t buff[WORDSPERBLOCK];
                         DBGPR (2, "thread: write block=%04o\n", drive->tapepos / 4);
                         if (REVERS) {
-                            for (int i = WORDSPERBLOCK; i > 0;) {
-                                cm = z8p->dmacycle (CM_ENAB | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
-                                uint16_t data = (cm & CM_DATA) / CM_DATA0;
-                                buff[--i] = ocarray[data];
-                                if (cm & CM_WCOVF) {
-                                    while (-- i >= 0) buff[i] = 07777;
-                                    break;
-                                }
-                            }
+                            uint16_t revbuf[WORDSPERBLOCK];
+                            int n = z8p->xfer3read (field | IDWC, revbuf, WORDSPERBLOCK, &wcovf);
+                            for (int i = 0; i < n; i ++) buff[WORDSPERBLOCK-1-i] = ocarray[revbuf[i]];
+                            for (int i = WORDSPERBLOCK - n; -- i >= 0;) buff[i] = 07777;
                         } else {
-                            for (int i = 0; i < WORDSPERBLOCK;) {
-                                cm = z8p->dmacycle (CM_ENAB | (field | IDWC) * CM_ADDR0, CM2_3CYCL | CM2_CAINC);
-                                uint16_t data = (cm & CM_DATA) / CM_DATA0;
-                                buff[i++] = data;
-                                if (cm & CM_WCOVF) {
-                                    memset (&buff[i], 0, (WORDSPERBLOCK - i) * 2);
-                                    break;
-                                }
-                            }
+                            int n = z8p->xfer3read (field | IDWC, buff, WORDSPERBLOCK, &wcovf);
+                            memset (&buff[n], 0, (WORDSPERBLOCK - n) * 2);
                         }
 
                         if (debug >= 3) dumpbuf (drive, "write", buff, WORDSPERBLOCK);
-                        int rc = pwrite (drive->dtfd, buff, BYTESPERBLOCK, drive->tapepos / 4 * BYTESPERBLOCK);
-                        if (rc < 0) {
-                            fprintf (stderr, "thread: error writing tape %d file: %m\n", driveno);
-                            ABORT ();
-                        }
-                        if (rc != BYTESPERBLOCK) {
-                            fprintf (stderr, "thread: only wrote %d of %d bytes to tape %d file\n", rc, BYTESPERBLOCK, driveno);
-                            ABORT ();
-                        }
-                    } while (CONTIN && ! (cm & CM_WCOVF));
+                        memcpy (tapebufs[driveno] + drive->tapepos / 4 * BYTESPERBLOCK, buff, BYTESPERBLOCK);
+                        wbmark (driveno, drive->tapepos / 4);
+                    } while (CONTIN && ! wcovf);
                     goto success;
                 }
 
@@ -726,12 +1139,14 @@ static void *thread (void *dummy)
             //  in our case, we process the next block when the processor clears DTFLAG because the tubes may take a while to clear DTFLAG
         finished:;
             DBGPR (1, "thread: done st_A=%04o st_B=%04o\n", status_a, status_b);
+            DBGPR (2, "thread: words direct %llu, dma %llu\n", (long long unsigned) z8p->xferdirect, (long long unsigned) z8p->xferdma);
             tcat[1] = (tcat[1] & ~ (07707 * TC_STATB0)) | ((status_b & 07707) * TC_STATB0);
 
             // drive can now be unloaded
         unlock:;
             LOCKIT;
             drive->locked = false;
+            publish ();
             if (pthread_cond_broadcast (&cond) != 0) ABORT ();
             UNLKIT;
         }
@@ -846,7 +1261,7 @@ static bool dmareadoverwritesinstructions (uint16_t field, uint16_t idca, uint16
 //  returns:
 //   false = it's ok to keep going as is
 //    true = something changed, re-decode
-static bool delayblk ()
+static bool delayblk (int driveno)
 {
     // 25ms standard per-block delay
     int usec = 25000;
@@ -857,7 +1272,7 @@ static bool delayblk ()
         usec += 375000;
     }
 
-    return delayloop (usec);
+    return delayloop (driveno, usec);
 }
 
 // delay the given number of microseconds, unlocking during the wait
@@ -867,23 +1282,46 @@ static bool delayblk ()
 //  output:
 //   returns true: command changed during wait
 //          false: command remained the same
-static bool delayloop (int usec)
+static bool delayloop (int driveno, int usec)
 {
-    while (! exiting) {
-
-        // wait
-        usleep (usec);
+    if (exiting) return true;
+
+    // wait, scaled by tctimescale
+    uint64_t begns = getnowns ();
+    uint64_t delns = (uint64_t) usec * getscale ();
+    if (delns > 0) {
+        struct timespec ts;
+        ts.tv_sec  = delns / 1000000000;
+        ts.tv_nsec = delns % 1000000000;
+        while ((nanosleep (&ts, &ts) < 0) && (errno == EINTR)) { }
+    }
+    uint64_t endns = getnowns ();
+    LOCKIT;
+    works[driveno].emulns += usec * 1000ULL;
+    works[driveno].waitns += endns - begns;
+    publish ();
+    UNLKIT;
 
-        // the TC08 diagnostics do the I/O instruction to start the I/O THEN write IDCA and IDWC,
-        // so make sure CPU has executed at least 100 cycles (20..30 instructions)
-        uint32_t ncycles = pdpat[Z_RN] - cycles;                // see how many cycles since I/O started
-        if (ncycles >= 100) return false;                       // if 100 cycles, assume IDCA,IDWC set up
+    // the TC08 diagnostics do the I/O instruction to start the I/O THEN write IDCA and IDWC,
+    // so make sure CPU has executed at least 100 cycles (20..30 instructions)
+    // if 100 cycles, assume IDCA,IDWC set up
+    return waitcycles (100);
+}
 
-        // not yet, wait another millisecond
-        usec = 1000;
+// wait for processor to execute the given number of memory cycles since 'cycles' was sampled
+// spins at first as it is typically only a couple hundred microseconds, then yields the cpu between checks
+// then sleeps a millisecond between checks so a halted processor doesn't pin a cpu
+// works the same whether cycles come from the real processor or the simulator
+//  output:
+//   returns true: exiting
+//          false: processor has executed that many cycles
+static bool waitcycles (uint32_t ncycles)
+{
+    for (uint32_t checks = 0; ! exiting; checks ++) {
+        if (pdpat[Z_RN] - cycles >= ncycles) return false;
+        if (checks >= SPINCHECKS + YIELDCHECKS) usleep (1000);
+        else if (checks >= SPINCHECKS) sched_yield ();
     }
-
-    // tell caller to abort if exiting
     return true;
 }
 
@@ -1329,12 +1767,15 @@ static void *udpthread (void *dummy)
             continue;
         }
 
-        LOCKIT;
         uint32_t status = tcat[1];
         udppkt.status_a = (status & TC_STATA) / TC_STATA0;
         udppkt.status_b = (status & TC_STATB) / TC_STATB0;
-        memcpy (udppkt.drives, drives, sizeof udppkt.drives);
-        UNLKIT;
+        uint32_t seq;
+        do {
+            seq = __atomic_load_n (&snapseq, __ATOMIC_ACQUIRE);
+            memcpy (udppkt.drives, snapdrives, sizeof udppkt.drives);
+            __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        } while ((seq & 1) || (__atomic_load_n (&snapseq, __ATOMIC_RELAXED) != seq));
 
         rc = sendto (udpfd, &udppkt, sizeof udppkt, 0, (sockaddr *) &client, sizeof client);
         if (rc != sizeof udppkt) {
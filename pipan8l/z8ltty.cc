@@ -19,6 +19,8 @@
 //    http://www.gnu.org/licenses/gpl-2.0.html
 
 // Performs TTY I/O for the PDP-8/L Zynq I/O board
+//  either one port connected to stdin/stdout (optionally under tcl control)
+//  or with -all, every enabled TT port and DC02 line from one process, each on its own unix socket or pty
 
 #include <errno.h>
 #include <fcntl.h>
@@ -29,20 +31,55 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "tclmain.h"
 #include "z8ldefs.h"
+#include "z8lstopon.h"
 #include "z8lutil.h"
 
-struct TTYStopOn {
-    TTYStopOn *next;
-    Tcl_Obj *strobj;
-    int hits;
-    char buff[1];
+// one port being served by -all mode
+#define MAXPORTS 16
+
+// flow mode wait for pdp to take keyboard char, printer gets checked in between
+#define FLOWPOLLUS 100
+
+// printer and punch output buffered during run, written when full, idle or run stops
+#define OUTBUFSIZE 4096
+#define OUTIDLEUS 2000          // write after nothing added for this long
+#define OUTMAXAGEUS 50000       // ... or oldest char has been waiting this long
+#define STATUSUS 100000         // update -stat counts this often
+
+struct OutBuf {
+    int fd;
+    uint32_t len;               // bytes in buf[] not yet written
+    uint64_t firstus;           // when buf[0] went in
+    uint64_t lastus;            // when buf[len-1] went in
+    uint8_t buf[OUTBUFSIZE];
+};
+
+struct TTYPort {
+    char name[8];               // "tt40", "dc3", etc, also name of socket or symlink in directory
+    char path[108];             // directory/name, same size as sockaddr_un.sun_path
+    uint32_t volatile *ttyat;   // TT registers, NULL if DC02 line
+    uint32_t volatile *dcreg;   // DC02 line register, NULL if TT port
+    int listenfd;               // listening unix socket, -1 if pty
+    int clientfd;               // connected client socket or pty master, -1 if no client
+    int slavefd;                // pty slave kept open so master doesn't see hangups
+    uint32_t kbbeg;             // kbbuf[kbbeg..kbend-1] = chars from client not yet given to pdp
+    uint32_t kbend;
+    uint64_t nextprat;          // when to look for next printer char
+    uint64_t nextkbat;          // when pdp can take next keyboard char
+    bool prblocked;             // client can't take printer char, waiting for EPOLLOUT
+    uint8_t kbbuf[256];
 };
 
 static Tcl_ObjCmdProc cmd_punch;
@@ -65,6 +102,7 @@ static uint8_t const nullbuf[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 static bool (*getprchar) (uint8_t *prchar_r);
 static bool (*putkbchar) (uint8_t kbchar);
 
+static bool flow;
 static bool nokb;
 static bool punchquiet;
 static bool punchstat;
@@ -75,22 +113,54 @@ static int punchfile = -1;
 static int readerfile = -1;
 static struct termios term_original;
 static uint32_t cps = 10;
+static uint32_t mingapus;
 static uint32_t punchbytes;
 static uint32_t readerbytes;
 static uint32_t readersize;
+static uint32_t readerbeg;
+static uint32_t readerend;
+static uint8_t const *readermap;
+static uint8_t readerbuf[4096];
+static uint32_t kbwaitmask;
+static uint32_t prwaitmask;
 static uint32_t volatile *dcreg;
+static uint32_t volatile *kbwaitreg;
+static uint32_t volatile *prwaitreg;
 static uint32_t volatile *ttyat;
+static Z8LPage *z8p;
 static uint8_t punchmask;
 static uint8_t readermask;
 
 static bool findtt (void *param, uint32_t volatile *ttyat);
-static bool stoponcheck (TTYStopOn *const stopon, char prchar);
+static bool findalltt (void *param, uint32_t volatile *ttyat);
+static bool finddc (void *param, uint32_t volatile *dcat);
+static int serveall (char const *dirname, bool usepty, bool killit);
+static bool openport (TTYPort *ttyport, char const *dirname, bool usepty, int epfd, int portidx);
+static void closeport (TTYPort *ttyport);
+static void acceptclient (TTYPort *ttyport, int epfd, int portidx);
+static void dropclient (TTYPort *ttyport, int epfd);
+static void readclient (TTYPort *ttyport, int epfd, int portidx);
+static void setclientevents (TTYPort *ttyport, int epfd, int portidx);
+static uint64_t getnowus ();
+static void sigallhand (int signum);
 static void sigrunhand (int signum);
 
 static bool dc_getprchar (uint8_t *prchar_r);
 static bool dc_putkbchar (uint8_t kbchar);
 static bool tt_getprchar (uint8_t *prchar_r);
 static bool tt_putkbchar (uint8_t kbchar);
+static bool dcgetpr (uint32_t volatile *reg, uint8_t *prchar_r);
+static bool dcputkb (uint32_t volatile *reg, uint8_t kbchar);
+static bool ttgetpr (uint32_t volatile *regs, uint8_t *prchar_r);
+static bool ttputkb (uint32_t volatile *regs, uint8_t kbchar);
+static void closereader ();
+static int getreaderbyte (uint8_t *kbbyte_r);
+static bool outbufput (OutBuf *outbuf, void const *data, uint32_t size, uint64_t nowus);
+static bool outbufidle (OutBuf *outbuf, uint64_t nowus);
+static bool outbufflush (OutBuf *outbuf, void const *data, uint32_t size);
+static bool getportpr (TTYPort *ttyport, uint8_t *prchar_r);
+static bool peekportpr (TTYPort *ttyport, uint8_t *prchar_r);
+static bool putportkb (TTYPort *ttyport, uint8_t kbchar);
 
 
 
@@ -99,6 +169,8 @@ int main (int argc, char **argv)
     bool dc02 = false;
     bool dotcl = false;
     bool killit = false;
+    bool usepty = false;
+    char const *alldir = NULL;
     int port = -1;
     int tclargs = argc;
     char *p;
@@ -107,10 +179,16 @@ int main (int argc, char **argv)
             puts ("");
             puts ("     Access TTY");
             puts ("");
-            puts ("  ./z8ltty [-cps <charspersec>] [-dc02] [-killit] [-nokb] [<octalportnumber>] [-upcase] [-tcl [<scriptfilename> [<scriptargs...>]]]");
+            puts ("  ./z8ltty [-cps <charspersec> | -flow [-mingap <usec>]] [-dc02] [-killit] [-nokb] [<octalportnumber>] [-upcase] [-tcl [<scriptfilename> [<scriptargs...>]]]");
+            puts ("  ./z8ltty -all <directory> [-cps <charspersec>] [-killit] [-pty] [-upcase]");
+            puts ("     -all    : serve every enabled TT port and all DC02 lines from this one process");
+            puts ("               each gets a unix socket in <directory> named tt03, tt40, ..., dc0..dc5");
+            puts ("     -pty    : with -all, make ptys instead of sockets, symlinked by same names");
             puts ("     -cps    : set chars per second, default 10");
             puts ("     -dc02   : <octalportnumber> is DC02 port number, 0..5, default 0");
+            puts ("     -flow   : pass characters as fast as the pdp takes and gives them instead of at -cps rate");
             puts ("     -killit : kill other process that is processing this tty port");
+            puts ("     -mingap : with -flow, minimum microseconds between characters each way, default 0");
             puts ("     -nokb   : do not pass stdin keyboard to pdp");
             puts ("     <octalportnumber> defaults to 03, other values are 40 42 44 46");
             puts ("     -tcl    : use tcl scripting");
@@ -120,9 +198,21 @@ int main (int argc, char **argv)
             puts ("     -upcase : convert all keyboard to upper case");
             puts ("");
             puts ("     Can access TTY 03 only if -entty03 given to z8lreal or using z8lsim simulator");
+            puts ("     -all skips TT ports that are not enabled, so TTY 03 only gets served in those cases");
+            puts ("     Connect to a -all socket with eg:  socat -,raw,echo=0 unix-connect:<directory>/tt40");
+            puts ("     or to a -all pty with eg:  screen <directory>/tt40");
+            puts ("     A -all port's printer output waits until a client is connected and reading it");
             puts ("");
             return 0;
         }
+        if (strcasecmp (argv[i], "-all") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing directory for -all\n");
+                return 1;
+            }
+            alldir = argv[i];
+            continue;
+        }
         if (strcasecmp (argv[i], "-cps") == 0) {
             if ((++ i >= argc) || (argv[i][0] == '-')) {
                 fprintf (stderr, "missing value for -cps\n");
@@ -133,6 +223,23 @@ int main (int argc, char **argv)
                 fprintf (stderr, "-cps value %s must be integer in range 1..1000\n", argv[i]);
                 return 1;
             }
+            flow = false;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-flow") == 0) {
+            flow = true;
+            continue;
+        }
+        if (strcasecmp (argv[i], "-mingap") == 0) {
+            if ((++ i >= argc) || (argv[i][0] == '-')) {
+                fprintf (stderr, "missing value for -mingap\n");
+                return 1;
+            }
+            mingapus = strtoul (argv[i], &p, 0);
+            if ((*p != 0) || (mingapus > 1000000)) {
+                fprintf (stderr, "-mingap value %s must be integer in range 0..1000000\n", argv[i]);
+                return 1;
+            }
             continue;
         }
         if (strcasecmp (argv[i], "-dc02") == 0) {
@@ -147,6 +254,10 @@ int main (int argc, char **argv)
             nokb = true;
             continue;
         }
+        if (strcasecmp (argv[i], "-pty") == 0) {
+            usepty = true;
+            continue;
+        }
         if (strcasecmp (argv[i], "-tcl") == 0) {
             dotcl = true;
             tclargs = i + 1;
@@ -167,29 +278,49 @@ int main (int argc, char **argv)
         }
     }
 
-    Z8LPage z8p;
+    if (alldir != NULL) {
+        if (dc02 || dotcl || flow || nokb || (port >= 0)) {
+            fprintf (stderr, "-all cannot be used with -dc02, -flow, -nokb, -tcl or a port number\n");
+            return 1;
+        }
+        z8p = new Z8LPage ();
+        return serveall (alldir, usepty, killit);
+    }
+    if (usepty) {
+        fprintf (stderr, "-pty requires -all\n");
+        return 1;
+    }
+
+    z8p = new Z8LPage ();
     if (dc02) {
         if (port < 0) port = 0;
         if (port > 5) {
             fprintf (stderr, "port number %o must be in range 0..5\n", port);
             return 1;
         }
-        uint32_t volatile *dcat = z8p.findev ("DC", NULL, NULL, false, killit);
+        uint32_t volatile *dcat = z8p->findev ("DC", NULL, NULL, false, killit);
         dcat[1]   = 0x80000000U;    // enable board to process io instructions
         dcreg     = &dcat[2+port];  // point to register for this terminal
         getprchar = dc_getprchar;   // set up get/put functions
         putkbchar = dc_putkbchar;
-        z8p.locksubdev (dcreg, 1, killit);  // make sure another one of these isn't running
+        kbwaitreg = prwaitreg = dcreg;  // kbflag clears when pdp reads kb char, prfull sets when pdp prints a char
+        kbwaitmask = 0x80000000;
+        prwaitmask = 0x20000000;
+        z8p->locksubdev (dcreg, 1, killit);  // make sure another one of these isn't running
     } else {
         if (port < 0) port = 3;
         if ((port < 1) || (port > 076)) {
             fprintf (stderr, "port number %o must be in range 1..76\n", port);
             return 1;
         }
-        ttyat = z8p.findev ("TT", findtt, &port, true, killit);
+        ttyat = z8p->findev ("TT", findtt, &port, true, killit);
         ttyat[Z_TTYKB] = KB_ENAB;   // enable board to process io instructions
         getprchar = tt_getprchar;   // set up get/put functions
         putkbchar = tt_putkbchar;
+        kbwaitreg  = &ttyat[Z_TTYKB];
+        kbwaitmask = KB_FLAG;
+        prwaitreg  = &ttyat[Z_TTYPR];
+        prwaitmask = PR_FULL;
     }
 
     int rc;
@@ -214,48 +345,22 @@ static bool findtt (void *param, uint32_t volatile *ttyat)
     return (ttyat[Z_TTYPN] & 077) == (uint32_t) port;
 }
 
-// have outgoing char, step stopon state and see if complete match has occurred
-static bool stoponcheck (TTYStopOn *const stopon, char prchar)
+// collect port numbers of all enabled TT ports
+static bool findalltt (void *param, uint32_t volatile *ttyat)
 {
-    // null doesn't match anything so reset
-    if (prchar == 0) {
-        stopon->hits = 0;
-        return false;
+    // param -> int array, [0] = number of ports found so far, [1...] = port numbers
+    int *ports = (int *) param;
+    if ((ttyat != NULL) && (ttyat[Z_TTYKB] & KB_ENAB) && (ports[0] < MAXPORTS)) {
+        ports[++ports[0]] = ttyat[Z_TTYPN] & 077;
     }
-
-    // if char matches next coming up, increment number of matching chars
-    // if reached the end, this one is completely matched
-    // if previously completely matched, prchar will mismatch on the null
-    int i = stopon->hits;
-    if (stopon->buff[i] != prchar) {
-
-        // mismatch, but maybe an earlier part is still matched
-        // eg, looking for "abcabcabd" but got "abcabcabc", we reset to 6
-        //     looking for "abcd" but got "abca", we reset to 1
-        // also has to work for case where "aaa" was completely matched last time,
-        //   if prchar is 'a', we say complete match this time, else reset to 0
-        do {
-            char *p = (char *) memrchr (stopon->buff, prchar, i);
-            if (p == NULL) {
-                i = -1;
-                break;
-            }
-            i = p - stopon->buff;
-
-            // prchar = 'c'
-            // hits = 8 in "abcabcabd"
-            //                      ^hits
-            //    i = 5 in "abcabcabd"
-            //                   ^i
-        } while (memcmp (stopon->buff, stopon->buff + stopon->hits - i, i) != 0);
-    }
-
-    // i = index where prchar matches (or -1 if not at all)
-    stopon->hits = ++ i;
-    return stopon->buff[i] == 0;
+    return false;
 }
 
-
+// DC02 is optional, just say if it was found
+static bool finddc (void *param, uint32_t volatile *dcat)
+{
+    return dcat != NULL;
+}
 
 // load file into punch
 static int cmd_punch (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
@@ -372,8 +477,7 @@ static int cmd_reader (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_
         }
 
         if (strcasecmp (subcmd, "load") == 0) {
-            close (readerfile);
-            readerfile  = -1;
+            closereader ();
             bool quiet  = false;
             char const *fn = NULL;
             readermask  = 0;
@@ -416,18 +520,24 @@ static int cmd_reader (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_
             readerfile  = fd;
             readerquiet = quiet;
             readersize  = 0;
-            if (readerstat) {
-                struct stat statbuf;
-                if ((fstat (fd, &statbuf) >= 0) && S_ISREG (statbuf.st_mode)) {
-                    readersize = statbuf.st_size;
+
+            // map regular files so run doesn't do a read() per char, others get read in chunks
+            struct stat statbuf;
+            if ((fstat (fd, &statbuf) >= 0) && S_ISREG (statbuf.st_mode)) {
+                readersize = statbuf.st_size;
+                if (readersize > 0) {
+                    void *map = mmap (NULL, readersize, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (map != MAP_FAILED) {
+                        madvise (map, readersize, MADV_SEQUENTIAL);
+                        readermap = (uint8_t const *) map;
+                    }
                 }
             }
             return TCL_OK;
         }
 
         if (strcasecmp (subcmd, "unload") == 0) {
-            close (readerfile);
-            readerfile  = -1;
+            closereader ();
             readerquiet = false;
             return TCL_OK;
         }
@@ -483,7 +593,7 @@ static int cmd_recvchar (ClientData clientdata, Tcl_Interp *interp, int objc, Tc
             break;
         }
         if (-- timeout < 0) break;
-        usleep (1000);
+        z8p->waitdev (prwaitreg, prwaitmask, 0, 1000);
     }
     return TCL_OK;
 }
@@ -495,43 +605,80 @@ static int cmd_recvchar (ClientData clientdata, Tcl_Interp *interp, int objc, Tc
 static int cmd_run (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[])
 {
     bool stdintty, stdoutty;
-    uint64_t nowus;
+    uint32_t kbgapus, prgapus, rdgapus;
+    uint32_t printedat, punchedat, readat, typed;
+    uint64_t nextstatat, nowus, startus;
+    OutBuf prbuf, pnbuf;
     uint64_t readnextkbat;
     uint64_t readnextprat;
 
+    char const *matchvar = NULL;
     int retcode = TCL_ERROR;
-    TTYStopOn *stopons = NULL;
-    TTYStopOn **laststopon = &stopons;
+    uint32_t printed = 0;
+    Z8LStopOn stopons;
+
+    if ((objc == 2) && (strcasecmp (Tcl_GetString (objv[1]), "help") == 0)) {
+        puts ("");
+        puts ("  run [-cps <charspersec> | -flow [-mingap <usec>]] [-kb] [-nokb] [-matchinfo <varname>] [-stopon <string>] [-stoponx <pattern>]");
+        printf ("    -cps = characters per second, %s %d\n", (flow ? "was" : "default"), cps);
+        printf ("    -flow = pass characters as fast as pdp takes and gives them%s\n", (flow ? ", default" : ""));
+        printf ("    -mingap = with -flow, minimum microseconds between characters, default %u\n", mingapus);
+        printf ("    -kb = enable keyboard processing%s, stop via control-\\\n", (nokb ? "" : ", default"));
+        printf ("    -nokb = disable keyboard processing%s, stop via control-C\n", (nokb ? ", default" : ""));
+        puts ("    -matchinfo <varname> = set variable to {<index> <offset>} of matching stopon, where");
+        puts ("       <index> = which -stopon or -stoponx, starting at 0, in order given");
+        puts ("       <offset> = byte offset in output printed by this run where match starts");
+        puts ("    -stopon <string> = stop when string printed");
+        puts ("    -stoponx <pattern> = stop when pattern printed, pattern can have:");
+        puts ("       ^ at beginning = only match at beginning of line");
+        puts ("       $ at end = match CR or LF");
+        puts ("       . = any char; [abc] [a-z] [^abc] = char class");
+        puts ("       \\d = digit; \\s = space or tab; \\r \\n \\t; \\<char> = that char");
+        puts ("       no repetition, so each pattern matches a fixed number of chars");
+        puts ("       -stopon and -stoponx may be given multiple times, all are matched at once");
+        puts ("");
+        puts ("  return value is matching stopon <string> or null string if stopped via control-\\ or -C");
+        puts ("");
+        return TCL_OK;
+    }
+
+    Tcl_Obj **stoponobjs = (Tcl_Obj **) malloc (objc * sizeof *stoponobjs);
+    if (stoponobjs == NULL) ABORT ();
 
     for (int i = 0; ++ i < objc;) {
         char const *arg = Tcl_GetString (objv[i]);
-        if ((objc == 2) && (strcasecmp (arg, "help") == 0)) {
-            puts ("");
-            puts ("  run [-cps <charspersec>] [-kb] [-nokb] [-stopon <string>]");
-            printf ("    -cps = characters per second, default %d\n", cps);
-            printf ("    -kb = enable keyboard processing%s, stop via control-\\\n", (nokb ? "" : ", default"));
-            printf ("    -nokb = disable keyboard processing%s, stop via control-C\n", (nokb ? ", default" : ""));
-            puts ("    -stopon <string> = stop when string printed");
-            puts ("       option may be given multiple times");
-            puts ("");
-            puts ("  return value is matching stopon <string> or null string if stopped via control-\\ or -C");
-            puts ("");
-            return TCL_OK;
-        }
-
         if (strcasecmp (arg, "-cps") == 0) {
             if ((++ i >= objc) || (Tcl_GetString (objv[i])[0] == '-')) {
                 Tcl_SetResultF (interp, "missing speed after -cps");
                 goto reterr;
             }
             int icps;
-            int rc = Tcl_GetIntFromObj (interp, objv[i], &icps);
-            if (rc != TCL_OK) return rc;
+            if (Tcl_GetIntFromObj (interp, objv[i], &icps) != TCL_OK) goto reterr;
             if ((icps < 1) || (icps > 1000)) {
                 Tcl_SetResultF (interp, "cps %d must be in range 1..1000", icps);
                 goto reterr;
             }
-            cps = icps;
+            cps  = icps;
+            flow = false;
+            continue;
+        }
+
+        if (strcasecmp (arg, "-flow") == 0) {
+            flow = true;
+            continue;
+        }
+        if (strcasecmp (arg, "-mingap") == 0) {
+            if ((++ i >= objc) || (Tcl_GetString (objv[i])[0] == '-')) {
+                Tcl_SetResultF (interp, "missing microseconds after -mingap");
+                goto reterr;
+            }
+            int igap;
+            if (Tcl_GetIntFromObj (interp, objv[i], &igap) != TCL_OK) goto reterr;
+            if ((igap < 0) || (igap > 1000000)) {
+                Tcl_SetResultF (interp, "mingap %d must be in range 0..1000000", igap);
+                goto reterr;
+            }
+            mingapus = igap;
             continue;
         }
 
@@ -544,21 +691,27 @@ static int cmd_run (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj
             continue;
         }
 
-        if (strcasecmp (arg, "-stopon") == 0) {
+        if (strcasecmp (arg, "-matchinfo") == 0) {
+            if (++ i >= objc) {
+                Tcl_SetResultF (interp, "missing variable name after -matchinfo");
+                goto reterr;
+            }
+            matchvar = Tcl_GetString (objv[i]);
+            continue;
+        }
+
+        if ((strcasecmp (arg, "-stopon") == 0) || (strcasecmp (arg, "-stoponx") == 0)) {
             if (++ i >= objc) {
-                Tcl_SetResultF (interp, "missing string after -stopon");
+                Tcl_SetResultF (interp, "missing string after %s", arg);
                 goto reterr;
             }
-            char const *str = Tcl_GetString (objv[i]);
-            int len = strlen (str);
-            TTYStopOn *stopon = (TTYStopOn *) malloc (len + sizeof *stopon);
-            if (stopon == NULL) ABORT ();
-            *laststopon = stopon;
-            laststopon = &stopon->next;
-            stopon->next = NULL;
-            stopon->strobj = objv[i];
-            stopon->hits = 0;
-            memcpy (stopon->buff, str, len + 1);
+            char *errmsg = stopons.addpattern (Tcl_GetString (objv[i]), arg[7] != 0);
+            if (errmsg != NULL) {
+                Tcl_SetResultF (interp, "%s", errmsg);
+                free (errmsg);
+                goto reterr;
+            }
+            stoponobjs[stopons.npatterns-1] = objv[i];
             continue;
         }
 
@@ -566,6 +719,16 @@ static int cmd_run (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj
         goto reterr;
     }
 
+    // build automaton for all stopons so each char printed is one step whatever number of stopons
+    if (stopons.npatterns > 0) {
+        char *errmsg = stopons.compile ();
+        if (errmsg != NULL) {
+            Tcl_SetResultF (interp, "%s", errmsg);
+            free (errmsg);
+            goto reterr;
+        }
+    }
+
     struct termios term_modified;
     stdintty = isatty (STDIN_FILENO) > 0;
     if (stdintty && ! nokb) {
@@ -587,18 +750,61 @@ static int cmd_run (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj
     if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
     nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
 
+    // timed mode paces characters at cps, reader a little slower
+    // flow mode passes them as soon as pdp takes or gives one, at least mingap apart
+    prgapus = flow ? mingapus : 1000000 / cps;
+    kbgapus = flow ? mingapus : 1000000 / cps;
+    rdgapus = flow ? mingapus : 1111111 / cps;
+
     stdoutty = isatty (STDOUT_FILENO) > 0;
-    readnextprat = nowus + 1111111 / cps;
+    prbuf.fd  = STDOUT_FILENO;
+    prbuf.len = 0;
+    pnbuf.fd  = punchfile;
+    pnbuf.len = 0;
+    printedat = printed;
+    punchedat = punchbytes;
+    readat    = readerbytes;
+    typed     = 0;
+    startus   = nowus;
+    nextstatat = nowus;
+
+    readnextprat = nowus + rdgapus;
     readnextkbat = (nokb && (readerfile < 0)) ? 0xFFFFFFFFFFFFFFFFULL : readnextprat;
 
     // keep processing until control-backslash
     // control-C is recognized only if -nokb mode
     while (! ctrlcflag) {
+
+        // in flow mode, don't give pdp another keyboard char until it has taken the last one
+        bool kbstalled = flow && (*kbwaitreg & kbwaitmask);
+
+        // wait for PDP to print something, but no longer than until next keyboard char is due
+        // stdin gets polled at least once a millisecond
+        uint64_t waitus = (readnextkbat > nowus) ? readnextkbat - nowus : ((readerfile < 0) ? 1000 : 0);
+        if (waitus > 1000) waitus = 1000;
+        if (nowus < readnextprat) {
+            if (waitus > readnextprat - nowus) waitus = readnextprat - nowus;
+            usleep (waitus);
+        } else if (kbstalled && (readerfile >= 0)) {
+            // reader char waiting for pdp to take the last one, it might print first so don't wait long
+            z8p->waitdev (kbwaitreg, kbwaitmask, kbwaitmask, FLOWPOLLUS);
+        } else if (waitus > 0) {
+            z8p->waitdev (prwaitreg, prwaitmask, 0, waitus);
+        }
         if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
         nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
-        usleep (1000 - nowus % 1000);
-        if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
-        nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
+
+        // write output that has been sitting around
+        if (! outbufidle (&prbuf, nowus)) ABORT ();
+        if (! outbufidle (&pnbuf, nowus)) {
+            fprintf (stderr, "\r\nz8ltty: error writing punch file: %m\r\n");
+            break;
+        }
+        if ((punchstat || readerstat) && (nowus >= nextstatat)) {
+            if (punchstat && (punchfile >= 0)) fprintf (stderr, "\r[%u]", punchbytes);
+            if (readerstat && (readerfile >= 0)) fprintf (stderr, "\r[%u/%u]", readerbytes, readersize);
+            nextstatat = nowus + STATUSUS;
+        }
 
         // maybe see if PDP has a character to print
         if (nowus >= readnextprat) {
@@ -608,45 +814,40 @@ static int cmd_run (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj
                 // print character to stdout
                 uint8_t prchar = prreg & 0177;
                 if (! readerquiet && ! punchquiet) {
-                    if ((prchar == 7) && stdoutty) {
-                        int rc = write (STDOUT_FILENO, "<BEL>", 5);
-                        if (rc < 5) ABORT ();
-                    } else {
-                        int rc = write (STDOUT_FILENO, &prchar, 1);
-                        if (rc <= 0) ABORT ();
-                    }
+                    bool ok = ((prchar == 7) && stdoutty) ? outbufput (&prbuf, "<BEL>", 5, nowus) : outbufput (&prbuf, &prchar, 1, nowus);
+                    if (! ok) ABORT ();
                 }
 
                 // if punchfile, write character to file
                 if (punchfile >= 0) {
                     uint8_t prbyte = prreg & punchmask;
-                    int rc = write (punchfile, &prbyte, 1);
-                    if (rc < 0) {
+                    if (! outbufput (&pnbuf, &prbyte, 1, nowus)) {
                         fprintf (stderr, "\r\nz8ltty: error writing punch file: %m\r\n");
                         break;
                     }
-                    if (rc != 1) {
-                        fprintf (stderr, "\r\nz8ltty: only wrote %d bytes of 1 to punch file\r\n", rc);
-                        break;
-                    }
-                    if (punchstat) fprintf (stderr, "\r[%u]", ++ punchbytes);
+                    punchbytes ++;
                 }
 
-                // check for another char to print after 1000000/cps usec
-                readnextprat = nowus + 1000000 / cps;
+                // check for another char to print after 1000000/cps usec (or mingap in flow mode)
+                readnextprat = nowus + prgapus;
 
                 // check stopons, stop if match
-                for (TTYStopOn *stopon = stopons; stopon != NULL; stopon = stopon->next) {
-                    if (stoponcheck (stopon, prchar)) {
-                        Tcl_IncrRefCount (stopon->strobj);
-                        Tcl_SetObjResult (interp, stopon->strobj);
+                printed ++;
+                if (stopons.npatterns > 0) {
+                    int index = stopons.step (prchar);
+                    if (index >= 0) {
+                        Tcl_SetObjResult (interp, stoponobjs[index]);
+                        if (matchvar != NULL) {
+                            Tcl_Obj *infos[2] = { Tcl_NewIntObj (index), Tcl_NewIntObj (printed - stopons.patlen (index)) };
+                            Tcl_SetVar2Ex (interp, matchvar, NULL, Tcl_NewListObj (2, infos), 0);
+                        }
                         goto stopped;
                     }
                 }
             }
         }
 
-        if (nowus >= readnextkbat) {
+        if ((nowus >= readnextkbat) && ! (flow && (*kbwaitreg & kbwaitmask))) {
 
             // chars from stdin take precedence over reader file
             // ...so user can do ctrl-\ to get back even if there is a reader file loaded
@@ -664,33 +865,39 @@ static int cmd_run (ClientData clientdata, Tcl_Interp *interp, int objc, Tcl_Obj
                 if ((kbchar == '\\' - '@') && stdintty) break;
                 if (upcase && (kbchar >= 'a') && (kbchar <= 'z')) kbchar -= 'a' - 'A';
                 putkbchar (0200 | kbchar);
-                readnextkbat = nowus + 1000000 / cps;
+                typed ++;
+                readnextkbat = nowus + kbgapus;
             } else if (readerfile >= 0) {
 
                 // stdin got nothing but there is a reader file,
                 // send next reader byte to pdp
                 uint8_t kbbyte;
-                int rc = read (readerfile, &kbbyte, 1);
+                int rc = getreaderbyte (&kbbyte);
                 if (rc < 0) {
                     fprintf (stderr, "\r\nz8ltty: error reading reader file: %m\r\n");
                     break;
                 }
                 if (rc == 0) {
+                    if (! outbufflush (&prbuf, NULL, 0)) ABORT ();
+                    if (readerstat) fprintf (stderr, "\r[%u/%u]", readerbytes, readersize);
                     fprintf (stderr, "\r\nz8ltty: reached end of reader file\r\n");
-                    close (readerfile);
-                    readerfile  = -1;
+                    closereader ();
                     readerquiet = false;
                 } else {
                     putkbchar (kbbyte | readermask);
-                    if (readerstat) fprintf (stderr, "\r[%u/%u]", ++ readerbytes, readersize);
                     // little slower for reader so pdp doesn't get overrun echoing
-                    readnextkbat = nowus + 1111111 / cps;
+                    // flow mode waits for pdp to take it instead
+                    readnextkbat = nowus + rdgapus;
                 }
             }
         }
     }
 
 stopped:;
+    if (! outbufflush (&prbuf, NULL, 0)) ABORT ();
+    if (! outbufflush (&pnbuf, NULL, 0)) {
+        fprintf (stderr, "\r\nz8ltty: error writing punch file: %m\r\n");
+    }
     if (stdintty && ! nokb) {
         tcsetattr (STDIN_FILENO, TCSADRAIN, &term_original);
         signal (SIGHUP,  SIG_DFL);
@@ -699,12 +906,23 @@ stopped:;
         signal (SIGQUIT, SIG_DFL);
     }
     fprintf (stderr, "\n");
+
+    // say how much went each way
+    if (gettimeofday (&nowtv, NULL) < 0) ABORT ();
+    nowus = nowtv.tv_sec * 1000000ULL + nowtv.tv_usec;
+    {
+        double secs = (nowus - startus) / 1000000.0;
+        uint32_t nprinted = printed - printedat;
+        uint32_t npunched = punchbytes - punchedat;
+        uint32_t nread    = readerbytes - readat;
+        if ((punchstat || readerstat) || (npunched > 0) || (nread > 0)) {
+            fprintf (stderr, "z8ltty: %.3f sec: printed %u (%.0f/sec), punched %u, reader %u (%.0f/sec), typed %u\n",
+                secs, nprinted, nprinted / secs, npunched, nread, nread / secs, typed);
+        }
+    }
     retcode = TCL_OK;
 reterr:;
-    for (TTYStopOn *stopon; (stopon = stopons) != NULL;) {
-        stopons = stopon->next;
-        free (stopon);
-    }
+    free (stoponobjs);
     return retcode;
 }
 
@@ -769,7 +987,7 @@ static int cmd_sendchar (ClientData clientdata, Tcl_Interp *interp, int objc, Tc
     int rc = 0;
     while (! ctrlcflag && ! (rc = putkbchar (character))) {
         if (-- timeout < 0) break;
-        usleep (1000);
+        z8p->waitdev (kbwaitreg, kbwaitmask, kbwaitmask, 1000);
     }
     Tcl_SetObjResult (interp, Tcl_NewIntObj (rc));
     return TCL_OK;
@@ -789,14 +1007,440 @@ static void sigrunhand (int signum)
     exit (1);
 }
 
+// serve all enabled TT ports and DC02 lines from one process
+// each port gets a unix socket (or pty) in dirname that one client at a time can attach to
+// the pdp registers have no wakeup so each port is looked at when its pacing deadline comes up,
+//  and in between we sleep in epoll_wait until the earliest deadline or until a client does something
+// a printer char is only taken from the pdp once the client has accepted it,
+//  so with no client or a client that isn't reading, the pdp waits like it would for a real teletype
+static int serveall (char const *dirname, bool usepty, bool killit)
+{
+    TTYPort ttyports[MAXPORTS];
+    int nports = 0;
+
+    // find all enabled TT ports, then lock each one
+    int ttports[1+MAXPORTS];
+    ttports[0] = 0;
+    z8p->findev ("TT", findalltt, ttports, false);
+    for (int i = 0; i < ttports[0]; i ++) {
+        int port = ttports[1+i];
+        TTYPort *ttyport = &ttyports[nports++];
+        memset (ttyport, 0, sizeof *ttyport);
+        snprintf (ttyport->name, sizeof ttyport->name, "tt%02o", port);
+        ttyport->ttyat = z8p->findev ("TT", findtt, &port, true, killit);
+        ttyport->ttyat[Z_TTYKB] = KB_ENAB;
+    }
+
+    // all six DC02 lines if there is a DC02
+    uint32_t volatile *dcat = z8p->findev ("DC", finddc, NULL, false);
+    if (dcat != NULL) {
+        dcat[1] = 0x80000000U;
+        for (int line = 0; (line < 6) && (nports < MAXPORTS); line ++) {
+            TTYPort *ttyport = &ttyports[nports++];
+            memset (ttyport, 0, sizeof *ttyport);
+            snprintf (ttyport->name, sizeof ttyport->name, "dc%d", line);
+            ttyport->dcreg = &dcat[2+line];
+            z8p->locksubdev (ttyport->dcreg, 1, killit);
+        }
+    }
+    if (nports == 0) {
+        fprintf (stderr, "z8ltty: no enabled TT ports or DC02 found\n");
+        return 1;
+    }
+
+    int epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epfd < 0) ABORT ();
+    int nopened;
+    for (nopened = 0; nopened < nports; nopened ++) {
+        if (! openport (&ttyports[nopened], dirname, usepty, epfd, nopened)) goto done;
+    }
+
+    if (signal (SIGHUP,  sigallhand) != SIG_DFL) ABORT ();
+    if (signal (SIGINT,  sigallhand) != SIG_DFL) ABORT ();
+    if (signal (SIGTERM, sigallhand) != SIG_DFL) ABORT ();
+    if (signal (SIGPIPE, SIG_IGN) != SIG_DFL) ABORT ();
+
+    fprintf (stderr, "z8ltty: serving");
+    for (int i = 0; i < nports; i ++) fprintf (stderr, " %s", ttyports[i].name);
+    fprintf (stderr, " in %s\n", dirname);
+
+    {
+        uint32_t charus = 1000000 / cps;
+        uint64_t nowus = getnowus ();
+        for (int i = 0; i < nports; i ++) {
+            ttyports[i].nextprat = nowus;
+            ttyports[i].nextkbat = nowus;
+        }
+
+        while (! ctrlcflag) {
+
+            // service ports whose deadlines have come up, and find the earliest upcoming deadline
+            nowus = getnowus ();
+            uint64_t wakeat = nowus + 1000000;
+            for (int i = 0; i < nports; i ++) {
+                TTYPort *ttyport = &ttyports[i];
+
+                // pdp gets its printer flag back once the client has the char, then we don't look for another for a char time
+                // a port with nothing printed gets looked at again one char time later
+                // a client that is full gets looked at again when epoll says it is writable
+                if (! ttyport->prblocked && (nowus >= ttyport->nextprat)) {
+                    uint8_t prchar;
+                    if ((ttyport->clientfd >= 0) && peekportpr (ttyport, &prchar)) {
+                        uint8_t outchar = prchar & 0177;
+                        int rc = write (ttyport->clientfd, &outchar, 1);
+                        if (rc > 0) {
+                            getportpr (ttyport, &prchar);
+                        } else if ((rc < 0) && (errno == EAGAIN)) {
+                            ttyport->prblocked = true;
+                            setclientevents (ttyport, epfd, i);
+                        } else if (ttyport->listenfd >= 0) {
+                            dropclient (ttyport, epfd);
+                        } else {
+                            fprintf (stderr, "z8ltty: error writing %s pty: %m\n", ttyport->name);
+                            ABORT ();
+                        }
+                    }
+                    ttyport->nextprat = nowus + charus;
+                }
+                if (! ttyport->prblocked && (wakeat > ttyport->nextprat)) wakeat = ttyport->nextprat;
+
+                // pass along next char from client if pdp has taken the last one
+                if (ttyport->kbbeg < ttyport->kbend) {
+                    if (nowus >= ttyport->nextkbat) {
+                        uint8_t kbchar = ttyport->kbbuf[ttyport->kbbeg];
+                        if (upcase && (kbchar >= 'a') && (kbchar <= 'z')) kbchar -= 'a' - 'A';
+                        if (putportkb (ttyport, 0200 | kbchar) && (++ ttyport->kbbeg == ttyport->kbend)) {
+
+                            // all taken, read more from client
+                            ttyport->kbbeg = ttyport->kbend = 0;
+                            if (ttyport->clientfd >= 0) setclientevents (ttyport, epfd, i);
+                        }
+                        ttyport->nextkbat = nowus + charus;
+                    }
+                    if ((ttyport->kbbeg < ttyport->kbend) && (wakeat > ttyport->nextkbat)) wakeat = ttyport->nextkbat;
+                }
+            }
+
+            // sleep until earliest deadline or a client connects or types something
+            struct epoll_event events[MAXPORTS*2];
+            int nevents = epoll_wait (epfd, events, MAXPORTS * 2, (wakeat - nowus + 999) / 1000);
+            if (nevents < 0) {
+                if (errno == EINTR) continue;
+                ABORT ();
+            }
+            for (int j = 0; j < nevents; j ++) {
+                int portidx = events[j].data.u32 / 2;
+                TTYPort *ttyport = &ttyports[portidx];
+                if (events[j].data.u32 & 1) {
+
+                    // client can take printer chars again, look for one right away
+                    if (ttyport->prblocked && (events[j].events & EPOLLOUT)) {
+                        ttyport->prblocked = false;
+                        ttyport->nextprat  = 0;
+                        setclientevents (ttyport, epfd, portidx);
+                    }
+                    if (events[j].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                        readclient (ttyport, epfd, portidx);
+                    }
+                } else {
+                    acceptclient (&ttyports[portidx], epfd, portidx);
+                }
+            }
+        }
+    }
+
+done:;
+    for (int i = 0; i < nopened; i ++) closeport (&ttyports[i]);
+    close (epfd);
+    if (ctrlcflag) fprintf (stderr, "\nz8ltty: terminated\n");
+    return ctrlcflag ? 0 : 1;
+}
+
+// create socket or pty for a port and add it to epoll set
+//  input:
+//   ttyport = port to open, name filled in
+//   dirname = directory to put socket or symlink to pty in
+//   usepty = false: create listening unix socket
+//             true: create pty
+//   epfd = epoll set
+//   portidx = index of ttyport in port array
+//  output:
+//   returns false: error message printed
+//            true: successful
+static bool openport (TTYPort *ttyport, char const *dirname, bool usepty, int epfd, int portidx)
+{
+    ttyport->listenfd = -1;
+    ttyport->clientfd = -1;
+    ttyport->slavefd  = -1;
+
+    struct sockaddr_un sockaddr;
+    memset (&sockaddr, 0, sizeof sockaddr);
+    sockaddr.sun_family = AF_UNIX;
+    char *path = ttyport->path;
+    if (snprintf (path, sizeof ttyport->path, "%s/%s", dirname, ttyport->name) >= (int) sizeof ttyport->path) {
+        fprintf (stderr, "z8ltty: directory name %s too long\n", dirname);
+        return false;
+    }
+    memcpy (sockaddr.sun_path, path, sizeof sockaddr.sun_path);
+
+    // remove socket or symlink left over from last time, but nothing else
+    struct stat statbuf;
+    if (lstat (path, &statbuf) >= 0) {
+        if (! S_ISSOCK (statbuf.st_mode) && ! S_ISLNK (statbuf.st_mode)) {
+            fprintf (stderr, "z8ltty: %s exists and is not a socket or symlink\n", path);
+            return false;
+        }
+        if (unlink (path) < 0) {
+            fprintf (stderr, "z8ltty: error removing old %s: %m\n", path);
+            return false;
+        }
+    }
+
+    struct epoll_event ev;
+    memset (&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+
+    if (usepty) {
+
+        // create pty, keep slave open so master never gets hangups when users come and go
+        int masterfd = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if ((masterfd < 0) || (grantpt (masterfd) < 0) || (unlockpt (masterfd) < 0)) {
+            fprintf (stderr, "z8ltty: error creating pty for %s: %m\n", ttyport->name);
+            return false;
+        }
+        ttyport->clientfd = masterfd;
+        char const *slavename = ptsname (masterfd);
+        ttyport->slavefd = open (slavename, O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (ttyport->slavefd < 0) {
+            fprintf (stderr, "z8ltty: error opening %s: %m\n", slavename);
+            return false;
+        }
+
+        // pdp does its own echoing and line endings
+        struct termios slaveterm;
+        if (tcgetattr (ttyport->slavefd, &slaveterm) < 0) ABORT ();
+        cfmakeraw (&slaveterm);
+        if (tcsetattr (ttyport->slavefd, TCSANOW, &slaveterm) < 0) ABORT ();
+        if (fcntl (masterfd, F_SETFL, O_NONBLOCK) < 0) ABORT ();
+
+        if (symlink (slavename, path) < 0) {
+            fprintf (stderr, "z8ltty: error creating symlink %s -> %s: %m\n", path, slavename);
+            return false;
+        }
+        ev.data.u32 = portidx * 2 + 1;
+        if (epoll_ctl (epfd, EPOLL_CTL_ADD, masterfd, &ev) < 0) ABORT ();
+    } else {
+
+        // create listening socket, client gets accepted when it connects
+        ttyport->listenfd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (ttyport->listenfd < 0) ABORT ();
+        if (bind (ttyport->listenfd, (struct sockaddr *) &sockaddr, sizeof sockaddr) < 0) {
+            fprintf (stderr, "z8ltty: error binding %s: %m\n", path);
+            return false;
+        }
+        if (listen (ttyport->listenfd, 1) < 0) ABORT ();
+        ev.data.u32 = portidx * 2;
+        if (epoll_ctl (epfd, EPOLL_CTL_ADD, ttyport->listenfd, &ev) < 0) ABORT ();
+    }
+    return true;
+}
+
+// close port's fds and remove its socket or symlink
+static void closeport (TTYPort *ttyport)
+{
+    if (ttyport->listenfd >= 0) close (ttyport->listenfd);
+    if (ttyport->clientfd >= 0) close (ttyport->clientfd);
+    if (ttyport->slavefd  >= 0) close (ttyport->slavefd);
+    ttyport->listenfd = -1;
+    ttyport->clientfd = -1;
+    ttyport->slavefd  = -1;
+    unlink (ttyport->path);
+}
+
+// client connecting to port's socket
+// only one client at a time, others get turned away
+static void acceptclient (TTYPort *ttyport, int epfd, int portidx)
+{
+    static char const busymsg[] = "z8ltty: port already in use\r\n";
+
+    int fd = accept4 (ttyport->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    if (ttyport->clientfd >= 0) {
+        send (fd, busymsg, sizeof busymsg - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        close (fd);
+        return;
+    }
+    ttyport->clientfd = fd;
+
+    // don't read from client until pdp has taken what's left over from previous client
+    struct epoll_event ev;
+    memset (&ev, 0, sizeof ev);
+    ev.events   = (ttyport->kbbeg < ttyport->kbend) ? 0 : EPOLLIN;
+    ev.data.u32 = portidx * 2 + 1;
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) < 0) ABORT ();
+    ttyport->nextprat = 0;
+    fprintf (stderr, "z8ltty: %s connected\n", ttyport->name);
+}
+
+// client disconnected from port's socket
+static void dropclient (TTYPort *ttyport, int epfd)
+{
+    epoll_ctl (epfd, EPOLL_CTL_DEL, ttyport->clientfd, NULL);
+    close (ttyport->clientfd);
+    ttyport->clientfd  = -1;
+    ttyport->prblocked = false;
+    ttyport->kbbeg = ttyport->kbend = 0;
+    fprintf (stderr, "z8ltty: %s disconnected\n", ttyport->name);
+}
+
+// client socket or pty has something for us
+// only polled for input when kbbuf is empty, but hangups get reported regardless so drop client then
+static void readclient (TTYPort *ttyport, int epfd, int portidx)
+{
+    if (ttyport->kbbeg < ttyport->kbend) {
+        dropclient (ttyport, epfd);
+        return;
+    }
+    int rc = read (ttyport->clientfd, ttyport->kbbuf, sizeof ttyport->kbbuf);
+    if (rc > 0) {
+
+        // stop polling client until pdp has taken all these
+        ttyport->kbbeg = 0;
+        ttyport->kbend = rc;
+        setclientevents (ttyport, epfd, portidx);
+        return;
+    }
+    if ((rc < 0) && ((errno == EAGAIN) || (errno == EINTR))) return;
+    if (ttyport->listenfd < 0) {
+        fprintf (stderr, "z8ltty: error reading %s pty: %m\n", ttyport->name);
+        ABORT ();
+    }
+    dropclient (ttyport, epfd);
+}
+
+// poll client for input only when kbbuf is empty and for output only when it was full
+static void setclientevents (TTYPort *ttyport, int epfd, int portidx)
+{
+    struct epoll_event ev;
+    memset (&ev, 0, sizeof ev);
+    if (ttyport->kbbeg >= ttyport->kbend) ev.events |= EPOLLIN;
+    if (ttyport->prblocked) ev.events |= EPOLLOUT;
+    ev.data.u32 = portidx * 2 + 1;
+    if (epoll_ctl (epfd, EPOLL_CTL_MOD, ttyport->clientfd, &ev) < 0) ABORT ();
+}
+
+static uint64_t getnowus ()
+{
+    struct timespec nowts;
+    if (clock_gettime (CLOCK_MONOTONIC, &nowts) < 0) ABORT ();
+    return nowts.tv_sec * 1000000ULL + nowts.tv_nsec / 1000;
+}
+
+static void sigallhand (int signum)
+{
+    ctrlcflag = true;
+}
+
+// unload reader file
+static void closereader ()
+{
+    if (readermap != NULL) munmap ((void *) readermap, readersize);
+    if (readerfile >= 0) close (readerfile);
+    readermap  = NULL;
+    readerfile = -1;
+    readerbeg  = 0;
+    readerend  = 0;
+}
+
+// get next reader file byte
+//  returns 1: got byte; 0: end of file; -1: read error
+static int getreaderbyte (uint8_t *kbbyte_r)
+{
+    if (readermap != NULL) {
+        if (readerbytes >= readersize) return 0;
+        *kbbyte_r = readermap[readerbytes++];
+        return 1;
+    }
+    if (readerbeg >= readerend) {
+        int rc = read (readerfile, readerbuf, sizeof readerbuf);
+        if (rc <= 0) return rc;
+        readerbeg = 0;
+        readerend = rc;
+    }
+    *kbbyte_r = readerbuf[readerbeg++];
+    readerbytes ++;
+    return 1;
+}
+
+// add output to buffer, writing it all out if it won't fit
+//  returns false: write error, errno set
+static bool outbufput (OutBuf *outbuf, void const *data, uint32_t size, uint64_t nowus)
+{
+    if (outbuf->len + size > OUTBUFSIZE) return outbufflush (outbuf, data, size);
+    if (outbuf->len == 0) outbuf->firstus = nowus;
+    memcpy (outbuf->buf + outbuf->len, data, size);
+    outbuf->len   += size;
+    outbuf->lastus = nowus;
+    return true;
+}
+
+// write buffer if nothing has been added for a while or it has been waiting long enough
+//  returns false: write error, errno set
+static bool outbufidle (OutBuf *outbuf, uint64_t nowus)
+{
+    if ((outbuf->len == 0) || ((nowus - outbuf->lastus < OUTIDLEUS) && (nowus - outbuf->firstus < OUTMAXAGEUS))) return true;
+    return outbufflush (outbuf, NULL, 0);
+}
+
+// write buffer followed by given data
+//  returns false: write error, errno set
+static bool outbufflush (OutBuf *outbuf, void const *data, uint32_t size)
+{
+    struct iovec iovs[2];
+    iovs[0].iov_base = outbuf->buf;
+    iovs[0].iov_len  = outbuf->len;
+    iovs[1].iov_base = (void *) data;
+    iovs[1].iov_len  = size;
+    struct iovec *iov = iovs;
+    int iovcnt = 2;
+    while (true) {
+        while ((iovcnt > 0) && (iov->iov_len == 0)) {
+            iov ++;
+            -- iovcnt;
+        }
+        if (iovcnt == 0) break;
+        ssize_t rc = writev (outbuf->fd, iov, iovcnt);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        for (size_t n; rc > 0; rc -= n) {
+            n = ((size_t) rc < iov->iov_len) ? rc : iov->iov_len;
+            iov->iov_base = (uint8_t *) iov->iov_base + n;
+            iov->iov_len -= n;
+            if (iov->iov_len == 0) {
+                iov ++;
+                -- iovcnt;
+            }
+        }
+    }
+    outbuf->len = 0;
+    return true;
+}
+
 // get printer character from terminal multiplexor
 
 static bool dc_getprchar (uint8_t *prchar_r)
 {
-    uint32_t prreg = *dcreg;
+    return dcgetpr (dcreg, prchar_r);
+}
+
+static bool dcgetpr (uint32_t volatile *reg, uint8_t *prchar_r)
+{
+    uint32_t prreg = *reg;
     if (! (prreg & 0x20000000)) return false;
     *prchar_r = prreg >> 12;
-    *dcreg = 0x4C000000;            // set prflag=1, prfull=0
+    *reg = 0x4C000000;              // set prflag=1, prfull=0
     return true;
 }
 
@@ -804,8 +1448,13 @@ static bool dc_getprchar (uint8_t *prchar_r)
 
 static bool dc_putkbchar (uint8_t kbchar)
 {
-    if (*dcreg & 0x80000000U) return false;
-    *dcreg = 0x91000000U | kbchar;  // set kbchar, kbflag=1
+    return dcputkb (dcreg, kbchar);
+}
+
+static bool dcputkb (uint32_t volatile *reg, uint8_t kbchar)
+{
+    if (*reg & 0x80000000U) return false;
+    *reg = 0x91000000U | kbchar;    // set kbchar, kbflag=1
     return true;
 }
 
@@ -813,10 +1462,15 @@ static bool dc_putkbchar (uint8_t kbchar)
 
 static bool tt_getprchar (uint8_t *prchar_r)
 {
-    uint32_t prreg = ttyat[Z_TTYPR];
+    return ttgetpr (ttyat, prchar_r);
+}
+
+static bool ttgetpr (uint32_t volatile *regs, uint8_t *prchar_r)
+{
+    uint32_t prreg = regs[Z_TTYPR];
     if (! (prreg & PR_FULL)) return false;
     *prchar_r = prreg;
-    ttyat[Z_TTYPR] = PR_FLAG;
+    regs[Z_TTYPR] = PR_FLAG;
     return true;
 }
 
@@ -824,7 +1478,43 @@ static bool tt_getprchar (uint8_t *prchar_r)
 
 static bool tt_putkbchar (uint8_t kbchar)
 {
-    if (ttyat[Z_TTYKB] & KB_FLAG) return false;
-    ttyat[Z_TTYKB] = KB_FLAG | KB_ENAB | kbchar;
+    return ttputkb (ttyat, kbchar);
+}
+
+static bool ttputkb (uint32_t volatile *regs, uint8_t kbchar)
+{
+    if (regs[Z_TTYKB] & KB_FLAG) return false;
+    regs[Z_TTYKB] = KB_FLAG | KB_ENAB | kbchar;
     return true;
 }
+
+// get printer character from whichever kind of port -all is serving
+
+static bool getportpr (TTYPort *ttyport, uint8_t *prchar_r)
+{
+    return (ttyport->dcreg != NULL) ? dcgetpr (ttyport->dcreg, prchar_r) : ttgetpr (ttyport->ttyat, prchar_r);
+}
+
+// see if there is a printer character without taking it, so pdp keeps waiting until client accepts it
+
+static bool peekportpr (TTYPort *ttyport, uint8_t *prchar_r)
+{
+    uint32_t prreg;
+    if (ttyport->dcreg != NULL) {
+        prreg = *ttyport->dcreg;
+        if (! (prreg & 0x20000000)) return false;
+        *prchar_r = prreg >> 12;
+    } else {
+        prreg = ttyport->ttyat[Z_TTYPR];
+        if (! (prreg & PR_FULL)) return false;
+        *prchar_r = prreg;
+    }
+    return true;
+}
+
+// put keyboard character to whichever kind of port -all is serving
+
+static bool putportkb (TTYPort *ttyport, uint8_t kbchar)
+{
+    return (ttyport->dcreg != NULL) ? dcputkb (ttyport->dcreg, kbchar) : ttputkb (ttyport->ttyat, kbchar);
+}
@@ -34,6 +34,12 @@
 
 uint32_t Z8LPage::mypid = getpid ();
 
+// set envar z8lpage_nodirect to force xfer...() to always use dma cycles
+static bool const nodirect = getenv ("z8lpage_nodirect") != NULL;
+
+// set envar z8lpage_sim to a filename to use software model instead of the FPGA, see z8lsimpage.cc
+static char const *const simname = getenv ("z8lpage_sim");
+
 Z8LPage::Z8LPage ()
 {
     extmemptr = NULL;
@@ -44,15 +50,28 @@ Z8LPage::Z8LPage ()
     xmemat = NULL;
     extmemat = NULL;
 
-    zynqfd = open ("/proc/zynqpdp8l", O_RDWR);
+    dmawords = 0;
+    dmananos = 0;
+    xferdirect = 0;
+    xferdma = 0;
+
+    waiter = &pollwaiter;
+
+    char const *pagename = "/proc/zynqpdp8l";
+    if (simname != NULL) {
+        pagename = simname;
+        zynqfd = simpageopen (simname);
+    } else {
+        zynqfd = open (pagename, O_RDWR);
+    }
     if (zynqfd < 0) {
-        fprintf (stderr, "Z8LPage::Z8LPage: error opening /proc/zynqpdp8l: %m\n");
+        fprintf (stderr, "Z8LPage::Z8LPage: error opening %s%s: %m\n", (simname != NULL) ? "sim page " : "", pagename);
         ABORT ();
     }
 
     zynqptr = mmap (NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, zynqfd, 0);
     if (zynqptr == MAP_FAILED) {
-        fprintf (stderr, "Z8LPage::Z8LPage: error mmapping /proc/zynqpdp8l: %m\n");
+        fprintf (stderr, "Z8LPage::Z8LPage: error mmapping %s%s: %m\n", (simname != NULL) ? "sim page " : "", pagename);
         ABORT ();
     }
 
@@ -113,7 +132,7 @@ uint32_t volatile *Z8LPage::extmem ()
     if (extmemptr == NULL) {
         extmemptr = mmap (NULL, 0x20000, PROT_READ | PROT_WRITE, MAP_SHARED, zynqfd, 0x20000);
         if (extmemptr == MAP_FAILED) {
-            fprintf (stderr, "Z8LPage::extmem: error mmapping /proc/zynqpdp8l: %m\n");
+            fprintf (stderr, "Z8LPage::extmem: error mmapping %s: %m\n", (simname != NULL) ? simname : "/proc/zynqpdp8l");
             ABORT ();
         }
     }
@@ -210,17 +229,30 @@ found:;
 //     cm<CM_WCOVF> = wordcount overflow in 3-cycle
 uint32_t Z8LPage::dmacycle (uint32_t cm, uint32_t cm2)
 {
-    if (cmemat == NULL) cmemat = findev ("CM", NULL, NULL, false);
-
     cmlock ();
+    cm = cmcycle (cm, cm2);
+    cmunlk ();
+    return cm;
+}
+
+// do a dma cycle with the controller already locked by the caller
+uint32_t Z8LPage::cmcycle (uint32_t cm, uint32_t cm2)
+{
     CMWAIT (! (cmemat[1] & CM_BUSY));
     cmemat[2] = (cmemat[2] & CM2_NOBRK) | cm2;
-    cmemat[1] = cm;
+    cmwrite (cm);
     CMWAIT ((cm = cmemat[1]) & CM_DONE);
-    cmunlk ();
     return cm;
 }
 
+// start a dma cycle
+// the FPGA sets CM_BUSY in the write cycle, the software model has to be told to do the same
+void Z8LPage::cmwrite (uint32_t cm)
+{
+    if (simname != NULL) simpagecmwrite (&cmemat[1], cm);
+                    else cmemat[1] = cm;
+}
+
 // make sure last write has completed
 void Z8LPage::dmaflush ()
 {
@@ -229,6 +261,332 @@ void Z8LPage::dmaflush ()
     cmunlk ();
 }
 
+// read a block of memory via dma cycles
+// locks the controller once for the whole block
+//  input:
+//   xaddr  = 15-bit starting address
+//   nwords = number of words to read
+//  output:
+//   buf = data read from memory
+//  note:
+//   address wraps within the 4K field like the RK8JE does
+void Z8LPage::dmaread (uint16_t xaddr, uint16_t *buf, int nwords)
+{
+    if (cmemat == NULL) cmemat = findev ("CM", NULL, NULL, false);
+
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+    uint64_t startns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    cmlock ();
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    cmemat[2] = cmemat[2] & CM2_NOBRK;
+    for (int i = 0; i < nwords; i ++) {
+        uint16_t addr = (xaddr & 070000) | ((xaddr + i) & 007777);
+        uint32_t cm;
+        cmwrite (CM_ENAB | addr * CM_ADDR0);
+        CMWAIT ((cm = cmemat[1]) & CM_DONE);
+        buf[i] = (cm & CM_DATA) / CM_DATA0;
+        CMWAIT (! (cmemat[1] & CM_BUSY));
+    }
+    cmunlk ();
+
+    dmacount (nwords, startns);
+}
+
+// write a block of memory via dma cycles
+// locks the controller once for the whole block
+// each word is started as soon as the previous one drops busy, without waiting for done
+//  input:
+//   xaddr  = 15-bit starting address
+//   buf    = data to write (low 12 bits of each word)
+//   nwords = number of words to write
+//  output:
+//   all writes completed
+//  note:
+//   address wraps within the 4K field like the RK8JE does
+void Z8LPage::dmawrite (uint16_t xaddr, uint16_t const *buf, int nwords)
+{
+    if (cmemat == NULL) cmemat = findev ("CM", NULL, NULL, false);
+
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+    uint64_t startns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    cmlock ();
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    cmemat[2] = cmemat[2] & CM2_NOBRK;
+    for (int i = 0; i < nwords; i ++) {
+        uint16_t addr = (xaddr & 070000) | ((xaddr + i) & 007777);
+        cmwrite (CM_ENAB | (buf[i] & 07777) * CM_DATA0 | CM_WRITE | addr * CM_ADDR0);
+        CMWAIT (! (cmemat[1] & CM_BUSY));
+    }
+    cmunlk ();
+
+    dmacount (nwords, startns);
+}
+
+// read a block of memory via 3-cycle dma
+//  input:
+//   xaddr  = 15-bit address of wordcount word (field of transfer in <14:12>)
+//   nwords = max number of words to read
+//   cm2    = CM2_CAINC or 0
+//  output:
+//   returns number of words read
+//   buf    = data read from memory
+//   *wcovf = true iff stopped because wordcount overflowed
+int Z8LPage::dma3read (uint16_t xaddr, uint16_t *buf, int nwords, uint32_t cm2, bool *wcovf)
+{
+    if (cmemat == NULL) cmemat = findev ("CM", NULL, NULL, false);
+
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+    uint64_t startns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    *wcovf = false;
+    int i;
+    cmlock ();
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    cmemat[2] = (cmemat[2] & CM2_NOBRK) | CM2_3CYCL | (cm2 & CM2_CAINC);
+    for (i = 0; i < nwords;) {
+        uint32_t cm;
+        cmwrite (CM_ENAB | xaddr * CM_ADDR0);
+        CMWAIT ((cm = cmemat[1]) & CM_DONE);
+        buf[i++] = (cm & CM_DATA) / CM_DATA0;
+        CMWAIT (! (cmemat[1] & CM_BUSY));
+        if (cm & CM_WCOVF) {
+            *wcovf = true;
+            break;
+        }
+    }
+    cmunlk ();
+
+    dmacount (i, startns);
+    return i;
+}
+
+// write a block of memory via 3-cycle dma
+//  input:
+//   xaddr  = 15-bit address of wordcount word (field of transfer in <14:12>)
+//   buf    = data to write (low 12 bits of each word)
+//   nwords = max number of words to write
+//   cm2    = CM2_CAINC or 0
+//  output:
+//   returns number of words written
+//   *wcovf = true iff stopped because wordcount overflowed
+//   all writes completed
+int Z8LPage::dma3write (uint16_t xaddr, uint16_t const *buf, int nwords, uint32_t cm2, bool *wcovf)
+{
+    if (cmemat == NULL) cmemat = findev ("CM", NULL, NULL, false);
+
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+    uint64_t startns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    *wcovf = false;
+    int i;
+    cmlock ();
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    cmemat[2] = (cmemat[2] & CM2_NOBRK) | CM2_3CYCL | (cm2 & CM2_CAINC);
+    for (i = 0; i < nwords;) {
+        uint32_t cm;
+        cmwrite (CM_ENAB | (buf[i++] & 07777) * CM_DATA0 | CM_WRITE | xaddr * CM_ADDR0);
+        CMWAIT ((cm = cmemat[1]) & CM_DONE);                    // done sets as soon as wcovf is valid
+        if (cm & CM_WCOVF) {
+            *wcovf = true;
+            break;
+        }
+        CMWAIT (! (cmemat[1] & CM_BUSY));
+    }
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    cmunlk ();
+
+    dmacount (i, startns);
+    return i;
+}
+
+// get average block dma transfer rate in words per second
+double Z8LPage::dmarate ()
+{
+    return (dmananos == 0) ? 0.0 : dmawords * 1.0e9 / dmananos;
+}
+
+// accumulate block dma statistics
+void Z8LPage::dmacount (int nwords, uint64_t startns)
+{
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+    dmananos += ts.tv_sec * 1000000000ULL + ts.tv_nsec - startns;
+    dmawords += nwords;
+}
+
+// transfer a block of memory to the caller's buffer
+// reads the FPGA's 32K RAM directly if safe, otherwise uses dma cycles
+//  input:
+//   xaddr  = 15-bit starting address
+//   nwords = number of words to read
+//  output:
+//   buf = data read from memory
+//  note:
+//   address wraps within the 4K field like the RK8JE does
+void Z8LPage::xferread (uint16_t xaddr, uint16_t *buf, int nwords)
+{
+    cmlock ();
+    bool direct = directok (xaddr >> 12);
+    if (direct) {
+        uint32_t volatile *xm = extmem ();
+        for (int i = 0; i < nwords; i ++) {
+            buf[i] = xm[(xaddr&070000)|((xaddr+i)&007777)] & 07777;
+        }
+    }
+    cmunlk ();
+
+    if (direct) {
+        xferdirect += nwords;
+    } else {
+        dmaread (xaddr, buf, nwords);
+        xferdma += nwords;
+    }
+}
+
+// transfer a block of memory from the caller's buffer
+// writes the FPGA's 32K RAM directly if safe, otherwise uses dma cycles
+//  input:
+//   xaddr  = 15-bit starting address
+//   buf    = data to write (low 12 bits of each word)
+//   nwords = number of words to write
+//  note:
+//   address wraps within the 4K field like the RK8JE does
+void Z8LPage::xferwrite (uint16_t xaddr, uint16_t const *buf, int nwords)
+{
+    cmlock ();
+    bool direct = directok (xaddr >> 12);
+    if (direct) {
+        uint32_t volatile *xm = extmem ();
+        for (int i = 0; i < nwords; i ++) {
+            xm[(xaddr&070000)|((xaddr+i)&007777)] = buf[i] & 07777;
+        }
+    }
+    cmunlk ();
+
+    if (direct) {
+        xferdirect += nwords;
+    } else {
+        dmawrite (xaddr, buf, nwords);
+        xferdma += nwords;
+    }
+}
+
+// transfer a block of memory to the caller's buffer like a 3-cycle dma with CA increment
+// if the data field is directly accessible, the wordcount and current address words are
+// ...updated with single-cycle dma and the data is read directly from the FPGA's 32K RAM
+//  input:
+//   xaddr  = 15-bit address of wordcount word (field of transfer in <14:12>)
+//   nwords = max number of words to read
+//  output:
+//   returns number of words read
+//   buf    = data read from memory
+//   *wcovf = true iff stopped because wordcount overflowed
+int Z8LPage::xfer3read (uint16_t xaddr, uint16_t *buf, int nwords, bool *wcovf)
+{
+    cmlock ();
+    if (! directok (xaddr >> 12)) {
+        cmunlk ();
+        int n = dma3read (xaddr, buf, nwords, CM2_CAINC, wcovf);
+        xferdma += n;
+        return n;
+    }
+
+    // wordcount and current address are always in field 0
+    uint16_t wcaddr = xaddr & 07777;
+    uint16_t caaddr = (wcaddr + 1) & 07777;
+    uint16_t wc = (cmcycle (CM_ENAB | wcaddr * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+    uint16_t ca = (cmcycle (CM_ENAB | caaddr * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+
+    // wordcount overflows when it increments to zero
+    int n = 010000 - wc;
+    *wcovf = (n <= nwords);
+    if (! *wcovf) n = nwords;
+
+    uint32_t volatile *xm = extmem ();
+    for (int i = 0; i < n; i ++) {
+        buf[i] = xm[(xaddr&070000)|((ca+1+i)&007777)] & 07777;
+    }
+
+    cmcycle (CM_ENAB | ((wc + n) & 07777) * CM_DATA0 | CM_WRITE | wcaddr * CM_ADDR0, 0);
+    cmcycle (CM_ENAB | ((ca + n) & 07777) * CM_DATA0 | CM_WRITE | caaddr * CM_ADDR0, 0);
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    cmunlk ();
+
+    xferdirect += n;
+    return n;
+}
+
+// transfer a block of memory from the caller's buffer like a 3-cycle dma with CA increment
+// if the data field is directly accessible, the wordcount and current address words are
+// ...updated with single-cycle dma and the data is written directly to the FPGA's 32K RAM
+//  input:
+//   xaddr  = 15-bit address of wordcount word (field of transfer in <14:12>)
+//   buf    = data to write (low 12 bits of each word)
+//   nwords = max number of words to write
+//  output:
+//   returns number of words written
+//   *wcovf = true iff stopped because wordcount overflowed
+int Z8LPage::xfer3write (uint16_t xaddr, uint16_t const *buf, int nwords, bool *wcovf)
+{
+    cmlock ();
+    if (! directok (xaddr >> 12)) {
+        cmunlk ();
+        int n = dma3write (xaddr, buf, nwords, CM2_CAINC, wcovf);
+        xferdma += n;
+        return n;
+    }
+
+    // wordcount and current address are always in field 0
+    uint16_t wcaddr = xaddr & 07777;
+    uint16_t caaddr = (wcaddr + 1) & 07777;
+    uint16_t wc = (cmcycle (CM_ENAB | wcaddr * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+    uint16_t ca = (cmcycle (CM_ENAB | caaddr * CM_ADDR0, 0) & CM_DATA) / CM_DATA0;
+
+    // wordcount overflows when it increments to zero
+    int n = 010000 - wc;
+    *wcovf = (n <= nwords);
+    if (! *wcovf) n = nwords;
+
+    uint32_t volatile *xm = extmem ();
+    for (int i = 0; i < n; i ++) {
+        xm[(xaddr&070000)|((ca+1+i)&007777)] = buf[i] & 07777;
+    }
+
+    cmcycle (CM_ENAB | ((wc + n) & 07777) * CM_DATA0 | CM_WRITE | wcaddr * CM_ADDR0, 0);
+    cmcycle (CM_ENAB | ((ca + n) & 07777) * CM_DATA0 | CM_WRITE | caaddr * CM_ADDR0, 0);
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    cmunlk ();
+
+    xferdirect += n;
+    return n;
+}
+
+// see if the given field can be accessed directly through extmem() instead of dma cycles
+// caller must have the cmem controller locked so none of our own dma cycles are in progress
+//  input:
+//   field = 3-bit field number
+//  output:
+//   returns true: field is in the FPGA's 32K RAM and nothing is watching or using the memory bus
+bool Z8LPage::directok (uint16_t field)
+{
+    if (nodirect) return false;
+    if (xmemat == NULL) xmemat = findev ("XM", NULL, NULL, false);
+
+    uint32_t xm1 = xmemat[1];
+    if (! (xm1 & XM_ENLO4K) && ((field & 7) == 0)) return false;    // low 4K is in PDP-8/L core (or simulator's own 4K)
+    if (! (xm1 & XM_ENABLE) && ((field & 7) != 0)) return false;    // upper 28K not enabled
+    if (xm1 & XM_MWHOLD) return false;                              // z8lmctrace is watching memory writes
+
+    CMWAIT (! (cmemat[1] & CM_BUSY));
+    return ! (cmemat[2] & CM2_BRKCYCL);                             // some other device is doing a break cycle
+}
+
 // get exclusive access (co-operative) to pdp8lcmem.v device by the calling process
 void Z8LPage::cmlock ()
 {
@@ -238,8 +596,12 @@ void Z8LPage::cmlock ()
     while (true) {
         uint32_t lkpid;
         for (int i = 1000000; -- i >= 0;) {
-            cmemat[3] = mypid;
-            lkpid = cmemat[3];
+            if (simname != NULL) {
+                lkpid = simpagelock (&cmemat[3], mypid);
+            } else {
+                cmemat[3] = mypid;
+                lkpid = cmemat[3];
+            }
             if (lkpid == mypid) return;
         }
         uint32_t now = time (NULL);
@@ -250,7 +612,8 @@ void Z8LPage::cmlock ()
         }
         if ((lkpid != 0) && (kill (lkpid, 0) < 0) && (errno == ESRCH)) {
             fprintf (stderr, "Z8LPage::cmlock: pid %u died, releasing lock\n", lkpid);
-            cmemat[3] = lkpid;
+            if (simname != NULL) simpagelock (&cmemat[3], lkpid);
+                            else cmemat[3] = lkpid;
         }
     }
 }
@@ -261,7 +624,195 @@ void Z8LPage::cmunlk ()
     ASSERT (cmemat != NULL);
     uint32_t lkpid = cmemat[3];
     ASSERT (lkpid == mypid);
-    cmemat[3] = lkpid;
+    if (simname != NULL) simpagelock (&cmemat[3], lkpid);
+                    else cmemat[3] = lkpid;
+}
+
+// wait for a device register to change
+//  input:
+//   reg = register to wait on
+//   mask = bits of register to check
+//   value = current value of those bits
+//   timeoutus = max microseconds to wait
+//  output:
+//   returns true: (*reg & mask) != value
+//          false: timed out
+bool Z8LPage::waitdev (uint32_t volatile *reg, uint32_t mask, uint32_t value, uint32_t timeoutus)
+{
+    return waiter->waitdev (reg, mask, value, timeoutus);
+}
+
+// select backend for waitdev(), NULL for the default polling backend
+//  returns previous backend
+Z8LWaiter *Z8LPage::setwaiter (Z8LWaiter *newwaiter)
+{
+    Z8LWaiter *oldwaiter = waiter;
+    waiter = (newwaiter == NULL) ? &pollwaiter : newwaiter;
+    return oldwaiter;
+}
+
+Z8LWaiter *Z8LPage::getwaiter ()
+{
+    return waiter;
+}
+
+static uint64_t getnowns ()
+{
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0) ABORT ();
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+Z8LWaiter::Z8LWaiter ()
+{
+    waits = 0;
+    spinhits = 0;
+    timeouts = 0;
+    latncount = 0;
+    latnanos = 0;
+}
+
+Z8LWaiter::~Z8LWaiter ()
+{ }
+
+// something wrote a register being waited on
+// polling backend finds out on its own
+void Z8LWaiter::notify ()
+{ }
+
+// spin at most this long before sleeping
+// no point spinning on a single-core processor as nothing else can run to change the register
+#if UNIPROC
+#define MAXSPINUS 0
+#else
+#define MAXSPINUS 200
+#endif
+#define MINSLEEPUS 20
+#define MAXSLEEPUS 1000
+
+Z8LPollWaiter::Z8LPollWaiter ()
+{
+    spinus = MAXSPINUS / 4;
+}
+
+// spin for spinus then sleep in doubling steps up to MAXSLEEPUS
+// spinus grows when changes are seen while spinning and shrinks when they aren't
+// several threads can share the waiter (eg z8lrk8je i/o and helper threads)
+// ...so spinus and the counters are accessed atomically
+bool Z8LPollWaiter::waitdev (uint32_t volatile *reg, uint32_t mask, uint32_t value, uint32_t timeoutus)
+{
+    __atomic_fetch_add (&waits, 1, __ATOMIC_RELAXED);
+    if ((*reg & mask) != value) {
+        __atomic_fetch_add (&spinhits, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    uint32_t myspinus = __atomic_load_n (&spinus, __ATOMIC_RELAXED);
+    uint64_t nowns  = getnowns ();
+    uint64_t stopns = nowns + timeoutus * 1000ULL;
+    uint64_t spinns = nowns + ((myspinus < timeoutus) ? myspinus : timeoutus) * 1000ULL;
+    while (nowns < spinns) {
+        if ((*reg & mask) != value) {
+            __atomic_fetch_add (&spinhits, 1, __ATOMIC_RELAXED);
+            myspinus += myspinus / 2 + 1;
+            if (myspinus > MAXSPINUS) myspinus = MAXSPINUS;
+            __atomic_store_n (&spinus, myspinus, __ATOMIC_RELAXED);
+            return true;
+        }
+        nowns = getnowns ();
+    }
+    __atomic_store_n (&spinus, myspinus / 2, __ATOMIC_RELAXED);
+
+    uint32_t sleepus = MINSLEEPUS;
+    while (nowns < stopns) {
+        uint64_t leftus = (stopns - nowns + 999) / 1000;
+        usleep ((sleepus < leftus) ? sleepus : leftus);
+        if ((*reg & mask) != value) return true;
+        if (sleepus < MAXSLEEPUS) sleepus *= 2;
+        nowns = getnowns ();
+    }
+    __atomic_fetch_add (&timeouts, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+Z8LCondWaiter::Z8LCondWaiter ()
+{
+    notifyns = 0;
+    if (pthread_cond_init (&cond, NULL) != 0) ABORT ();
+    if (pthread_mutex_init (&lock, NULL) != 0) ABORT ();
+}
+
+Z8LCondWaiter::~Z8LCondWaiter ()
+{
+    pthread_cond_destroy (&cond);
+    pthread_mutex_destroy (&lock);
+}
+
+// sleep until notify() is called and the register has changed
+bool Z8LCondWaiter::waitdev (uint32_t volatile *reg, uint32_t mask, uint32_t value, uint32_t timeoutus)
+{
+    struct timespec ts;
+    if (clock_gettime (CLOCK_REALTIME, &ts) < 0) ABORT ();
+    uint64_t stopns = ts.tv_sec * 1000000000ULL + ts.tv_nsec + timeoutus * 1000ULL;
+    ts.tv_sec  = stopns / 1000000000;
+    ts.tv_nsec = stopns % 1000000000;
+
+    if (pthread_mutex_lock (&lock) != 0) ABORT ();
+    waits ++;
+    bool changed = (*reg & mask) != value;
+    if (changed) spinhits ++;
+    while (! changed) {
+        int rc = pthread_cond_timedwait (&cond, &lock, &ts);
+        changed = (*reg & mask) != value;
+        if (changed) {
+            latnanos += getnowns () - notifyns;
+            latncount ++;
+        } else if (rc == ETIMEDOUT) {
+            timeouts ++;
+            break;
+        } else if (rc != 0) ABORT ();
+    }
+    pthread_mutex_unlock (&lock);
+    return changed;
+}
+
+// call after writing a register that something might be waiting on
+void Z8LCondWaiter::notify ()
+{
+    if (pthread_mutex_lock (&lock) != 0) ABORT ();
+    notifyns = getnowns ();
+    if (pthread_cond_broadcast (&cond) != 0) ABORT ();
+    pthread_mutex_unlock (&lock);
+}
+
+// try to lock the given file
+// used for disk and tape files so two programs don't access one at the same time
+//  input:
+//   fd = file to lock
+//   how = F_WRLCK: exclusive access
+//         F_RDLCK: shared access
+//  output:
+//   returns NULL: successful
+//           else: error message, caller must free()
+char *lockfile (int fd, int how)
+{
+    struct flock flockit;
+
+trylk:;
+    memset (&flockit, 0, sizeof flockit);
+    flockit.l_type   = how;
+    flockit.l_whence = SEEK_SET;
+    flockit.l_len    = 4096;
+    if (fcntl (fd, F_SETLK, &flockit) >= 0) return NULL;
+
+    char *errmsg = NULL;
+    if (((errno == EACCES) || (errno == EAGAIN)) && (fcntl (fd, F_GETLK, &flockit) >= 0)) {
+        if (flockit.l_type == F_UNLCK) goto trylk;
+        if (asprintf (&errmsg, "locked by pid %d", (int) flockit.l_pid) < 0) ABORT ();
+    } else {
+        if (asprintf (&errmsg, "%m") < 0) ABORT ();
+    }
+    return errmsg;
 }
 
 // format shadow string
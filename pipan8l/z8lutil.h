@@ -21,6 +21,7 @@
 #ifndef _Z8LUTIL_H
 #define _Z8LUTIL_H
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,6 +29,42 @@
 #define ABORT() do { fprintf (stderr, "abort() %s:%d\n", __FILE__, __LINE__); abort (); } while (0)
 #define ASSERT(cond) do { if (__builtin_constant_p (cond)) { if (!(cond)) asm volatile ("assert failure line %c0" :: "i"(__LINE__)); } else { if (!(cond)) ABORT (); } } while (0)
 
+// backend for Z8LPage::waitdev()
+struct Z8LWaiter {
+    Z8LWaiter ();
+    virtual ~Z8LWaiter ();
+    virtual bool waitdev (uint32_t volatile *reg, uint32_t mask, uint32_t value, uint32_t timeoutus) = 0;
+    virtual void notify ();
+
+    uint64_t waits;             // number of waitdev() calls
+    uint64_t spinhits;          // ... satisfied while spinning
+    uint64_t timeouts;          // ... that timed out
+    uint64_t latncount;         // number of wakeups with measured latency
+    uint64_t latnanos;          // total nanoseconds from notify() to wakeup
+};
+
+// polls the register, spins a little first then sleeps in increasing steps
+struct Z8LPollWaiter : Z8LWaiter {
+    Z8LPollWaiter ();
+    virtual bool waitdev (uint32_t volatile *reg, uint32_t mask, uint32_t value, uint32_t timeoutus);
+
+private:
+    uint32_t spinus;            // current spin time, adapted to recent results
+};
+
+// software backend, sleeps until whoever writes the registers calls notify()
+struct Z8LCondWaiter : Z8LWaiter {
+    Z8LCondWaiter ();
+    virtual ~Z8LCondWaiter ();
+    virtual bool waitdev (uint32_t volatile *reg, uint32_t mask, uint32_t value, uint32_t timeoutus);
+    virtual void notify ();
+
+private:
+    pthread_cond_t cond;
+    pthread_mutex_t lock;
+    uint64_t notifyns;
+};
+
 struct Z8LPage {
     Z8LPage ();
     virtual ~Z8LPage ();
@@ -37,8 +74,25 @@ struct Z8LPage {
 
     uint32_t dmacycle (uint32_t cm, uint32_t cm2);
     void dmaflush ();
+    void dmaread (uint16_t xaddr, uint16_t *buf, int nwords);
+    void dmawrite (uint16_t xaddr, uint16_t const *buf, int nwords);
+    int dma3read (uint16_t xaddr, uint16_t *buf, int nwords, uint32_t cm2, bool *wcovf);
+    int dma3write (uint16_t xaddr, uint16_t const *buf, int nwords, uint32_t cm2, bool *wcovf);
+    double dmarate ();
+    void xferread (uint16_t xaddr, uint16_t *buf, int nwords);
+    void xferwrite (uint16_t xaddr, uint16_t const *buf, int nwords);
+    int xfer3read (uint16_t xaddr, uint16_t *buf, int nwords, bool *wcovf);
+    int xfer3write (uint16_t xaddr, uint16_t const *buf, int nwords, bool *wcovf);
     void cmlock ();
     void cmunlk ();
+    bool waitdev (uint32_t volatile *reg, uint32_t mask, uint32_t value, uint32_t timeoutus);
+    Z8LWaiter *setwaiter (Z8LWaiter *newwaiter);
+    Z8LWaiter *getwaiter ();
+
+    uint64_t dmawords;          // words transferred by dmaread(), dmawrite(), dma3read(), dma3write()
+    uint64_t dmananos;          // nanoseconds spent doing those transfers
+    uint64_t xferdirect;        // words transferred by xfer...() directly through extmem()
+    uint64_t xferdma;           // words transferred by xfer...() with dma cycles
 
 private:
     int zynqfd;
@@ -48,11 +102,25 @@ private:
     uint32_t volatile *zynqpage;
     void *extmemptr;
     void *zynqptr;
+    Z8LWaiter *waiter;
+    Z8LPollWaiter pollwaiter;
+
+    uint32_t cmcycle (uint32_t cm, uint32_t cm2);
+    void cmwrite (uint32_t cm);
+    void dmacount (int nwords, uint64_t startns);
+    bool directok (uint16_t field);
 
     static uint32_t mypid;
 };
 
 char *formatshadow (uint32_t volatile *shat);
+char *lockfile (int fd, int how);
 uint32_t randbits (int nbits);
 
+int simpageopen (char const *name);
+uint32_t simpagelock (uint32_t volatile *cell, uint32_t pid);
+void simpagecmwrite (uint32_t volatile *cell, uint32_t cm);
+uint16_t simrkiot (uint32_t volatile *rkat, uint16_t opcode, uint16_t ac, bool *skip);
+uint16_t simtciot (uint32_t volatile *tcat, uint16_t opcode, uint16_t ac, bool *skip);
+
 #endif